@@ -0,0 +1,76 @@
+#ifndef AUTH_H
+#define AUTH_H
+
+#include <stddef.h>
+#include "common.h"
+
+// Austauschbarer Anbieter für LOGIN (Start-Option -a):
+//   ldap      Bind gegen den LDAP Server, asynchron im epoll-Modus (Standard)
+//   htpasswd  Lokale Benutzerdatei mit bcrypt/yescrypt Hashes, ohne Netzwerk
+//             (Staging, Benchmarks); wird bei SIGHUP neu geladen, crypt()
+//             läuft im epoll-Modus in eigenen Threads
+//
+// Ein Login läuft immer über start(); liefert er AUTH_PENDING, wartet der
+// Reactor auf fd() bzw. höchstens remaining_ms() und ruft dann poll().
+
+#define AUTH_PASSWORD_LEN 256
+#define AUTH_DIGEST_LEN 32          // SHA-256 für Caches erfolgreicher Logins
+
+struct ldap; // LDAP aus <ldap.h>
+struct htpasswd_job;
+
+enum auth_status
+{
+    AUTH_FAILED,
+    AUTH_OK,
+    AUTH_PENDING        // Antwort steht aus: bei Aktivität auf fd() pollen
+};
+
+// Ein laufender Login. Das Passwort wird nach Abschluss überschrieben.
+struct auth_request
+{
+    char user[USER_LEN + 1];
+    char password[AUTH_PASSWORD_LEN];
+    long deadline_ms;
+
+    // Nur ldap
+    struct ldap *ld;
+    int msgid;
+    int pooled;
+    int connecting;     // Wartet auf eine Verbindung, die im Hintergrund aufgebaut wird
+    int blocking;       // authenticate(): Verbindung selbst aufbauen statt zu warten
+    char user_dn[256];
+
+    // Nur htpasswd
+    struct htpasswd_job *job;
+};
+
+struct auth_provider
+{
+    const char *name;
+
+    int (*init)(void);          // Vor fork(): Cache anlegen bzw. Benutzerdatei laden
+    void (*warm)(void);         // Im Prozess, der die Logins bedient; NULL = nichts vorzubereiten
+    int (*authenticate)(const char *username, const char *password);   // Blockierend, 1 = OK
+    enum auth_status (*start)(struct auth_request *req, const char *username, const char *password);
+    enum auth_status (*poll)(struct auth_request *req);                 // Blockiert nie
+    int (*fd)(const struct auth_request *req);                          // -1 = unbekannt, zeitgesteuert pollen
+    long (*remaining_ms)(const struct auth_request *req);
+    void (*cancel)(struct auth_request *req);
+    int (*reload)(void);        // Nach SIGHUP, 0 = alte Daten bleiben aktiv; NULL = nichts zu laden
+};
+
+extern const struct auth_provider ldap_provider;
+extern const struct auth_provider htpasswd_provider;
+
+int auth_select(const char *name);      // Vor fork() aufrufen; 0 = unbekannter Anbieter
+const struct auth_provider *auth(void);
+
+// Gesalzener Hash eines Passworts für Login-Caches (nie das Passwort selbst speichern)
+int auth_password_digest(const unsigned char *salt, size_t salt_len, const char *password, unsigned char *out);
+
+// SIGHUP merken; die Event-Loops rufen auth_reload_requested() und laden dann neu
+void auth_watch_reload(void);
+int auth_reload_requested(void);        // 1 = SIGHUP seit dem letzten Aufruf
+
+#endif
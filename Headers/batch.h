@@ -0,0 +1,35 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+
+// Nicht-interaktiver Modus des Clients (twmailer-client -b <datei|->).
+// Alle Commands werden ohne auf Antworten zu warten hintereinander
+// geschickt (Pipelining), der Server beantwortet sie in derselben
+// Reihenfolge. Schreiben und Lesen laufen gleichzeitig über poll(),
+// damit keine Seite mit vollem Socket-Puffer hängen bleibt.
+//
+// Eine Zeile pro Command, '#' leitet Kommentare ein:
+//   LIST [<parameter>...]            (z.B. LIST order=desc limit=20, siehe common.h)
+//   READ <nr> | READ <von>-<bis>    (Bereiche als MREAD)
+//   DEL <nr>  | DEL <von>-<bis>     (Bereiche als MDEL, Blöcke von hinten,
+//                                    damit die Nummern gültig bleiben)
+//   SEND <empfänger>[,<empfänger>...] <betreff>   (mehrere Empfänger als MSEND)
+//   <text>...                     (Zeilen beliebig lang, geht als SEND <bytes>)
+//   .
+// Nummern beziehen sich auf den Stand, wenn der Command am Server ankommt.
+
+#define BATCH_MAX_RANGE 100000  // Nummern pro READ/DEL Bereich
+
+struct batch;
+struct ssl_st;
+struct wire_compress;
+
+struct batch *batch_load(FILE *input);  // NULL = Syntaxfehler (mit Meldung) oder kein Speicher
+void batch_free(struct batch *b);
+// Meldet user an und führt alle Commands aus; 1 = alle OK, 0 = mind. ein Fehler
+// tls: fertig aufgebaute Verbindung oder NULL (unverschlüsselt)
+// wire: ausgehandelte Kompression (liegt über tls) oder NULL
+int batch_run(struct batch *b, int sock, struct ssl_st *tls, struct wire_compress *wire, const char *user, const char *password);
+
+#endif
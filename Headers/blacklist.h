@@ -0,0 +1,25 @@
+#ifndef BLACKLIST_H
+#define BLACKLIST_H
+
+#include <time.h>
+
+// IP-Blacklist nach zu vielen fehlgeschlagenen Logins.
+// Hash-Tabelle (binäre IPv4/IPv6 Adresse -> Ablaufzeit) in Shared Memory,
+// damit alle geforkten Kinder dieselben Einträge sehen. Die Prüfung beim
+// Verbindungsaufbau ist O(1), unabhängig von der Größe der Liste.
+// blacklist.txt bleibt die persistente Kopie: neue Einträge werden sofort
+// angehängt, ein Hintergrundprozess entfernt abgelaufene Einträge und
+// schreibt die Datei neu.
+
+#define BLACKLIST_FILE "blacklist.txt"
+#define BLACKLIST_DURATION 60
+#define BLACKLIST_SLOTS 16384           // Zweierpotenz
+#define BLACKLIST_REAP_INTERVAL 30      // Sekunden zwischen zwei Aufräumläufen
+
+int blacklist_init(void);               // Vor fork(): Tabelle anlegen und BLACKLIST_FILE laden
+int blacklist_contains(const char *ip);
+void blacklist_add(const char *ip);     // Für BLACKLIST_DURATION Sekunden sperren
+void blacklist_reap(void);              // Abgelaufene entfernen, Datei neu schreiben
+void blacklist_start_reaper(void);
+
+#endif
@@ -16,6 +16,61 @@
 #define CMD_DEL "DEL"
 #define CMD_QUIT "QUIT"
 
+// Mehrere Nachrichten pro Command (eine Zeile nach dem Command):
+//   MREAD  <nummern>          z.B. 1,4,7-12 → <anzahl>, dann pro Nummer OK + Inhalt + "." oder ERR
+//   MDEL   <nummern>          Alle oder keine, Nummern vor dem Löschen → OK oder ERR
+//   MSEND  <empf>,<empf>,...  Wie SEND, das ebenfalls Listen annimmt
+//                             (der Text wird einmal gespeichert, siehe delivery.h)
+
+#define CMD_MREAD "MREAD"
+#define CMD_MDEL "MDEL"
+#define CMD_MSEND "MSEND"
+
+// SEND/MSEND mit Längenangabe statt Zeilen bis ".":
+//   SEND <bytes>, Empfänger, Betreff, dann genau <bytes> Bytes Text ohne "." am Ende
+// Zeilen dürfen beliebig lang sein, nur eine Zeile "." nicht (READ endet dort).
+// Ungültige oder zu große Länge → ERR, danach wird die Verbindung geschlossen.
+
+#define SEND_MAX_BODY_LEN (64UL * 1024 * 1024)
+
+// Erweiterungen abfragen und die Verbindung komprimieren (jederzeit, auch vor LOGIN):
+//   CAPA                → <anzahl>, dann eine Zeile pro Erweiterung (wie LIST)
+//   COMPRESS <verfahren> (nächste Zeile, z.B. DEFLATE) → OK oder ERR
+// Nach OK ist alles, was der Client nach der Verfahrens-Zeile schickt, und
+// alles, was der Server nach "OK\n" schickt, raw deflate (RFC 1951) mit
+// Sync-Flush nach jedem Block (siehe compress.h). Ältere Server antworten
+// auf CAPA mit ERR; der Client bleibt dann unkomprimiert.
+
+#define CMD_CAPA "CAPA"
+#define CMD_COMPRESS "COMPRESS"
+#define COMPRESS_DEFLATE "DEFLATE"
+#define CAPA_COMPRESS_DEFLATE CMD_COMPRESS " " COMPRESS_DEFLATE
+#define CAPA_SEND_BYTES "SEND-BYTES"
+
+// LIST mit Parametern in derselben Zeile (Ausschnitt, Filter, Sortierung):
+//   LIST [offset=<n>] [limit=<n>] [since=<id>] [from=<user>] [order=asc|desc] [subject=<text>]
+//   → "<anzahl> <gesamt>", dann pro Treffer "<nummer> <id> <absender> <betreff>"
+// <nummer> gilt für READ/DEL, <id> bleibt auch nach DEL gleich (für since=).
+// subject= sucht ohne Groß/Klein im Betreff und nimmt den Rest der Zeile.
+// Ohne limit= höchstens LIST_MAX_LIMIT Treffer; LIST ohne Parameter antwortet wie bisher.
+
+#define LIST_PARAM_OFFSET "offset"
+#define LIST_PARAM_LIMIT "limit"
+#define LIST_PARAM_SINCE "since"
+#define LIST_PARAM_FROM "from"
+#define LIST_PARAM_ORDER "order"
+#define LIST_PARAM_SUBJECT "subject"
+#define LIST_ORDER_ASC "asc"
+#define LIST_ORDER_DESC "desc"
+#define LIST_MAX_LIMIT 1000
+#define CAPA_LIST_QUERY "LIST-QUERY"
+
+#define LIST_SEPARATOR ','
+#define RANGE_SEPARATOR '-'
+#define MREAD_MAX_MESSAGES 64       // Jede Nachricht hält bis zum Senden einen Datei-Deskriptor
+#define MDEL_MAX_MESSAGES 1000
+#define MSEND_MAX_RECIPIENTS 32
+
 // Server Responses
 
 #define RESP_OK "OK"
@@ -0,0 +1,76 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Komprimierte Ablage von Nachrichtentexten (Start-Option -z none|gzip[:stufe]).
+// Die Kopfzeilen bleiben lesbar, damit Index-Neuaufbau und Migration sie wie
+// bisher parsen; eine zusätzliche Zeile markiert den gzip-Text dahinter:
+//   Sender: ...\nReceiver: ...\nSubject: ...\nEncoding: gzip\n\n<gzip>
+// Der Index merkt sich das als MI_FLAG_COMPRESSED, LIST liest nie Inhalte.
+// READ entpackt blockweise beim Senden (outbuf Stream-Chunk), die Länge des
+// Klartexts steht im gzip-Trailer. Unkomprimierte Nachrichten gehen weiter
+// per sendfile() hinaus, beide Formate können gemischt vorkommen.
+//
+// Bestehende .msg Dateien komprimiert "twmailer-migrate <dir> --compress"
+// (auch bei laufendem Server).
+//
+// Unabhängig davon kann die Verbindung selbst komprimiert werden (COMPRESS
+// DEFLATE, siehe common.h): wire_* liegt zwischen Line Reader/Ausgabepuffer
+// und Socket bzw. TLS.
+
+#define COMPRESS_ENCODING_LINE "Encoding: gzip"
+#define COMPRESS_DEFAULT_LEVEL 6
+#define COMPRESS_BUFFER_SIZE (16 * 1024)
+#define MESSAGE_HEADER_MAX 512          // Kopfzeilen inkl. Leerzeile (Receiver mit MSEND_MAX_RECIPIENTS)
+
+int compress_configure(const char *spec);   // "none", "gzip" oder "gzip:<1-9>"; vor fork()
+int compress_enabled(void);
+
+// Schreibt alles durch gzip nach raw; fclose() beendet den Stream, raw bleibt offen
+FILE *compress_writer(FILE *raw);
+
+// Lage einer komprimierten Nachricht
+struct compressed_message
+{
+    char header[MESSAGE_HEADER_MAX];    // Kopfzeilen ohne Encoding-Zeile, mit Leerzeile
+    size_t header_len;
+    off_t body_offset;                  // gzip-Stream
+    size_t body_length;
+    size_t plain_length;                // Länge nach dem Entpacken
+};
+
+// 1 = komprimierte Nachricht erkannt, 0 = unkomprimiert oder unlesbar
+int compress_open_message(int fd, off_t offset, size_t length, struct compressed_message *out);
+
+// Entpackt den gzip-Stream blockweise (für ob_append_stream); übernimmt fd.
+// Speicher für zlib entsteht erst beim ersten Lesen.
+void *inflate_stream_open(int fd, const struct compressed_message *message);
+ssize_t inflate_stream_read(void *stream, void *buf, size_t len);   // 0 = Ende, -1 = Fehler
+void inflate_stream_close(void *stream);
+
+// -=- Komprimierte Verbindung (COMPRESS DEFLATE) -=-
+
+// Raw deflate (RFC 1951) in beide Richtungen, Z_SYNC_FLUSH nach jedem Schreiben:
+// alles Geschriebene kann die Gegenseite sofort entpacken.
+typedef ssize_t (*wire_read_fn)(void *ctx, void *buf, size_t len);          // Wie read()
+typedef ssize_t (*wire_write_fn)(void *ctx, const void *buf, size_t len);   // Wie write()
+
+struct wire_compress;
+
+// Untere Schicht: lower_read/lower_write (z.B. TLS) oder NULL = read()/send() auf fd.
+// pending: schon gelesene, noch komprimierte Bytes (Rest im Line Reader nach dem Umschalten)
+struct wire_compress *wire_compress_new(int fd, wire_read_fn lower_read, void *read_ctx,
+                                        wire_write_fn lower_write, void *write_ctx,
+                                        const void *pending, size_t pending_len);
+// Wie read()/write(), auch nicht-blockierend (-1 mit errno EAGAIN). Nach EAGAIN muss
+// wire_write() wieder mit denselben Daten aufgerufen werden (wie bei SSL_write)
+ssize_t wire_read(void *wire, void *buf, size_t len);
+ssize_t wire_write(void *wire, const void *buf, size_t len);
+void wire_compress_stats(const struct wire_compress *w, uint64_t *plain, uint64_t *compressed);
+void wire_compress_free(struct wire_compress *w);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef DELIVERY_H
+#define DELIVERY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "mailbox.h"
+
+// Absturzsichere Zustellung im maildir-Stil:
+// Nachricht nach <user>/tmp/<id>.msg schreiben, auf die Platte bringen,
+// per link() atomar als <user>/<id>.msg veröffentlichen, dann indexieren.
+//
+// Sync-Modi (Start-Option -d):
+//   none   kein fsync (Verhalten wie früher, nur für Tests)
+//   fsync  fsync() der Datei und des Verzeichnisses pro Nachricht
+//   group  Group Commit: gleichzeitige Zustellungen teilen sich ein syncfs()
+//
+// Eine Nachricht an mehrere Empfänger wird nur einmal geschrieben: die
+// tmp-Dateien der weiteren Empfänger sind Hardlinks auf die des ersten
+// (delivery_begin_shared). Alle Mailboxen verweisen so auf denselben Inhalt,
+// DEL entfernt nur den eigenen Link; der Inhalt verschwindet mit dem letzten.
+//
+// Mit -z gzip schreibt delivery_write_header() nach den Kopfzeilen durch
+// einen gzip-Stream weiter (compress.h), der Index bekommt MI_FLAG_COMPRESSED.
+
+#define DELIVERY_TMP_DIR "tmp"
+
+enum delivery_sync_mode
+{
+    SYNC_NONE,
+    SYNC_FSYNC,
+    SYNC_GROUP
+};
+
+struct mail_delivery
+{
+    FILE *file;
+    FILE *raw;                              // Datei in tmp/, wenn file komprimiert
+    const char *mail_dir;
+    char user[USER_LEN + 1];
+    char tmp_path[256];
+    char final_path[256];
+    struct mail_index_record record;
+    const struct mail_delivery *source;     // Geteilter Inhalt: Zustellung, die die Datei schreibt
+};
+
+int delivery_set_sync_mode(const char *name);   // Vor fork() aufrufen; 0 = unbekannter Modus
+enum delivery_sync_mode delivery_sync_mode(void);
+
+int delivery_begin(struct mail_delivery *d, const char *mail_dir, const char *user);
+// Weiterer Empfänger desselben Inhalts; source muss vor d geschlossen werden
+int delivery_begin_shared(struct mail_delivery *d, const char *mail_dir, const char *user, const struct mail_delivery *source);
+// Kopfzeilen schreiben (nur die erste Zustellung eines Inhalts); danach geht der Text nach d->file
+int delivery_write_header(struct mail_delivery *d, const char *sender, const char *receivers, const char *subject);
+void delivery_abort(struct mail_delivery *d);
+int delivery_commit(struct mail_delivery *d);       // Schreiben, sync, veröffentlichen, indexieren
+
+// Für gebündelte Commits (epoll-Modus): close für alle, ein delivery_barrier(),
+// publish für alle, noch ein delivery_barrier()
+int delivery_close(struct mail_delivery *d);
+int delivery_publish(struct mail_delivery *d);
+int delivery_barrier(const char *mail_dir);
+
+void delivery_recover(const char *mail_dir);    // Beim Start: tmp/ aufräumen, Indizes prüfen
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef HTPASSWD_H
+#define HTPASSWD_H
+
+// Lokaler Anmelde-Anbieter (-a htpasswd) für Staging und Benchmarks.
+// Eine Zeile pro Benutzer: <user>:<hash>, '#' leitet Kommentare ein.
+// Akzeptiert werden alle starken Verfahren von crypt(3), z.B. bcrypt
+// ($2b$/$2y$, erzeugt mit "htpasswd -nbB -C 10 user pass") oder yescrypt ($y$).
+//
+// Die Datei wird beim Start in den Speicher geladen und bei SIGHUP neu
+// eingelesen; ist die neue Datei fehlerhaft, bleibt die alte aktiv.
+// Nach einem erfolgreichen crypt() merkt sich der Prozess nur einen
+// gesalzenen SHA-256 des Passworts, damit wiederholte Logins (epoll,
+// prefork) nicht jedes Mal die teure Hash-Funktion durchlaufen.
+//
+// crypt() braucht zehn bis hunderte Millisekunden. Im epoll-Modus läuft es
+// deshalb in HTPASSWD_WORKERS Threads pro Prozess: start() liefert
+// AUTH_PENDING, fd() ist ein eventfd, das der Thread nach dem Hash auslöst.
+//
+// Start-Option -H <Datei> (Standard: HTPASSWD_DEFAULT_FILE)
+
+#define HTPASSWD_DEFAULT_FILE "users.htpasswd"
+#define HTPASSWD_HASH_LEN 128
+#define HTPASSWD_SALT_LEN 16
+#define HTPASSWD_WORKERS 2              // crypt()-Threads pro Prozess (epoll/prefork)
+#define HTPASSWD_POLL_MS 1000           // Ohne eventfd bzw. als Sicherheitsnetz so oft abfragen
+
+int htpasswd_set_file(const char *path);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef LDAPAUTH_H
+#define LDAPAUTH_H
+
+#include "common.h"
+#include "auth.h"
+
+// LDAP Authentifizierung für LOGIN (Anbieter "ldap", siehe auth.h).
+// Verbindungen (inkl. StartTLS) werden in einem Pool pro Prozess gehalten und
+// für jeden Login nur neu gebunden. Optional merkt sich ein Cache im Shared
+// Memory erfolgreiche Logins für kurze Zeit: gespeichert wird nur ein
+// gesalzener SHA-256 Hash, nie das Passwort.
+//
+// Der Bind läuft asynchron (ldap_sasl_bind + ldap_result): im epoll-Modus
+// wartet die Session auf den LDAP Socket, statt den Event-Loop zu blockieren.
+// Verbindungsaufbau und StartTLS blockieren in libldap; sie laufen deshalb in
+// einem eigenen Thread pro Prozess, der den Pool füllt. Ist der Pool leer,
+// wartet der Login auf die nächste Verbindung (bzw. scheitert sofort, solange
+// der Server als nicht erreichbar gilt).
+//
+// Start-Optionen:
+//   -L  LDAP URI                 (Standard: LDAP_DEFAULT_URI)
+//   -U  DN-Vorlage mit einem %s  (Standard: LDAP_DEFAULT_DN_TEMPLATE)
+//   -T  kein StartTLS (z.B. lokaler slapd zum Testen)
+//   -C  Cache-Dauer in Sekunden  (0 = aus, Standard)
+//   -A  Timeout für einen Login in Sekunden (Standard: LDAP_AUTH_TIMEOUT)
+
+#define LDAP_DEFAULT_URI "ldap://ldap.technikum-wien.at:389"
+#define LDAP_DEFAULT_DN_TEMPLATE "uid=%s,ou=people,dc=technikum-wien,dc=at"
+
+#define LDAP_POOL_SIZE 8            // Gebundene Verbindungen, die pro Prozess offen bleiben
+#define LDAP_NETWORK_TIMEOUT 5      // Sekunden für Verbindungsaufbau
+#define LDAP_CACHE_SLOTS 1024
+#define LDAP_CACHE_SALT_LEN 16
+#define LDAP_CACHE_MAX_TTL 3600
+#define LDAP_AUTH_TIMEOUT 10
+#define LDAP_RETRY_BACKOFF 5        // Sekunden ohne neuen Verbindungsversuch nach einem Fehler
+int ldap_auth_set_uri(const char *uri);
+int ldap_auth_set_dn_template(const char *dn_template);    // 0 = kein bzw. mehr als ein %s
+void ldap_auth_set_starttls(int enabled);
+int ldap_auth_set_cache_ttl(const char *seconds);
+int ldap_auth_set_timeout(const char *seconds);
+
+#endif
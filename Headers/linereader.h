@@ -0,0 +1,41 @@
+#ifndef LINEREADER_H
+#define LINEREADER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Gepufferter Zeilenleser für Server und Client.
+// Liest große Blöcke per read() und liefert Zeilen als Views direkt im Puffer
+// (mit '\0' statt '\n' terminiert). Eine View bleibt gültig bis zum nächsten
+// Aufruf einer lr_*-Funktion auf demselben Reader.
+// Mit lr_set_source() kommen die Daten statt per read() z.B. aus TLS.
+
+#define LR_BUFFER_SIZE (64 * 1024)
+
+typedef ssize_t (*lr_read_fn)(void *ctx, void *buf, size_t len);   // Semantik wie read()
+
+struct line_reader
+{
+    int fd;
+    lr_read_fn read_fn; // NULL = read(fd)
+    void *read_ctx;
+    char *buf;          // Wird erst beim ersten Lesen angelegt
+    size_t head;        // Beginn der ungelesenen Daten
+    size_t tail;        // Ende der gültigen Daten
+    size_t max_line;    // Längere Zeilen werden nach max_line - 1 Zeichen geteilt
+    size_t saved_pos;   // Für geteilte Zeilen überschriebenes Zeichen
+    char saved_char;
+    int has_saved;
+};
+
+void lr_init(struct line_reader *r, int fd, size_t max_line);
+void lr_set_source(struct line_reader *r, lr_read_fn read_fn, void *ctx);
+void lr_free(struct line_reader *r);
+void lr_shrink(struct line_reader *r);                              // Leeren Puffer freigeben (idle Verbindungen)
+ssize_t lr_fill(struct line_reader *r);                             // Ein read(): >0 Bytes, 0 EOF, -1 Fehler (errno)
+int lr_next_line(struct line_reader *r, char **line, size_t *len);  // 1 = Zeile, 0 = mehr Daten nötig
+int lr_read_line(struct line_reader *r, char **line, size_t *len);  // Blockierend: Länge oder -1 bei EOF/Fehler
+size_t lr_pending(const struct line_reader *r);                     // Gepufferte, noch nicht gelieferte Bytes
+size_t lr_take(struct line_reader *r, size_t max, char **data);     // Bis zu max gepufferte Bytes ohne Zeilentrennung
+
+#endif
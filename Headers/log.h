@@ -0,0 +1,45 @@
+#ifndef LOG_H
+#define LOG_H
+
+// Strukturiertes Logging mit Level. Aufrufer formatieren nur in einen Slot
+// eines lock-freien Ringpuffers pro Prozess; ein Flusher-Thread schreibt die
+// gesammelten Zeilen mit einem write() pro Runde auf stdout. Ganze Zeilen
+// pro write() = keine zerstückelten Ausgaben mehrerer Kinder.
+//
+// Start-Optionen:
+//   -l  Mindest-Level zur Laufzeit: debug, info (Standard), warn, error
+//   -J  Eine JSON-Zeile pro Eintrag statt Text
+//
+// Level unter LOG_COMPILE_LEVEL werden gar nicht erst übersetzt, z.B.
+//   make CFLAGS="-Wall -Wextra -std=c99 -O2 -DLOG_COMPILE_LEVEL=1"   (ohne DEBUG)
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_RING_SLOTS 4096         // Zweierpotenz
+#define LOG_MESSAGE_LEN 240         // Längere Meldungen werden abgeschnitten
+#define LOG_FLUSH_INTERVAL_MS 50    // Spätestens so oft schreibt der Flusher
+
+int log_set_level(const char *name);    // 0 = unbekanntes Level
+void log_set_json(int enabled);
+void log_flush(void);                   // Ring synchron leeren (vor _exit())
+
+// Nicht direkt aufrufen, sondern über die Makros unten
+extern int log_level;
+void log_write(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#define LOG_AT(level, ...) \
+    do { if ((level) >= LOG_COMPILE_LEVEL && (level) >= log_level) log_write((level), __VA_ARGS__); } while (0)
+
+#define log_debug(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define log_info(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_warn(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_error(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif
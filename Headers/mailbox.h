@@ -0,0 +1,98 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdint.h>
+#include "common.h"
+
+// Persistenter Index pro Mailbox (<mail_dir>/<user>/.index).
+// Aufbau: Header + Tombstone-Liste + Records fester Größe in Zustellreihenfolge.
+// DEL markiert einen Record nur als gelöscht (Tombstone) und trägt seine Position
+// in die Liste ein, damit READ N die Position ohne Durchlauf berechnen kann. Ist
+// die Liste voll oder sind zu viele Records gelöscht, wird der Index kompaktiert.
+// Fehlt der Index oder ist er beschädigt, wird er aus dem Speicher-Backend
+// (storage.h) neu aufgebaut.
+
+#define MAILBOX_INDEX_FILE ".index"
+#define MAILBOX_INDEX_MAGIC "TWMIDX1"
+#define MAILBOX_INDEX_VERSION 3
+#define MAILBOX_INDEX_TOMBSTONES 1024   // Plätze in der Tombstone-Liste, mindestens MDEL_MAX_MESSAGES
+
+#define MI_FLAG_DELETED 0x1
+#define MI_FLAG_COMPRESSED 0x2          // Text als gzip gespeichert (compress.h)
+
+// Zähler für Nachrichtennummern (<mail_dir>/<user>/.nextid, unter flock()).
+// Nummern werden nie wiederverwendet, auch nicht nach DEL.
+#define MAILBOX_COUNTER_FILE ".nextid"
+#define MAILBOX_CREATE_RETRIES 16
+
+struct mail_index_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t record_count;      // Inklusive Tombstones
+    uint32_t deleted_count;     // Gültige Einträge der Tombstone-Liste
+};
+
+struct mail_index_record
+{
+    uint32_t id;                        // Nachrichtennummer (file-Backend: <id>.msg)
+    uint32_t flags;
+    uint64_t offset;                    // Position im Speicher (eine Datei pro Nachricht: 0)
+    uint64_t size;                      // Größe der gespeicherten Nachricht in Bytes
+    char sender[USER_LEN + 1];
+    char subject[SUBJECT_LEN + 1];
+    uint32_t segment;                   // Segmentnummer (segment-Backend), sonst 0
+};
+
+// Wird für jeden nicht gelöschten Record aufgerufen (total = Anzahl Nachrichten); != 0 bricht ab
+typedef int (*mailbox_visit_fn)(const struct mail_index_record *record, uint32_t total, void *ctx);
+
+uint32_t mailbox_next_id(const char *mail_dir, const char *user);                  // 0 = Fehler
+
+int mailbox_index_prepare(const char *mail_dir, const char *user);  // Legt einen fehlenden Index an
+int mailbox_index_append(const char *mail_dir, const char *user, const struct mail_index_record *record);
+int mailbox_index_foreach(const char *mail_dir, const char *user, mailbox_visit_fn visit, void *ctx); // Besuchte Records, -1 bei Fehler
+int mailbox_index_get(const char *mail_dir, const char *user, int number, struct mail_index_record *out);
+// Nach id statt Nummer (linearer Durchlauf), z.B. wenn ein gemerkter Record inzwischen verschoben wurde
+int mailbox_index_get_id(const char *mail_dir, const char *user, uint32_t id, struct mail_index_record *out);
+
+// Ausschnitt der Mailbox für LIST mit Parametern (siehe common.h)
+struct mailbox_query
+{
+    uint32_t offset;                    // So viele Treffer überspringen
+    uint32_t limit;                     // Höchstens so viele Treffer (> 0)
+    uint32_t since_id;                  // Nur Nachrichten mit id > since_id (0 = alle)
+    char sender[USER_LEN + 1];          // Exakter Absender, leer = alle
+    char subject[SUBJECT_LEN + 1];      // Teil des Betreffs ohne Groß/Klein, leer = alle
+    int newest_first;
+};
+
+// Schreibt bis zu query->limit Treffer nach out, numbers[i] ist die Nummer für READ/DEL.
+// Ohne Filter und Tombstones wird nur der Ausschnitt gelesen, sonst läuft der Durchlauf
+// nur bis zum letzten benötigten Treffer. *total = Nachrichten in der Mailbox.
+// Rückgabe: Anzahl Treffer, -1 bei Fehler
+int mailbox_index_query(const char *mail_dir, const char *user, const struct mailbox_query *query,
+                        struct mail_index_record *out, int *numbers, uint32_t *total);
+int mailbox_index_delete(const char *mail_dir, const char *user, int number, struct mail_index_record *out);
+// Mehrere Nummern in einem Durchlauf unter einem Lock (MREAD/MDEL); found[i] = 0 für unbekannte Nummern
+int mailbox_index_get_many(const char *mail_dir, const char *user, const int *numbers, int count,
+                           struct mail_index_record *out, int *found);
+// Alle oder keine: fehlt eine Nummer, wird nichts gelöscht. Nummern ohne Duplikate,
+// alle beziehen sich auf den Stand vor dem Löschen. Rückgabe: Anzahl gelöschter Records
+// (count = alle, 0 = keiner). Bei einem Schreibfehler wird zurückgerollt; scheitert
+// auch das, sind genau out[0..Rückgabe-1] gelöscht und ihr Speicher muss weg
+int mailbox_index_delete_many(const char *mail_dir, const char *user, const int *numbers, int count,
+                              struct mail_index_record *out);
+int mailbox_index_rebuild(const char *mail_dir, const char *user);
+int mailbox_index_verify(const char *mail_dir, const char *user);  // Neuaufbau, falls Index und Backend abweichen
+// Neue Lage umkopierter Nachrichten eintragen (Kompaktierung); moved nach id sortiert
+int mailbox_index_relocate(const char *mail_dir, const char *user, const struct mail_index_record *moved, int count);
+// Neu geschriebene Nachrichten eintragen (Komprimierung); updated nach id sortiert. Für jeden
+// noch vorhandenen Record ruft replace() unter dem Lock apply(record, ctx) auf (z.B. rename()),
+// bei Erfolg werden size und flags übernommen. Rückgabe: Anzahl ersetzt, -1 bei Fehler
+typedef int (*mailbox_apply_fn)(const struct mail_index_record *updated, void *ctx);
+int mailbox_index_replace(const char *mail_dir, const char *user, const struct mail_index_record *updated, int count,
+                          mailbox_apply_fn apply, void *ctx);
+
+#endif
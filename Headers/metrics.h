@@ -0,0 +1,53 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+// Zähler und Latenz-Histogramme pro Command und pro Phase.
+// Die Werte liegen in Shared Memory und werden mit atomaren Additionen
+// aktualisiert, damit alle Kinder bzw. Worker in dieselben Zähler schreiben.
+// Ein eigener Prozess liefert sie im Prometheus Textformat aus.
+//
+// Start-Option -M [<ip>:]<port>, z.B. -M 9464 oder -M 127.0.0.1:9464
+// Ohne -M wird nichts gemessen.
+//
+// Buckets nach HDR-Art: zwei Stufen pro Zweierpotenz (1, 2, 3, 4, 6, 8, 12 ... µs)
+// bis 2^27 µs (gut 2 Minuten), darüber zählt nur +Inf.
+
+#define METRICS_BUCKETS 54
+#define METRICS_REQUEST_LEN 1024
+#define METRICS_RESPONSE_LEN (128 * 1024)
+
+enum metric_command
+{
+    METRIC_LOGIN,
+    METRIC_SEND,
+    METRIC_LIST,
+    METRIC_READ,
+    METRIC_DEL,
+    METRIC_MSEND,
+    METRIC_MREAD,
+    METRIC_MDEL,
+    METRIC_COMMANDS,
+    METRIC_NONE = METRIC_COMMANDS  // Kein Command aktiv
+};
+
+enum metric_phase
+{
+    PHASE_AUTH,         // LDAP Bind bzw. Cache-Treffer
+    PHASE_INDEX,        // Lesen/Ändern des Mailbox-Index
+    PHASE_FILE_IO,      // Nachricht anlegen, veröffentlichen, öffnen, löschen
+    PHASE_SOCKET_WRITE, // Ausgabepuffer zum Client leeren
+    METRIC_PHASES
+};
+
+int metrics_configure(const char *spec);    // 0 = ungültige Angabe
+int metrics_init(void);                     // Vor fork() aufrufen
+void metrics_start_server(void);            // Admin-Prozess für GET /metrics
+
+uint64_t metrics_now(void);                 // Monotone Zeit in ns, 0 wenn Metriken aus
+void metrics_observe_command(enum metric_command command, uint64_t start, int failed);
+void metrics_observe_phase(enum metric_phase phase, uint64_t start);
+void metrics_count_connection(int accepted);
+
+#endif
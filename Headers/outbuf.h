@@ -0,0 +1,67 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Ausgabepuffer pro Verbindung. Antworten werden in Chunks gesammelt und
+// einmal pro Command (bzw. bevor wieder auf Eingaben gewartet wird) mit
+// writev() verschickt, statt jedes Fragment einzeln zu write()n.
+// Nachrichteninhalte werden als Datei-Chunk eingereiht und mit sendfile()
+// direkt aus dem Page Cache gesendet, ohne Kopie in den Userspace.
+// Mit ob_set_writer() (TLS ohne kTLS) wird stattdessen Chunk für Chunk
+// geschrieben, Dateien über einen Zwischenpuffer.
+// Stream-Chunks (komprimierte Nachrichten) erzeugen ihre Daten erst beim
+// Senden blockweise, es liegt nie der ganze Klartext im Speicher.
+
+#define OB_CHUNK_SIZE (16 * 1024)
+#define OB_SMALL_CHUNK_SIZE 256         // Nach Datei-Chunks: meist nur ".\n" und das nächste "OK"
+#define OB_MAX_IOV 64
+#define OB_FLUSH_THRESHOLD (256 * 1024) // Blockierender Modus: ab hier sofort schreiben
+
+typedef ssize_t (*ob_write_fn)(void *ctx, const void *buf, size_t len);  // Semantik wie write()
+typedef ssize_t (*ob_stream_fn)(void *ctx, void *buf, size_t len);       // Wie read(), 0 = Ende
+typedef void (*ob_stream_close_fn)(void *ctx);
+
+struct ob_chunk
+{
+    struct ob_chunk *next;
+    int file_fd;        // >= 0: Datei-Chunk, len Bytes ab file_offset (data ist leer)
+    off_t file_offset;
+    ob_stream_fn stream;            // != NULL: Stream-Chunk, block hält den aktuellen Block
+    ob_stream_close_fn stream_close;
+    void *stream_ctx;
+    size_t stream_left;             // Noch nicht erzeugte Bytes
+    char *block;                    // OB_CHUNK_SIZE, erst angelegt wenn der Chunk vorne steht
+    size_t cap;
+    size_t len;
+    size_t sent;
+    char data[];
+};
+
+struct out_buffer
+{
+    int fd;
+    ob_write_fn write_fn;   // NULL = writev()/sendfile() auf fd
+    void *write_ctx;
+    struct ob_chunk *head;
+    struct ob_chunk *tail;
+    size_t pending;     // Noch nicht gesendete Bytes
+    int open_chunks;    // Datei- und Stream-Chunks, jeder hält spätestens beim Senden Deskriptor und Puffer
+};
+
+void ob_init(struct out_buffer *ob, int fd);
+void ob_set_writer(struct out_buffer *ob, ob_write_fn write_fn, void *ctx);
+void ob_free(struct out_buffer *ob);
+int ob_append(struct out_buffer *ob, const void *data, size_t len);   // 0 = OK, -1 = kein Speicher
+int ob_append_line(struct out_buffer *ob, const char *text);           // text + "\n"
+int ob_append_file(struct out_buffer *ob, int fd, off_t offset, size_t len); // Übernimmt fd (auch bei Fehler)
+// Übernimmt ctx (auch bei Fehler); der Stream muss genau len Bytes liefern.
+// stream wird erst aufgerufen, wenn der Chunk am Anfang der Liste steht
+int ob_append_stream(struct out_buffer *ob, ob_stream_fn stream, ob_stream_close_fn close_fn, void *ctx, size_t len);
+int ob_flush(struct out_buffer *ob);  // 0 = alles gesendet, 1 = Socket voll (EAGAIN), -1 = Fehler
+
+static inline size_t ob_pending(const struct out_buffer *ob) { return ob->pending; }
+static inline int ob_open_chunks(const struct out_buffer *ob) { return ob->open_chunks; }
+
+#endif
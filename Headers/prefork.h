@@ -0,0 +1,26 @@
+#ifndef PREFORK_H
+#define PREFORK_H
+
+// Pre-fork Modus (-m prefork): der Master startet beim Start N Worker-Prozesse.
+// Jeder Worker öffnet einen eigenen Listen-Socket mit SO_REUSEPORT (der Kernel
+// verteilt neue Verbindungen) und bedient seine Clients mit dem epoll-Reactor.
+// Kein fork() pro Client mehr; stirbt ein Worker, startet der Master ihn neu.
+//
+// Start-Optionen:
+//   -w  Anzahl Worker (Standard: Anzahl CPUs)
+//   -c  Maximale Verbindungen pro Worker (auch im epoll-Modus, 0 = unbegrenzt)
+//   -P  Worker i an CPU i pinnen
+
+#define PREFORK_MAX_WORKERS 256
+#define PREFORK_RESPAWN_DELAY 1     // Sekunden Pause, wenn ein Worker sofort wieder stirbt
+
+struct prefork_config
+{
+    int workers;
+    int max_connections;
+    int pin_cpus;
+};
+
+int prefork_run(int port, const char *mail_dir, const struct prefork_config *config);
+
+#endif
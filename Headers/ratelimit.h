@@ -0,0 +1,39 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Token-Bucket Limits pro Quell-IP und pro Benutzer.
+// Die Buckets liegen in einer lock-freien Hash-Tabelle in Shared Memory
+// (CAS auf Schlüssel und Zustand), damit alle geforkten Kinder dieselben
+// Zähler sehen. Geprüft wird, bevor LDAP oder die Platte angefasst werden.
+//
+// Start-Option -R <art>=<rate>[/<burst>], mehrfach angebbar, z.B.
+//   -R connect=20/40 -R login=1/5 -R send=10/30 -R bytes=1048576/16777216
+// rate = Tokens pro Sekunde, burst = Größe des Buckets (Standard: rate).
+// Ohne -R gibt es keine Limits.
+
+#define RL_SLOTS 65536              // Zweierpotenz
+#define RL_MAX_PROBES 16            // Tabelle voll: durchlassen statt blockieren
+#define RL_IDLE_MS (10 * 60 * 1000) // Volle, so lange unbenutzte Buckets dürfen ersetzt werden
+
+enum rl_kind
+{
+    RL_CONNECT,     // Verbindungen pro IP
+    RL_LOGIN,       // LOGIN Versuche pro IP und pro Benutzername
+    RL_SEND,        // SEND pro IP und pro Benutzer
+    RL_BYTES,       // Empfangene Nachrichten-Bytes pro IP und pro Benutzer
+    RL_KINDS
+};
+
+int ratelimit_configure(const char *spec);  // 0 = ungültige Angabe
+int ratelimit_init(void);                   // Vor fork() aufrufen
+int ratelimit_enabled(enum rl_kind kind);
+// amount Tokens von IP- und (falls user != NULL) Benutzer-Bucket nehmen; 0 = Limit erreicht
+int ratelimit_allow(enum rl_kind kind, const char *ip, const char *user, uint32_t amount);
+// Wie ratelimit_allow(), aber in Stücken von höchstens burst: für Datenblöcke, deren
+// Größe vom Eingabepuffer abhängt und nicht von der Nachricht
+int ratelimit_allow_split(enum rl_kind kind, const char *ip, const char *user, size_t amount);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+// Edge-triggered epoll Event-Loop: ein Prozess bedient alle Verbindungen.
+// Jede Verbindung hat eine eigene Protokoll-State-Machine (struct session).
+
+#define REACTOR_MAX_EVENTS 256
+#define REACTOR_OUT_HIGH_WATER (256 * 1024) // Ab hier keine weiteren Commands bis der Client liest
+#define REACTOR_LDAP_POLL_MS 10             // Logins ohne überwachbaren LDAP Socket so oft abfragen
+
+// max_connections: weitere Clients werden mit ERR abgewiesen (0 = unbegrenzt)
+int reactor_run(int server_socket, const char *mail_dir, int max_connections);
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "common.h"
+#include "outbuf.h"
+#include "delivery.h"
+#include "auth.h"
+#include "metrics.h"
+#include "tls.h"
+#include "compress.h"
+
+struct line_reader;
+struct mread_batch;
+struct deferred_message;
+
+// Server-Modi (Auswahl beim Start mit -m)
+
+#define MODE_FORK "fork"
+#define MODE_EPOLL "epoll"
+#define MODE_PREFORK "prefork"
+
+#define MAX_LOGIN_ATTEMPTS 3
+#define SESSION_MAX_OPEN_CHUNKS 64      // Eingereihte Dateien pro Verbindung, danach erst senden, dann weiterlesen
+
+// Zustände der Protokoll-State-Machine pro Verbindung
+
+enum session_state
+{
+    STATE_COMMAND,
+    STATE_LOGIN_USER,
+    STATE_LOGIN_PASS,
+    STATE_SEND_RECEIVER,
+    STATE_SEND_SUBJECT,
+    STATE_SEND_BODY,
+    STATE_SEND_DATA,        // SEND <bytes>: Rohdaten statt Zeilen
+    STATE_SEND_COMMIT,      // Nur epoll + Group Commit: wartet auf session_commit_group()
+    STATE_LOGIN_AUTH,       // Nur epoll: Login beim Anbieter läuft, wartet auf session_poll_login()
+    STATE_READ_NUMBER,
+    STATE_DEL_NUMBER,
+    STATE_MREAD_NUMBERS,
+    STATE_MDEL_NUMBERS,
+    STATE_MREAD_SENDING,    // Nur epoll: MREAD hat SESSION_MAX_OPEN_CHUNKS erreicht, Rest nach dem Senden
+    STATE_COMPRESS_METHOD,
+    STATE_COMPRESS_START    // OK auf COMPRESS ist gepuffert: nach dem Senden umschalten (session_flush)
+};
+
+struct session
+{
+    int sock;
+    int id;                                 // PID (fork) bzw. Socket-FD (epoll) für Ausgaben
+    const char *mail_dir;
+    char client_ip[INET6_ADDRSTRLEN];
+
+    char session_user[USER_LEN + 1];
+    int is_logged_in;
+    int failed_attempts;
+
+    enum session_state state;
+
+    // Zwischenstand mehrzeiliger Commands
+    char login_user[USER_LEN + 2];
+    char receivers[MSEND_MAX_RECIPIENTS][USER_LEN + 1];
+    int receiver_count;
+    char subject[SUBJECT_LEN + 1];
+    struct mail_delivery delivery;
+    struct mail_delivery *deliveries;       // Eine pro Empfänger: einer &delivery, sonst eigenes Array
+    int send_valid;
+    uint64_t body_length;                   // SEND <bytes>: angekündigt bzw. noch ausstehend
+    uint64_t body_remaining;
+    int body_framed;
+    int body_line_state;                    // Suche nach einer Zeile "." über Chunk-Grenzen
+    struct auth_request auth;               // Laufender LOGIN (STATE_LOGIN_AUTH)
+    struct mread_batch *mread;              // Noch nicht eingereihter Rest (STATE_MREAD_SENDING)
+    struct deferred_message *deferred;      // Eingereihte komprimierte READs, Datei noch nicht offen
+
+    // Laufzeitmessung des aktuellen Commands (nur mit -M)
+    enum metric_command metric_command;
+    uint64_t command_start;
+    uint64_t auth_start;
+    int command_failed;
+
+    // Antworten werden gesammelt und einmal pro Command geschrieben
+    // (fork-Modus: vor dem nächsten Lesen, epoll-Modus: durch den Reactor)
+    int nonblocking;
+    struct out_buffer out;
+    struct ssl_st *tls;                     // NULL = unverschlüsselt (Server ohne -S)
+    struct wire_compress *wire;             // COMPRESS DEFLATE aktiv, liegt über Socket bzw. TLS
+    struct line_reader *wire_reader;        // Reader, der beim Umschalten mitgeht
+};
+
+void session_init(struct session *s, int sock, int id, const char *client_ip, const char *mail_dir, int nonblocking);
+int session_feed_line(struct session *s, char *line);   // 0 = Verbindung schließen
+// Nächste Zeile bzw. (SEND <bytes>) nächsten Block Rohdaten aus dem Reader verarbeiten:
+// 1 = verarbeitet, 0 = mehr Daten nötig, -1 = Verbindung schließen
+int session_feed_input(struct session *s, struct line_reader *reader);
+void session_cleanup(struct session *s);
+void session_start_tls(struct session *s, struct line_reader *reader, struct ssl_st *tls);  // Nach dem Handshake
+void session_write(struct session *s, const char *data, size_t len);
+int session_flush(struct session *s);   // Ausgabepuffer senden (misst PHASE_SOCKET_WRITE), Rückgabe wie ob_flush()
+int session_accepts_input(const struct session *s);
+int session_poll_login(struct session *s);  // Laufenden Login prüfen; 0 = Verbindung schließen
+void session_commit_group(struct session **sessions, int count);
+
+// Listen-Socket auf allen Adressen; reuseport = mehrere Prozesse binden denselben Port
+int server_socket_create(int port, int reuseport);   // -1 = Fehler
+
+
+#endif
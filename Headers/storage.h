@@ -0,0 +1,56 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <sys/types.h>
+#include "mailbox.h"
+#include "delivery.h"
+
+// Austauschbares Speicher-Backend hinter SEND/LIST/READ/DEL (Start-Option -b).
+// Der Index (.index) ist für alle Backends gleich, nur die Ablage der
+// Nachrichteninhalte unterscheidet sich:
+//   file     eine Datei pro Nachricht: <user>/<id>.msg (bisheriges Layout)
+//   segment  append-only Log pro Mailbox: <user>/segments/<n>.seg, DEL schreibt
+//            einen Tombstone, ein Hintergrundprozess kompaktiert alte Segmente
+
+#define STORAGE_COMPACT_INTERVAL 60 // Sekunden zwischen zwei Kompaktierungsläufen
+
+// Lage einer gespeicherten Nachricht: length Bytes ab offset in fd
+struct message_ref
+{
+    int fd;
+    off_t offset;
+    size_t length;
+};
+
+// Wird pro gespeicherter Nachricht aufgerufen; != 0 bricht ab
+typedef int (*storage_scan_fn)(const struct mail_index_record *record, void *ctx);
+
+struct storage_backend
+{
+    const char *name;
+
+    // Zugestellte Nachricht aus tmp/ übernehmen, setzt record.segment/offset
+    int (*publish)(struct mail_delivery *d);
+    // Nachricht mit vorgegebener id aus einer anderen Quelle übernehmen (Migration)
+    int (*import)(const char *mail_dir, const char *user, struct mail_index_record *record, int src_fd, off_t src_offset);
+    int (*open_message)(const char *mail_dir, const char *user, const struct mail_index_record *record, struct message_ref *out);
+    int (*remove_message)(const char *mail_dir, const char *user, const struct mail_index_record *record);
+    // Alle gespeicherten Nachrichten aufzählen (für Index-Neuaufbau); Sender/Betreff nur mit with_headers
+    int (*scan)(const char *mail_dir, const char *user, int with_headers, storage_scan_fn visit, void *ctx);
+    void (*recover)(const char *mail_dir, const char *user);       // Nach Absturz: halbe Schreibvorgänge verwerfen
+    void (*compact)(const char *mail_dir, const char *user);       // NULL = nicht nötig
+    void (*destroy)(const char *mail_dir, const char *user);       // Alle Inhalte entfernen (Migration)
+};
+
+extern const struct storage_backend file_storage;
+extern const struct storage_backend segment_storage;
+
+const struct storage_backend *storage_find(const char *name);
+int storage_select(const char *name);   // Vor fork() aufrufen; 0 = unbekanntes Backend
+const struct storage_backend *storage(void);
+
+void message_ref_close(struct message_ref *ref);
+void parse_message_header(const char *data, size_t len, struct mail_index_record *record);
+void storage_start_compactor(const char *mail_dir);
+
+#endif
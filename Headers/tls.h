@@ -0,0 +1,50 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// TLS (OpenSSL) für Server und Client, ohne vorgeschalteten Terminator.
+//
+// Server: Start-Optionen -S <zertifikat.pem> [-K <schlüssel.pem>], ohne -S
+// bleibt das Protokoll unverschlüsselt. Der Kontext entsteht vor fork(),
+// damit alle Kinder bzw. prefork-Worker dieselben Session-Ticket-Schlüssel
+// haben: ein Client mit Ticket überspringt den vollen Handshake, egal
+// welcher Prozess die neue Verbindung annimmt.
+//
+// Bietet der Kernel kTLS an, verschlüsselt er die Ausgaben selbst; READ
+// sendet Nachrichten dann weiterhin per sendfile() ohne Kopie. Sonst laufen
+// Ausgaben über SSL_write() (Dateien über einen Zwischenpuffer).
+//
+// Client: -t aktiviert TLS, -C <ca.pem> für selbst signierte Zertifikate,
+// -R <datei> speichert das Session-Ticket für den nächsten Start.
+//
+// Zum Testen auf localhost:
+//   openssl req -x509 -newkey rsa:2048 -nodes -days 365 -keyout key.pem -out cert.pem
+//       -subj /CN=localhost -addext subjectAltName=DNS:localhost,IP:127.0.0.1
+
+#define TLS_RECORD_LEN (16 * 1024)      // Max. Klartext pro TLS Record
+
+struct ssl_st; // SSL aus <openssl/ssl.h>
+
+// -=- Server -=-
+int tls_server_init(const char *cert_file, const char *key_file);   // Vor fork(); 0 = Fehler
+int tls_server_enabled(void);
+struct ssl_st *tls_server_new(int fd);                              // Handshake danach mit tls_handshake()
+
+// -=- Client -=-
+int tls_client_init(const char *ca_file, const char *session_file); // ca_file/session_file dürfen NULL sein
+struct ssl_st *tls_client_connect(int fd, const char *host);        // Blockierend inkl. Prüfung des Zertifikats
+
+// -=- Beide -=-
+int tls_handshake(struct ssl_st *ssl);          // 1 = fertig, 0 = später erneut (errno EAGAIN), -1 = Fehler
+// Wie read()/write(): -1 mit errno EAGAIN, wenn der Socket nicht bereit ist
+ssize_t tls_read(void *ssl, void *buf, size_t len);
+ssize_t tls_write(void *ssl, const void *buf, size_t len);
+int tls_ktls_send(struct ssl_st *ssl);          // 1 = Kernel verschlüsselt Ausgaben (write/sendfile direkt)
+int tls_session_reused(struct ssl_st *ssl);
+const char *tls_version(struct ssl_st *ssl);
+const char *tls_last_error(void);               // Für Meldungen nach einem Fehler
+void tls_free(struct ssl_st *ssl);              // close_notify senden (best effort) und freigeben
+
+#endif
@@ -0,0 +1,67 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <openssl/evp.h>
+#include "Headers/auth.h"
+
+static const struct auth_provider *providers[] = { &ldap_provider, &htpasswd_provider };
+static const struct auth_provider *active_provider = &ldap_provider;
+
+static volatile sig_atomic_t reload_pending = 0;
+
+int auth_select(const char *name)
+{
+    for (size_t i = 0; i < sizeof(providers) / sizeof(providers[0]); i++)
+    {
+        if (strcmp(providers[i]->name, name) == 0)
+        {
+            active_provider = providers[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+const struct auth_provider *auth(void)
+{
+    return active_provider;
+}
+
+int auth_password_digest(const unsigned char *salt, size_t salt_len, const char *password, unsigned char *out)
+{
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    if (!ctx) return 0;
+    int ok = EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) &&
+             EVP_DigestUpdate(ctx, salt, salt_len) &&
+             EVP_DigestUpdate(ctx, password, strlen(password)) &&
+             EVP_DigestFinal_ex(ctx, out, NULL);
+    EVP_MD_CTX_free(ctx);
+    return ok;
+}
+
+// -=- Neu laden bei SIGHUP -=-
+
+static void on_sighup(int sig)
+{
+    (void)sig;
+    reload_pending = 1;
+}
+
+void auth_watch_reload(void)
+{
+    // Ohne SA_RESTART: accept()/epoll_wait()/wait() kehren mit EINTR zurück
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_sighup;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGHUP, &action, NULL);
+}
+
+int auth_reload_requested(void)
+{
+    if (!reload_pending) return 0;
+    reload_pending = 0;
+    return 1;
+}
@@ -0,0 +1,576 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include "Headers/common.h"
+#include "Headers/linereader.h"
+#include "Headers/tls.h"
+#include "Headers/compress.h"
+#include "Headers/batch.h"
+
+enum batch_op
+{
+    BATCH_LOGIN,
+    BATCH_SEND,
+    BATCH_LIST,
+    BATCH_READ,
+    BATCH_DEL,
+    BATCH_MREAD,
+    BATCH_MDEL
+};
+
+struct batch_command
+{
+    enum batch_op op;
+    int number;                     // READ/DEL, bei MREAD/MDEL erste Nummer
+    int last;                       // MREAD/MDEL: letzte Nummer
+    char *receiver;                 // SEND: Empfänger bzw. Liste
+};
+
+struct batch
+{
+    struct batch_command *commands; // commands[0] ist immer LOGIN
+    size_t count;
+    size_t capacity;
+
+    char *request;                  // Alle Protokollzeilen nach dem LOGIN
+    size_t request_len;
+    size_t request_cap;
+
+    // Laufender SEND: die Zeile "SEND <bytes>" kommt vor Empfänger und Betreff,
+    // sobald die Länge des Texts feststeht
+    const char *send_command;
+    size_t send_start;
+    size_t body_start;
+};
+
+// Fortschritt beim Lesen der Antworten
+struct batch_reply
+{
+    size_t next;            // Command, auf dessen Antwort gewartet wird
+    int list_remaining;     // LIST/MREAD: noch erwartete Betreffzeilen bzw. Nachrichten (-1 = Anzahl fehlt noch)
+    int list_index;
+    int in_body;            // READ: Inhalt bis "." ausgeben
+    int failed;
+};
+
+// -=- Batch-Datei einlesen -=-
+
+static int add_command(struct batch *b, enum batch_op op, int number, int last, const char *receiver)
+{
+    if (b->count == b->capacity)
+    {
+        size_t capacity = b->capacity ? b->capacity * 2 : 64;
+        struct batch_command *grown = realloc(b->commands, capacity * sizeof(*grown));
+        if (!grown) return 0;
+        b->commands = grown;
+        b->capacity = capacity;
+    }
+
+    struct batch_command *command = &b->commands[b->count++];
+    command->op = op;
+    command->number = number;
+    command->last = last;
+    command->receiver = receiver ? strdup(receiver) : NULL;
+    return !receiver || command->receiver;
+}
+
+static int reserve(struct batch *b, size_t extra)
+{
+    if (b->request_len + extra <= b->request_cap) return 1;
+
+    size_t capacity = b->request_cap ? b->request_cap : 64 * 1024;
+    while (capacity < b->request_len + extra) capacity *= 2;
+    char *grown = realloc(b->request, capacity);
+    if (!grown) return 0;
+    b->request = grown;
+    b->request_cap = capacity;
+    return 1;
+}
+
+static int append_line(struct batch *b, const char *text)
+{
+    size_t len = strlen(text);
+    if (!reserve(b, len + 1)) return 0;
+    memcpy(b->request + b->request_len, text, len);
+    b->request[b->request_len + len] = '\n';
+    b->request_len += len + 1;
+    return 1;
+}
+
+// Text ist vollständig: "SEND <bytes>" vor Empfänger und Betreff einfügen
+static int finish_send(struct batch *b)
+{
+    char header[32];
+    int header_len = snprintf(header, sizeof(header), "%s %zu\n", b->send_command, b->request_len - b->body_start);
+    if (!reserve(b, header_len)) return 0;
+
+    memmove(b->request + b->send_start + header_len, b->request + b->send_start, b->request_len - b->send_start);
+    memcpy(b->request + b->send_start, header, header_len);
+    b->request_len += header_len;
+    return 1;
+}
+
+static int parse_number(const char *text, const char *end, int *out)
+{
+    if (text == end) return 0;
+    long value = 0;
+    for (const char *p = text; p < end; p++)
+    {
+        if (*p < '0' || *p > '9') return 0;
+        value = value * 10 + (*p - '0');
+        if (value > 1000000000L) return 0;
+    }
+    if (value == 0) return 0;
+    *out = (int)value;
+    return 1;
+}
+
+// "<nr>" oder "<von>-<bis>"
+static int parse_range(const char *text, int *from, int *to)
+{
+    if (!text) return 0;
+    const char *dash = strchr(text, '-');
+    const char *end = text + strlen(text);
+    if (!dash) return parse_number(text, end, from) && parse_number(text, end, to);
+    return parse_number(text, dash, from) && parse_number(dash + 1, end, to) &&
+           *from <= *to && *to - *from < BATCH_MAX_RANGE;
+}
+
+// Einzelne Nummern als READ/DEL, Bereiche als MREAD/MDEL in Blöcken der Server-Limits.
+// MDEL-Blöcke von hinten, damit die Nummern der restlichen Blöcke gültig bleiben.
+static int add_range(struct batch *b, int is_read, int from, int to)
+{
+    char numbers[32];
+    if (from == to)
+    {
+        snprintf(numbers, sizeof(numbers), "%d", from);
+        return add_command(b, is_read ? BATCH_READ : BATCH_DEL, from, to, NULL) &&
+               append_line(b, is_read ? CMD_READ : CMD_DEL) && append_line(b, numbers);
+    }
+
+    // MREAD: Blöcke ab from aufwärts, MDEL: Blöcke ab to abwärts. Ein MDEL verschiebt
+    // nur die Nummern dahinter, die tieferen Blöcke bleiben gültig; der letzte Block
+    // (bei MDEL der vorderste) ist kürzer
+    int block = is_read ? MREAD_MAX_MESSAGES : MDEL_MAX_MESSAGES;
+    for (int i = 0; i <= (to - from) / block; i++)
+    {
+        int first, last;
+        if (is_read)
+        {
+            first = from + i * block;
+            last = first + block - 1;
+            if (last > to) last = to;
+        }
+        else
+        {
+            last = to - i * block;
+            first = last - block + 1;
+            if (first < from) first = from;
+        }
+
+        snprintf(numbers, sizeof(numbers), "%d%c%d", first, RANGE_SEPARATOR, last);
+        if (!add_command(b, is_read ? BATCH_MREAD : BATCH_MDEL, first, last, NULL) ||
+            !append_line(b, is_read ? CMD_MREAD : CMD_MDEL) || !append_line(b, numbers)) return 0;
+    }
+    return 1;
+}
+
+// Eine Command-Zeile; *in_body = 1, wenn danach der SEND-Text folgt
+static int parse_command(struct batch *b, char *line, int line_number, int *in_body)
+{
+    char *word = strtok(line, " \t");
+    char *argument = strtok(NULL, " \t");
+    int from, to;
+
+    if (strcasecmp(word, CMD_LIST) == 0)
+    {
+        if (!argument) return add_command(b, BATCH_LIST, 0, 0, NULL) && append_line(b, CMD_LIST);
+
+        // Parameter unverändert weiterreichen, der Server prüft sie
+        char *rest = strtok(NULL, "");
+        char query[LINE_LEN];
+        if (snprintf(query, sizeof(query), "%s %s%s%s", CMD_LIST, argument, rest ? " " : "", rest ? rest : "") >= (int)sizeof(query))
+        {
+            fprintf(stderr, "Batch Zeile %d: %s Parameter zu lang\n", line_number, CMD_LIST);
+            return 0;
+        }
+        return add_command(b, BATCH_LIST, 0, 0, NULL) && append_line(b, query);
+    }
+    if (strcasecmp(word, CMD_READ) == 0 || strcasecmp(word, CMD_DEL) == 0)
+    {
+        int is_read = strcasecmp(word, CMD_READ) == 0;
+        if (!parse_range(argument, &from, &to) || strtok(NULL, " \t"))
+        {
+            fprintf(stderr, "Batch Zeile %d: %s erwartet <nr> oder <von>-<bis>\n", line_number, is_read ? CMD_READ : CMD_DEL);
+            return 0;
+        }
+        return add_range(b, is_read, from, to);
+    }
+    if (strcasecmp(word, CMD_SEND) == 0)
+    {
+        char *subject = strtok(NULL, "");
+        if (subject) subject += strspn(subject, " \t");
+        // Mehrere Empfänger (a,b,c) gehen als ein MSEND, der Text nur einmal
+        int multiple = argument && strchr(argument, LIST_SEPARATOR) != NULL;
+        size_t max_receivers = multiple ? MSEND_MAX_RECIPIENTS * (USER_LEN + 1) - 1 : USER_LEN;
+        if (!argument || strlen(argument) > max_receivers || !subject || !*subject || strlen(subject) > SUBJECT_LEN)
+        {
+            fprintf(stderr, "Batch Zeile %d: SEND erwartet <empfänger>[,<empfänger>...] <betreff> (max. %d Empfänger mit %d bzw. %d Zeichen)\n",
+                    line_number, MSEND_MAX_RECIPIENTS, USER_LEN, SUBJECT_LEN);
+            return 0;
+        }
+        *in_body = 1;
+        b->send_command = multiple ? CMD_MSEND : CMD_SEND;
+        b->send_start = b->request_len;
+        if (!add_command(b, BATCH_SEND, 0, 0, argument) || !append_line(b, argument) || !append_line(b, subject)) return 0;
+        b->body_start = b->request_len;
+        return 1;
+    }
+
+    fprintf(stderr, "Batch Zeile %d: unbekannter Command '%s'\n", line_number, word);
+    return 0;
+}
+
+struct batch *batch_load(FILE *input)
+{
+    struct batch *b = calloc(1, sizeof(*b));
+    if (!b || !add_command(b, BATCH_LOGIN, 0, 0, NULL))
+    {
+        batch_free(b);
+        return NULL;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_number = 0;
+    int in_body = 0;
+    int ok = 1;
+
+    while (ok && getline(&line, &line_size, input) >= 0)
+    {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (in_body)
+        {
+            // Nachrichtentext bis zur Zeile "." unverändert übernehmen, beliebig lange Zeilen
+            // (geht als SEND <bytes>, siehe common.h)
+            if (strcmp(line, ".") == 0)
+            {
+                in_body = 0;
+                ok = finish_send(b);
+            }
+            else if (b->request_len - b->body_start + strlen(line) + 1 > SEND_MAX_BODY_LEN)
+            {
+                fprintf(stderr, "Batch Zeile %d: Text länger als %lu Bytes\n", line_number, SEND_MAX_BODY_LEN);
+                ok = 0;
+            }
+            else
+            {
+                ok = append_line(b, line);
+            }
+            continue;
+        }
+
+        char *start = line + strspn(line, " \t");
+        if (*start == '\0' || *start == '#') continue;
+        ok = parse_command(b, start, line_number, &in_body);
+    }
+    free(line);
+
+    if (ok && in_body)
+    {
+        fprintf(stderr, "Batch: SEND ohne abschließende Zeile '.'\n");
+        ok = 0;
+    }
+    if (!ok)
+    {
+        batch_free(b);
+        return NULL;
+    }
+    return b;
+}
+
+void batch_free(struct batch *b)
+{
+    if (!b) return;
+    for (size_t i = 0; i < b->count; i++) free(b->commands[i].receiver);
+    free(b->commands);
+    free(b->request);
+    free(b);
+}
+
+// -=- Antworten auswerten -=-
+
+static void command_done(struct batch_reply *reply, int ok)
+{
+    if (!ok) reply->failed++;
+    reply->next++;
+    reply->list_remaining = -1;
+    reply->in_body = 0;
+}
+
+// MREAD: nächste Nachricht des Blocks
+static void mread_next(struct batch_reply *reply)
+{
+    reply->in_body = 0;
+    reply->list_index++;
+    if (--reply->list_remaining == 0) command_done(reply, 1);
+}
+
+static void handle_reply_line(const struct batch *b, struct batch_reply *reply, const char *line, const char *user)
+{
+    const struct batch_command *command = &b->commands[reply->next];
+    int ok = strcmp(line, RESP_OK) == 0;
+
+    switch (command->op)
+    {
+        case BATCH_LOGIN:
+            if (!ok) fprintf(stderr, "Login als %s fehlgeschlagen.\n", user);
+            command_done(reply, ok);
+            break;
+
+        case BATCH_SEND:
+            printf("%s %s: %s\n", CMD_SEND, command->receiver, line);
+            command_done(reply, ok);
+            break;
+
+        case BATCH_DEL:
+            printf("%s %d: %s\n", CMD_DEL, command->number, line);
+            command_done(reply, ok);
+            break;
+
+        case BATCH_LIST:
+            if (reply->list_remaining < 0)
+            {
+                if (strcmp(line, RESP_ERR) == 0)
+                {
+                    printf("%s: %s\n", CMD_LIST, line);
+                    command_done(reply, 0);
+                    break;
+                }
+                reply->list_remaining = atoi(line);
+                reply->list_index = 0;
+                printf("%d Nachrichten gefunden:\n", reply->list_remaining);
+                if (reply->list_remaining <= 0) command_done(reply, 1);
+                break;
+            }
+            printf("%d. %s\n", ++reply->list_index, line);
+            if (--reply->list_remaining == 0) command_done(reply, 1);
+            break;
+
+        case BATCH_MDEL:
+            printf("%s %d%c%d: %s\n", CMD_DEL, command->number, RANGE_SEPARATOR, command->last, line);
+            command_done(reply, ok);
+            break;
+
+        case BATCH_MREAD:
+            // Erst die Anzahl, dann pro Nummer OK + Inhalt + "." oder ERR
+            if (reply->list_remaining < 0)
+            {
+                if (strcmp(line, RESP_ERR) == 0)
+                {
+                    printf("%s %d%c%d: %s\n", CMD_READ, command->number, RANGE_SEPARATOR, command->last, line);
+                    command_done(reply, 0);
+                    break;
+                }
+                reply->list_remaining = atoi(line);
+                reply->list_index = 0;
+                if (reply->list_remaining <= 0) command_done(reply, 1);
+                break;
+            }
+            if (!reply->in_body)
+            {
+                if (!ok)
+                {
+                    printf("%s %d: %s\n", CMD_READ, command->number + reply->list_index, line);
+                    reply->failed++;
+                    mread_next(reply);
+                    break;
+                }
+                reply->in_body = 1;
+                printf("--- Nachricht %d ---\n", command->number + reply->list_index);
+                break;
+            }
+            if (strcmp(line, ".") == 0)
+            {
+                printf("--- Ende der Nachricht ---\n");
+                mread_next(reply);
+                break;
+            }
+            printf("%s\n", line);
+            break;
+
+        case BATCH_READ:
+            if (!reply->in_body)
+            {
+                if (!ok)
+                {
+                    printf("%s %d: %s\n", CMD_READ, command->number, line);
+                    command_done(reply, 0);
+                    break;
+                }
+                reply->in_body = 1;
+                printf("--- Nachricht %d ---\n", command->number);
+                break;
+            }
+            if (strcmp(line, ".") == 0)
+            {
+                printf("--- Ende der Nachricht ---\n");
+                command_done(reply, 1);
+                break;
+            }
+            printf("%s\n", line);
+            break;
+    }
+}
+
+// -=- Ausführen -=-
+
+// TLS bzw. Kompression: Block für Block, nach EAGAIN wieder mit demselben Abschnitt
+// (SSL_write und wire_write verlangen das)
+static int send_pending_stream(wire_write_fn write_fn, void *ctx, struct iovec *parts, int part_count, size_t *sent)
+{
+    size_t offset = *sent;
+    int i = 0;
+    while (i < part_count)
+    {
+        if (offset >= parts[i].iov_len)
+        {
+            offset -= parts[i].iov_len;
+            i++;
+            continue;
+        }
+
+        size_t len = parts[i].iov_len - offset;
+        if (len > TLS_RECORD_LEN) len = TLS_RECORD_LEN;
+        ssize_t n = write_fn(ctx, (char *)parts[i].iov_base + offset, len);
+        if (n < 0) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        *sent += (size_t)n;
+        offset += (size_t)n;
+    }
+    return 0;
+}
+
+// Schickt so viel wie der Socket gerade nimmt; 0 = OK (auch EAGAIN), -1 = Fehler
+static int send_pending(int sock, struct ssl_st *tls, struct wire_compress *wire, struct iovec *parts, int part_count, size_t *sent)
+{
+    if (wire) return send_pending_stream(wire_write, wire, parts, part_count, sent);
+    if (tls) return send_pending_stream(tls_write, tls, parts, part_count, sent);
+
+    struct iovec iov[4];
+    int iov_count = 0;
+    size_t skip = *sent;
+
+    for (int i = 0; i < part_count; i++)
+    {
+        if (skip >= parts[i].iov_len)
+        {
+            skip -= parts[i].iov_len;
+            continue;
+        }
+        iov[iov_count].iov_base = (char *)parts[i].iov_base + skip;
+        iov[iov_count].iov_len = parts[i].iov_len - skip;
+        iov_count++;
+        skip = 0;
+    }
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = iov;
+    message.msg_iovlen = iov_count;
+
+    ssize_t n = sendmsg(sock, &message, MSG_NOSIGNAL);
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    *sent += (size_t)n;
+    return 0;
+}
+
+int batch_run(struct batch *b, int sock, struct ssl_st *tls, struct wire_compress *wire, const char *user, const char *password)
+{
+    char login[sizeof(CMD_LOGIN) + USER_LEN + LINE_LEN + 3];
+    if (strlen(user) > USER_LEN || strlen(password) >= LINE_LEN)
+    {
+        fprintf(stderr, "Benutzername oder Passwort zu lang.\n");
+        return 0;
+    }
+    snprintf(login, sizeof(login), "%s\n%s\n%s\n", CMD_LOGIN, user, password);
+    static char quit[] = CMD_QUIT "\n";
+
+    // LOGIN, alle Commands und QUIT gehen ohne Pause hinaus
+    struct iovec parts[3] =
+    {
+        { login, strlen(login) },
+        { b->request, b->request_len },
+        { quit, sizeof(quit) - 1 }
+    };
+    size_t total = parts[0].iov_len + parts[1].iov_len + parts[2].iov_len;
+    size_t sent = 0;
+
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+    struct line_reader reader;
+    lr_init(&reader, sock, LR_BUFFER_SIZE); // Lange Zeilen aus SEND <bytes> möglichst am Stück ausgeben
+    if (wire) lr_set_source(&reader, wire_read, wire);
+    else if (tls) lr_set_source(&reader, tls_read, tls);
+    struct batch_reply reply = { 0, -1, 0, 0, 0 };
+    int connection_ok = 1;
+
+    while (reply.next < b->count)
+    {
+        struct pollfd p = { sock, POLLIN, 0 };
+        if (sent < total) p.events |= POLLOUT;
+        if (poll(&p, 1, -1) < 0)
+        {
+            if (errno == EINTR) continue;
+            connection_ok = 0;
+            break;
+        }
+
+        if ((p.revents & POLLOUT) && send_pending(sock, tls, wire, parts, 3, &sent) < 0)
+        {
+            connection_ok = 0;
+            break;
+        }
+
+        // Bis EAGAIN lesen: TLS und zlib können Daten puffern, ohne dass poll() sie sieht
+        while ((p.revents & (POLLIN | POLLHUP | POLLERR)) && reply.next < b->count)
+        {
+            ssize_t n = lr_fill(&reader);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) break;
+            if (n <= 0)
+            {
+                connection_ok = 0;
+                break;
+            }
+
+            char *line;
+            size_t len;
+            while (reply.next < b->count && lr_next_line(&reader, &line, &len))
+            {
+                handle_reply_line(b, &reply, line, user);
+            }
+        }
+        if (!connection_ok) break;
+    }
+    lr_free(&reader);
+    fflush(stdout);
+
+    if (!connection_ok)
+    {
+        fprintf(stderr, "Verbindung zum Server verloren, %zu von %zu Commands ohne Antwort.\n",
+                b->count - reply.next, b->count);
+        return 0;
+    }
+    fprintf(stderr, "%zu Commands ausgeführt, %d fehlgeschlagen.\n", b->count, reply.failed);
+    return reply.failed == 0;
+}
@@ -0,0 +1,566 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "Headers/common.h"
+#include "Headers/linereader.h"
+
+// twmailer-bench: Lastgenerator für das TW-Mailer Protokoll.
+// Ein Prozess, ein epoll-Loop, beliebig viele nicht-blockierende Verbindungen.
+// Jede Verbindung meldet sich an und schickt danach Commands nach dem
+// gewählten Mix, immer eins nach dem anderen (Latenz = Command bis Antwort).
+
+#define BENCH_MAX_EVENTS 256
+#define BENCH_BODY_LINE 76          // Zeichen pro Body-Zeile
+#define BENCH_DRAIN_SECONDS 5       // So lange auf offene Antworten warten
+#define BENCH_SUB_BUCKETS 16        // Histogramm: Stufen pro Zweierpotenz (~6 % Auflösung)
+#define BENCH_BUCKETS (40 * BENCH_SUB_BUCKETS)
+
+enum bench_op
+{
+    OP_LOGIN,
+    OP_SEND,
+    OP_LIST,
+    OP_READ,
+    OP_DEL,
+    OP_COUNT
+};
+
+static const char *op_names[OP_COUNT] = { "LOGIN", "SEND", "LIST", "READ", "DEL" };
+
+enum conn_state
+{
+    CONN_CONNECTING,
+    CONN_WAITING,       // Command gesendet, Antwort ausstehend
+    CONN_DONE
+};
+
+struct bench_conn
+{
+    int fd;
+    enum conn_state state;
+    struct line_reader reader;
+    const char *user;
+
+    enum bench_op op;
+    uint64_t start_us;
+    int failed;
+    int list_remaining;     // LIST: noch erwartete Betreffzeilen (-1 = Anzahl fehlt noch)
+    int in_body;            // READ: Inhalt bis "." lesen
+    int known_messages;
+
+    char *out;
+    size_t out_len;
+    size_t out_sent;
+    unsigned int seed;
+};
+
+struct bench_histogram
+{
+    uint64_t buckets[BENCH_BUCKETS];
+    uint64_t count;
+    uint64_t errors;
+    uint64_t max_us;
+};
+
+static struct bench_histogram results[OP_COUNT];
+static int mix[OP_COUNT] = { 0, 50, 20, 20, 10 };  // LOGIN wird nicht gewürfelt
+static int mix_total = 100;
+static size_t message_size = 1024;
+static char *message_body = NULL;
+static const char *password = NULL;
+
+static uint64_t now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000ULL + (uint64_t)now.tv_nsec / 1000;
+}
+
+// -=- Histogramm (log-linear wie HdrHistogram) -=-
+
+static int bucket_of(uint64_t value)
+{
+    if (value < 2 * BENCH_SUB_BUCKETS) return (int)value;
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - 4;
+    int index = (shift + 1) * BENCH_SUB_BUCKETS + (int)((value >> shift) & (BENCH_SUB_BUCKETS - 1));
+    return index < BENCH_BUCKETS ? index : BENCH_BUCKETS - 1;
+}
+
+static uint64_t bucket_upper(int index)
+{
+    if (index < 2 * BENCH_SUB_BUCKETS) return (uint64_t)index;
+
+    int shift = index / BENCH_SUB_BUCKETS - 1;
+    uint64_t sub = (uint64_t)(index % BENCH_SUB_BUCKETS);
+    return ((BENCH_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+static void record(enum bench_op op, uint64_t start_us, int failed)
+{
+    uint64_t elapsed = now_us() - start_us;
+    struct bench_histogram *h = &results[op];
+    h->buckets[bucket_of(elapsed)]++;
+    h->count++;
+    if (failed) h->errors++;
+    if (elapsed > h->max_us) h->max_us = elapsed;
+}
+
+static double percentile_ms(const struct bench_histogram *h, double quantile)
+{
+    if (h->count == 0) return 0;
+
+    uint64_t wanted = (uint64_t)(quantile * h->count + 0.5);
+    if (wanted == 0) wanted = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < BENCH_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= wanted)
+        {
+            uint64_t upper = bucket_upper(i);
+            return (upper < h->max_us ? upper : h->max_us) / 1000.0;
+        }
+    }
+    return h->max_us / 1000.0;
+}
+
+// -=- Optionen -=-
+
+static int parse_mix(const char *spec)
+{
+    int parsed[OP_COUNT] = { 0 };
+    char *copy = strdup(spec);
+    if (!copy) return 0;
+
+    int ok = 1;
+    for (char *item = strtok(copy, ","); item && ok; item = strtok(NULL, ","))
+    {
+        char *equals = strchr(item, '=');
+        if (!equals)
+        {
+            ok = 0;
+            break;
+        }
+        *equals = '\0';
+
+        int found = 0;
+        for (int op = OP_SEND; op < OP_COUNT; op++)
+        {
+            if (strcasecmp(item, op_names[op]) != 0) continue;
+            char *end;
+            long weight = strtol(equals + 1, &end, 10);
+            if (*end || weight < 0 || weight > 1000) break;
+            parsed[op] = (int)weight;
+            found = 1;
+        }
+        ok = found;
+    }
+    free(copy);
+
+    int total = 0;
+    for (int op = OP_SEND; op < OP_COUNT; op++) total += parsed[op];
+    if (!ok || total == 0) return 0;
+
+    memcpy(mix, parsed, sizeof(mix));
+    mix_total = total;
+    return 1;
+}
+
+static void build_body(void)
+{
+    // Zeilen aus 'x', nie ein einzelner Punkt
+    message_body = malloc(message_size + BENCH_BODY_LINE + 2);
+    size_t len = 0;
+    while (len < message_size)
+    {
+        size_t line = message_size - len > BENCH_BODY_LINE ? BENCH_BODY_LINE : message_size - len;
+        if (line < 2) line = 2;
+        memset(message_body + len, 'x', line - 1);
+        message_body[len + line - 1] = '\n';
+        len += line;
+    }
+    message_body[len] = '\0';
+}
+
+static void print_usage(const char *program)
+{
+    printf("Verwendung: %s [-c verbindungen] [-t sekunden] [-m mix] [-s bytes] [-u user[,user...]] [-p passwort] <IP> <Port>\n", program);
+    printf("Beispiel: %s -c 1000 -t 30 -m send=70,list=10,read=15,del=5 -s 4096 -u if23b001 127.0.0.1 8080\n", program);
+    printf("  -c  Gleichzeitige Verbindungen (Standard: 100)\n");
+    printf("  -t  Messdauer in Sekunden (Standard: 10)\n");
+    printf("  -m  Gewichtung der Commands (Standard: send=50,list=20,read=20,del=10)\n");
+    printf("  -s  Größe des Nachrichtentexts in Bytes (Standard: 1024)\n");
+    printf("  -u  Benutzer, Verbindung i meldet sich als Benutzer i %% Anzahl an und schreibt sich selbst\n");
+    printf("  -p  Passwort aller Benutzer (Standard: Umgebungsvariable TWMAILER_BENCH_PASSWORD)\n");
+    printf("Achtung: wiederholt fehlgeschlagene Logins sperren die IP am Server.\n");
+}
+
+// -=- Verbindungen -=-
+
+static int choose_op(struct bench_conn *c)
+{
+    int roll = (int)(rand_r(&c->seed) % (unsigned int)mix_total);
+    for (int op = OP_SEND; op < OP_COUNT; op++)
+    {
+        if (roll < mix[op]) return op;
+        roll -= mix[op];
+    }
+    return OP_LIST;
+}
+
+static void queue_request(struct bench_conn *c, enum bench_op op)
+{
+    free(c->out);
+    c->out = NULL;
+    c->out_sent = 0;
+
+    int number = c->known_messages > 0 ? 1 + (int)(rand_r(&c->seed) % (unsigned int)c->known_messages) : 1;
+    int len = 0;
+    switch (op)
+    {
+        case OP_LOGIN:
+            len = asprintf(&c->out, "%s\n%s\n%s\n", CMD_LOGIN, c->user, password);
+            break;
+        case OP_SEND:
+            len = asprintf(&c->out, "%s\n%s\nbench %u\n%s.\n", CMD_SEND, c->user, (unsigned int)rand_r(&c->seed), message_body);
+            break;
+        case OP_LIST:
+            len = asprintf(&c->out, "%s\n", CMD_LIST);
+            break;
+        case OP_READ:
+            len = asprintf(&c->out, "%s\n%d\n", CMD_READ, number);
+            break;
+        case OP_DEL:
+            len = asprintf(&c->out, "%s\n%d\n", CMD_DEL, number);
+            break;
+        default:
+            break;
+    }
+    if (len < 0)
+    {
+        c->out = NULL;
+        len = 0;
+    }
+    c->out_len = (size_t)len;
+
+    c->op = op;
+    c->failed = 0;
+    c->list_remaining = -1;
+    c->in_body = 0;
+    c->state = CONN_WAITING;
+    c->start_us = now_us();
+}
+
+static int flush_request(struct bench_conn *c)
+{
+    while (c->out_sent < c->out_len)
+    {
+        ssize_t n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 1;
+        if (n <= 0) return 0;
+        c->out_sent += (size_t)n;
+    }
+    return 1;
+}
+
+// Eine Antwortzeile verarbeiten; 1 = Antwort vollständig
+static int handle_line(struct bench_conn *c, const char *line)
+{
+    switch (c->op)
+    {
+        case OP_LIST:
+            if (c->list_remaining < 0)
+            {
+                char *end;
+                long count = strtol(line, &end, 10);
+                if (*line == '\0' || *end)
+                {
+                    c->failed = 1; // ERR statt Anzahl
+                    return 1;
+                }
+                c->known_messages = (int)count;
+                c->list_remaining = (int)count;
+            }
+            else
+            {
+                c->list_remaining--;
+            }
+            return c->list_remaining == 0;
+
+        case OP_READ:
+            if (c->in_body) return strcmp(line, ".") == 0;
+            if (strcmp(line, RESP_OK) != 0)
+            {
+                c->failed = 1;
+                return 1;
+            }
+            c->in_body = 1;
+            return 0;
+
+        default:
+            c->failed = strcmp(line, RESP_OK) != 0;
+            if (!c->failed && c->op == OP_SEND) c->known_messages++;
+            if (!c->failed && c->op == OP_DEL && c->known_messages > 0) c->known_messages--;
+            return 1;
+    }
+}
+
+static void conn_close(int epoll_fd, struct bench_conn *c)
+{
+    if (c->fd >= 0)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+    }
+    lr_free(&c->reader);
+    free(c->out);
+    c->out = NULL;
+    c->fd = -1;
+    c->state = CONN_DONE;
+}
+
+// 0 = Verbindung beenden
+static int conn_read(struct bench_conn *c, int running)
+{
+    while (1)
+    {
+        char *line;
+        size_t line_len;
+        while (c->state == CONN_WAITING && lr_next_line(&c->reader, &line, &line_len))
+        {
+            if (!handle_line(c, line)) continue;
+
+            record(c->op, c->start_us, c->failed);
+            if (c->op == OP_LOGIN && c->failed) return 0; // Weitere Versuche würden die IP sperren
+            if (!running) return 0;
+            queue_request(c, choose_op(c));
+            if (!flush_request(c)) return 0;
+        }
+
+        ssize_t n = lr_fill(&c->reader);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 1;
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+    }
+}
+
+static int conn_start(int epoll_fd, struct bench_conn *c, const struct sockaddr_in *address)
+{
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0) return 0;
+
+    int nodelay = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    if (connect(c->fd, (const struct sockaddr*)address, sizeof(*address)) < 0 && errno != EINPROGRESS)
+    {
+        close(c->fd);
+        c->fd = -1;
+        return 0;
+    }
+
+    lr_init(&c->reader, c->fd, LINE_LEN + 2);
+    c->state = CONN_CONNECTING;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) == 0;
+}
+
+static void conn_event(int epoll_fd, struct bench_conn *c, uint32_t events, int running)
+{
+    if (c->state == CONN_CONNECTING)
+    {
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) return;
+
+        int error = 0;
+        socklen_t len = sizeof(error);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+        if (error != 0 || !running)
+        {
+            conn_close(epoll_fd, c);
+            return;
+        }
+        queue_request(c, OP_LOGIN);
+    }
+
+    if (!flush_request(c) || !conn_read(c, running)) conn_close(epoll_fd, c);
+}
+
+// -=- Bericht -=-
+
+static void print_report(double seconds, int connections, int failed_connections)
+{
+    printf("\n%d Verbindungen (%d fehlgeschlagen), %.1f s, Nachrichten %zu Bytes\n",
+           connections, failed_connections, seconds, message_size);
+    printf("%-7s %10s %8s %10s %9s %9s %9s %9s\n", "Command", "Anzahl", "Fehler", "ops/s", "p50 ms", "p99 ms", "p99.9 ms", "max ms");
+
+    struct bench_histogram total;
+    memset(&total, 0, sizeof(total));
+    for (int op = 0; op < OP_COUNT; op++)
+    {
+        const struct bench_histogram *h = &results[op];
+        if (h->count == 0) continue;
+        printf("%-7s %10llu %8llu %10.0f %9.3f %9.3f %9.3f %9.3f\n", op_names[op],
+               (unsigned long long)h->count, (unsigned long long)h->errors, h->count / seconds,
+               percentile_ms(h, 0.50), percentile_ms(h, 0.99), percentile_ms(h, 0.999), h->max_us / 1000.0);
+
+        for (int i = 0; i < BENCH_BUCKETS; i++) total.buckets[i] += h->buckets[i];
+        total.count += h->count;
+        total.errors += h->errors;
+        if (h->max_us > total.max_us) total.max_us = h->max_us;
+    }
+    printf("%-7s %10llu %8llu %10.0f %9.3f %9.3f %9.3f %9.3f\n", "Gesamt",
+           (unsigned long long)total.count, (unsigned long long)total.errors, total.count / seconds,
+           percentile_ms(&total, 0.50), percentile_ms(&total, 0.99), percentile_ms(&total, 0.999), total.max_us / 1000.0);
+    printf("(READ/DEL Fehler enthalten Nummern, die eine andere Verbindung schon gelöscht hat)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int connection_count = 100;
+    int duration = 10;
+    char *users = NULL;
+    password = getenv("TWMAILER_BENCH_PASSWORD");
+
+    int opt_char;
+    while ((opt_char = getopt(argc, argv, "c:t:m:s:u:p:")) != -1)
+    {
+        switch (opt_char)
+        {
+            case 'c':
+                connection_count = atoi(optarg);
+                break;
+            case 't':
+                duration = atoi(optarg);
+                break;
+            case 'm':
+                if (!parse_mix(optarg))
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 's':
+                message_size = (size_t)atol(optarg);
+                break;
+            case 'u':
+                users = optarg;
+                break;
+            case 'p':
+                password = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind != 2 || !users || !password || connection_count <= 0 || duration <= 0 || message_size == 0)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)atoi(argv[optind + 1]));
+    const char *server_ip = strcmp(argv[optind], "localhost") == 0 ? "127.0.0.1" : argv[optind];
+    if (inet_pton(AF_INET, server_ip, &address.sin_addr) != 1)
+    {
+        printf("Fehler: Ungültige Server Addresse\n");
+        return 1;
+    }
+
+    // Benutzerliste aufteilen
+    int user_count = 0;
+    char *user_list[256];
+    for (char *user = strtok(users, ","); user && user_count < 256; user = strtok(NULL, ",")) user_list[user_count++] = user;
+
+    // Tausende Verbindungen brauchen mehr Deskriptoren als das übliche Soft-Limit
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    build_body();
+    struct bench_conn *conns = calloc((size_t)connection_count, sizeof(*conns));
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (!conns || !message_body || epoll_fd < 0)
+    {
+        perror("Setup failed");
+        return 1;
+    }
+
+    int failed_connections = 0;
+    for (int i = 0; i < connection_count; i++)
+    {
+        struct bench_conn *c = &conns[i];
+        c->fd = -1;
+        c->user = user_list[i % user_count];
+        c->seed = (unsigned int)(i * 2654435761u) ^ (unsigned int)now_us();
+        if (!conn_start(epoll_fd, c, &address))
+        {
+            if (errno == EMFILE) printf("Zu viele offene Dateien: ulimit -n erhöhen\n");
+            conn_close(epoll_fd, c);
+            failed_connections++;
+        }
+    }
+
+    printf("Benchmark läuft: %d Verbindungen, %d s...\n", connection_count, duration);
+    uint64_t started = now_us();
+    uint64_t deadline = started + (uint64_t)duration * 1000000ULL;
+    uint64_t drain_deadline = deadline + BENCH_DRAIN_SECONDS * 1000000ULL;
+    int open_connections = connection_count - failed_connections;
+
+    struct epoll_event events[BENCH_MAX_EVENTS];
+    while (open_connections > 0)
+    {
+        uint64_t now = now_us();
+        if (now >= drain_deadline) break;
+        int running = now < deadline;
+
+        int timeout = (int)(((running ? deadline : drain_deadline) - now) / 1000) + 1;
+        int ready = epoll_wait(epoll_fd, events, BENCH_MAX_EVENTS, timeout);
+        if (ready < 0 && errno != EINTR) break;
+
+        running = now_us() < deadline;
+        for (int i = 0; i < ready; i++)
+        {
+            struct bench_conn *c = events[i].data.ptr;
+            if (c->state == CONN_DONE) continue;
+            conn_event(epoll_fd, c, events[i].events, running);
+            if (c->state == CONN_DONE) open_connections--;
+        }
+    }
+
+    double seconds = (double)(deadline - started) / 1e6;
+    for (int i = 0; i < connection_count; i++)
+    {
+        if (conns[i].state != CONN_DONE) conn_close(epoll_fd, &conns[i]);
+    }
+    close(epoll_fd);
+
+    print_report(seconds, connection_count, failed_connections);
+    free(conns);
+    free(message_body);
+    return 0;
+}
@@ -0,0 +1,260 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include "Headers/blacklist.h"
+#include "Headers/log.h"
+
+#define BLACKLIST_TMP_FILE BLACKLIST_FILE ".tmp"
+
+// IPv4 wird als IPv4-mapped IPv6 Adresse (::ffff:a.b.c.d) gespeichert
+struct blacklist_entry
+{
+    unsigned char addr[16];
+    time_t until;           // 0 = Slot nie benutzt (beendet die Suche)
+};
+
+struct blacklist
+{
+    pthread_mutex_t lock;
+    uint32_t used;          // Belegte Slots inklusive abgelaufener
+    struct blacklist_entry entries[BLACKLIST_SLOTS];
+};
+
+static struct blacklist *table = NULL;
+
+static int parse_ip(const char *ip, unsigned char *addr)
+{
+    struct in_addr v4;
+    if (inet_pton(AF_INET, ip, &v4) == 1)
+    {
+        memset(addr, 0, 10);
+        addr[10] = addr[11] = 0xff;
+        memcpy(addr + 12, &v4, 4);
+        return 1;
+    }
+    return inet_pton(AF_INET6, ip, addr) == 1;
+}
+
+static uint32_t hash_addr(const unsigned char *addr)
+{
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (int i = 0; i < 16; i++) hash = (hash ^ addr[i]) * 16777619u;
+    return hash;
+}
+
+static int table_lock(void)
+{
+    int rc = pthread_mutex_lock(&table->lock);
+    if (rc == EOWNERDEAD)
+    {
+        pthread_mutex_consistent(&table->lock); // Einträge werden nur einzeln überschrieben
+        rc = 0;
+    }
+    return rc == 0;
+}
+
+// Aufrufer hält table->lock. Lineares Sondieren; abgelaufene Einträge bleiben
+// als Platzhalter liegen, bis blacklist_reap() die Tabelle neu aufbaut.
+static int table_insert(const unsigned char *addr, time_t until, time_t now)
+{
+    uint32_t mask = BLACKLIST_SLOTS - 1;
+    uint32_t slot = hash_addr(addr) & mask;
+    struct blacklist_entry *reuse = NULL;
+
+    for (uint32_t probe = 0; probe < BLACKLIST_SLOTS; probe++, slot = (slot + 1) & mask)
+    {
+        struct blacklist_entry *entry = &table->entries[slot];
+        if (entry->until == 0)
+        {
+            if (!reuse)
+            {
+                // Nur neue Slots zählen; ab 3/4 Füllung erst aufräumen lassen
+                if (table->used >= BLACKLIST_SLOTS / 4 * 3) return 0;
+                table->used++;
+                reuse = entry;
+            }
+            break;
+        }
+        if (memcmp(entry->addr, addr, 16) == 0)
+        {
+            if (until > entry->until) entry->until = until;
+            return 1;
+        }
+        if (!reuse && entry->until <= now) reuse = entry;
+    }
+    if (!reuse) return 0;
+
+    memcpy(reuse->addr, addr, 16);
+    reuse->until = until;
+    return 1;
+}
+
+static void append_to_file(const char *ip, time_t until)
+{
+    FILE *f = fopen(BLACKLIST_FILE, "a");
+    if (!f) return;
+    fprintf(f, "%s %ld\n", ip, (long)until);
+    fclose(f);
+}
+
+// -=- Öffentliche Funktionen -=-
+
+int blacklist_init(void)
+{
+    if (table) return 1;
+
+    table = mmap(NULL, sizeof(*table), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED)
+    {
+        table = NULL;
+        return 0;
+    }
+    memset(table, 0, sizeof(*table));
+
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&table->lock, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+
+    // Noch gültige Sperren aus der letzten Laufzeit übernehmen
+    FILE *f = fopen(BLACKLIST_FILE, "r");
+    if (f)
+    {
+        char file_ip[64];
+        long until = 0;
+        time_t now = time(NULL);
+        while (fscanf(f, "%63s %ld", file_ip, &until) == 2)
+        {
+            unsigned char addr[16];
+            if (until > now && parse_ip(file_ip, addr)) table_insert(addr, until, now);
+        }
+        fclose(f);
+    }
+    blacklist_reap(); // Datei gleich ohne abgelaufene Einträge neu schreiben
+    return 1;
+}
+
+int blacklist_contains(const char *ip)
+{
+    unsigned char addr[16];
+    if (!table || !parse_ip(ip, addr)) return 0;
+
+    time_t now = time(NULL);
+    uint32_t mask = BLACKLIST_SLOTS - 1;
+    uint32_t slot = hash_addr(addr) & mask;
+    int found = 0;
+
+    if (!table_lock()) return 0;
+    for (uint32_t probe = 0; probe < BLACKLIST_SLOTS; probe++, slot = (slot + 1) & mask)
+    {
+        const struct blacklist_entry *entry = &table->entries[slot];
+        if (entry->until == 0) break;
+        if (memcmp(entry->addr, addr, 16) == 0)
+        {
+            found = entry->until > now; // IP ist noch gesperrt
+            break;
+        }
+    }
+    pthread_mutex_unlock(&table->lock);
+    return found;
+}
+
+void blacklist_add(const char *ip)
+{
+    unsigned char addr[16];
+    if (!table || !parse_ip(ip, addr)) return;
+
+    time_t now = time(NULL);
+    time_t until = now + BLACKLIST_DURATION;
+
+    if (!table_lock()) return;
+    int ok = table_insert(addr, until, now);
+    if (ok) append_to_file(ip, until); // Unter dem Lock: kein Konflikt mit blacklist_reap()
+    pthread_mutex_unlock(&table->lock);
+
+    if (ok)
+    {
+        log_warn("[SERVER] Added IP %s to blacklist for %d seconds.", ip, BLACKLIST_DURATION);
+    }
+    else
+    {
+        log_error("[SERVER] Blacklist voll, IP %s nicht gesperrt.", ip);
+    }
+}
+
+void blacklist_reap(void)
+{
+    if (!table) return;
+
+    struct blacklist_entry *live = malloc(sizeof(table->entries));
+    if (!live) return;
+
+    if (!table_lock())
+    {
+        free(live);
+        return;
+    }
+
+    // Noch gültige Einträge sammeln und die Tabelle ohne Platzhalter neu aufbauen
+    time_t now = time(NULL);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < BLACKLIST_SLOTS; i++)
+    {
+        if (table->entries[i].until > now) live[count++] = table->entries[i];
+    }
+    memset(table->entries, 0, sizeof(table->entries));
+    table->used = 0;
+    for (uint32_t i = 0; i < count; i++) table_insert(live[i].addr, live[i].until, now);
+
+    // Schnappschuss schreiben und atomar ersetzen
+    FILE *f = count > 0 ? fopen(BLACKLIST_TMP_FILE, "w") : NULL;
+    if (count == 0) unlink(BLACKLIST_FILE);
+    if (f)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            char ip[INET6_ADDRSTRLEN];
+            static const unsigned char v4_prefix[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+            if (memcmp(live[i].addr, v4_prefix, 12) == 0) inet_ntop(AF_INET, live[i].addr + 12, ip, sizeof(ip));
+            else inet_ntop(AF_INET6, live[i].addr, ip, sizeof(ip));
+            fprintf(f, "%s %ld\n", ip, (long)live[i].until);
+        }
+        if (fclose(f) == 0) rename(BLACKLIST_TMP_FILE, BLACKLIST_FILE);
+        else unlink(BLACKLIST_TMP_FILE);
+    }
+
+    pthread_mutex_unlock(&table->lock);
+    free(live);
+}
+
+void blacklist_start_reaper(void)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        log_error("Blacklist reaper fork failed: %s", strerror(errno));
+        return;
+    }
+    if (pid > 0) return;
+
+    // Kindprozess: teilt die Tabelle mit dem Server, stirbt mit ihm
+    signal(SIGCHLD, SIG_DFL);
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    while (1)
+    {
+        sleep(BLACKLIST_REAP_INTERVAL);
+        blacklist_reap();
+    }
+}
@@ -1,13 +1,27 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include "Headers/common.h"
+#include "Headers/linereader.h"
+#include "Headers/batch.h"
+#include "Headers/tls.h"
+#include "Headers/compress.h"
 
 char session_user[USER_LEN + 2] = "";
+struct line_reader server_reader; // Gepufferte Antworten vom Server
+struct ssl_st *server_tls = NULL; // Gesetzt mit -t
+struct wire_compress *server_wire = NULL; // Gesetzt mit -z, wenn der Server COMPRESS DEFLATE kann
+
+#define LIST_PAGE_SIZE 20 // Treffer pro Seite beim Suchen
 
 int connect_to_server(const char* server_ip, int port) 
 {
@@ -57,15 +71,126 @@ int connect_to_server(const char* server_ip, int port)
 
 void read_server_line(int sock, char* buffer, int size) 
 {
-    int i = 0;
-    char c;
-    
-    while (i < size - 1 && read(sock, &c, 1) > 0) 
+    char *line = "";
+    size_t len;
+
+    (void)sock; // Der Reader ist beim Verbindungsaufbau an den Socket gebunden
+    if (lr_read_line(&server_reader, &line, &len) < 0) len = 0;
+    if (len > (size_t)size - 1) len = size - 1;
+    memcpy(buffer, line, len);
+    buffer[len] = '\0';
+}
+
+// TLS über den verbundenen Socket; host wie auf der Kommandozeile (Prüfung des Zertifikats)
+int start_tls(int sock, const char *host)
+{
+    server_tls = tls_client_connect(sock, host);
+    if (!server_tls)
+    {
+        printf("Fehler: TLS Verbindung fehlgeschlagen (%s)\n", tls_last_error());
+        return 0;
+    }
+    return 1;
+}
+
+void close_connection(int sock)
+{
+    wire_compress_free(server_wire);
+    server_wire = NULL;
+    tls_free(server_tls);
+    server_tls = NULL;
+    close(sock);
+}
+
+// Schreibt alles, bei TLS über SSL_write(), mit -z komprimiert
+void send_raw(int sock, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = server_wire ? wire_write(server_wire, data, len)
+                  : server_tls ? tls_write(server_tls, data, len) : write(sock, data, len);
+        if (n <= 0) return;
+        data += n;
+        len -= n;
+    }
+}
+
+// Schickt mehrere Protokollzeilen mit einem writev() statt einzelner write()s
+void send_lines(int sock, const char **lines, int count)
+{
+    if (server_tls || server_wire)
+    {
+        // Ein TLS Record bzw. ein deflate-Block für alle Zeilen
+        char joined[4 * LINE_LEN];
+        size_t len = 0;
+        for (int i = 0; i < count; i++)
+        {
+            len += snprintf(joined + len, sizeof(joined) - len, "%s\n", lines[i]);
+            if (len >= sizeof(joined)) len = sizeof(joined) - 1;
+        }
+        send_raw(sock, joined, len);
+        return;
+    }
+
+    struct iovec iov[16];
+    int iov_count = 0;
+
+    for (int i = 0; i < count && iov_count < 16; i++)
+    {
+        iov[iov_count].iov_base = (void *)lines[i];
+        iov[iov_count].iov_len = strlen(lines[i]);
+        iov_count++;
+        iov[iov_count].iov_base = "\n";
+        iov[iov_count].iov_len = 1;
+        iov_count++;
+    }
+    writev(sock, iov, iov_count);
+}
+
+// Fragt per CAPA, ob der Server komprimieren kann, und schaltet dann beide Richtungen um.
+// Ohne Unterstützung geht es unkomprimiert weiter; 0 nur bei Verbindungsfehlern
+int start_compress(int sock)
+{
+    char line[LINE_LEN];
+    const char *capa[] = { CMD_CAPA };
+    send_lines(sock, capa, 1);
+    read_server_line(sock, line, sizeof(line));
+    if (line[0] == '\0') return 0;
+
+    int supported = 0;
+    int count = strcmp(line, RESP_ERR) == 0 ? 0 : atoi(line); // Älterer Server: ERR
+    for (int i = 0; i < count; i++)
+    {
+        read_server_line(sock, line, sizeof(line));
+        if (strcmp(line, CAPA_COMPRESS_DEFLATE) == 0) supported = 1;
+    }
+    if (!supported)
+    {
+        fprintf(stderr, "Hinweis: Server unterstützt keine Kompression, Verbindung bleibt unkomprimiert\n");
+        return 1;
+    }
+
+    const char *command[] = { CMD_COMPRESS, COMPRESS_DEFLATE };
+    send_lines(sock, command, 2);
+    read_server_line(sock, line, sizeof(line));
+    if (strcmp(line, RESP_OK) != 0)
     {
-        if (c == '\n') break;
-        buffer[i++] = c;
+        fprintf(stderr, "Hinweis: Kompression abgelehnt (%s)\n", line);
+        return line[0] != '\0';
+    }
+
+    // Alles nach dem OK ist komprimiert, auch was schon im Reader liegt
+    char *pending = NULL;
+    size_t pending_len = lr_take(&server_reader, lr_pending(&server_reader), &pending);
+    server_wire = wire_compress_new(sock, server_tls ? tls_read : NULL, server_tls,
+                                    server_tls ? tls_write : NULL, server_tls, pending, pending_len);
+    if (!server_wire)
+    {
+        printf("Fehler: Kein Speicher für die Kompression\n");
+        return 0;
     }
-    buffer[i] = '\0';
+    lr_set_source(&server_reader, wire_read, server_wire);
+    return 1;
 }
 
 int perform_login(int sock)
@@ -82,12 +207,8 @@ int perform_login(int sock)
     fgets(password, sizeof(password), stdin);
     password[strcspn(password, "\n")] = '\0';
 
-    write(sock, CMD_LOGIN, strlen(CMD_LOGIN));
-    write(sock, "\n", 1);
-    write(sock, username, strlen(username));
-    write(sock, "\n", 1);
-    write(sock, password, strlen(password));
-    write(sock, "\n", 1);
+    const char *command[] = { CMD_LOGIN, username, password };
+    send_lines(sock, command, 3);
 
     read_server_line(sock, response, sizeof(response));
 
@@ -106,15 +227,14 @@ int perform_login(int sock)
 
 void send_message_to_server(int sock) 
 {
-    char receiver[USER_LEN + 2]; 
+    char receiver[MSEND_MAX_RECIPIENTS * (USER_LEN + 1) + 1]; // Ein Empfänger oder Liste a,b,c
     char subject[SUBJECT_LEN + 2];
-    char line[LINE_LEN];
     
     printf("--- Sende Nachricht  ---\n");
     
     // Benutzerdaten eingeben
     
-    printf("Empfänger: ");
+    printf("Empfänger (mehrere mit ','): ");
     fgets(receiver, sizeof(receiver), stdin);
     receiver[strcspn(receiver, "\n")] = '\0';
     
@@ -122,30 +242,43 @@ void send_message_to_server(int sock)
     fgets(subject, sizeof(subject), stdin);
     subject[strcspn(subject, "\n")] = '\0';
     
-    // Befehl an Server senden
-
-    write(sock, CMD_SEND, strlen(CMD_SEND));
-    write(sock, "\n", 1);
-    write(sock, receiver, strlen(receiver));
-    write(sock, "\n", 1);
-    write(sock, subject, strlen(subject));
-    write(sock, "\n", 1);
-    
-    // Nachrichtentext eingeben
+    // Nachrichtentext eingeben, beliebig lange Zeilen. Der Text geht erst
+    // danach mit Längenangabe hinaus (SEND <bytes>, kein "." am Ende)
 
     printf("Gib deine Nachricht ein (Beende mit einen '.' oder einer leeren Linie.):\n");
-    while (1) 
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *body_stream = open_memstream(&body, &body_len);
+    if (!body_stream)
     {
-        fgets(line, sizeof(line), stdin);
-        
-        if (strcmp(line, ".\n") == 0) 
-        {
-            write(sock, ".\n", 2);
-            break;
-        }
-        
-        write(sock, line, strlen(line));
+        printf("Fehler: Kein Speicher für die Nachricht\n");
+        return;
     }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    while (getline(&line, &line_size, stdin) >= 0 && strcmp(line, ".\n") != 0)
+    {
+        fputs(line, body_stream);
+    }
+    free(line);
+    fclose(body_stream);
+
+    if (body_len > SEND_MAX_BODY_LEN)
+    {
+        printf("Fehler: Nachricht länger als %lu Bytes\n", SEND_MAX_BODY_LEN);
+        free(body);
+        return;
+    }
+
+    // Befehl an Server senden
+
+    char send_command[32];
+    snprintf(send_command, sizeof(send_command), "%s %zu", CMD_SEND, body_len);
+    const char *command[] = { send_command, receiver, subject };
+    send_lines(sock, command, 3);
+    send_raw(sock, body, body_len);
+    free(body);
     
     // Antwort vom Server lesen
 
@@ -161,8 +294,8 @@ void list_user_messages(int sock)
     
     // Befehl an Server senden
 
-    write(sock, CMD_LIST, strlen(CMD_LIST));
-    write(sock, "\n", 1);
+    const char *command[] = { CMD_LIST };
+    send_lines(sock, command, 1);
     
     // Anzahl der Nachrichten lesen
 
@@ -182,6 +315,66 @@ void list_user_messages(int sock)
     }
 }
 
+void search_user_messages(int sock)
+{
+    char sender[USER_LEN + 2];
+    char subject[SUBJECT_LEN + 2];
+    char page_str[10];
+
+    printf("--- Nachrichten suchen (neueste zuerst) ---\n");
+
+    printf("Absender (leer = alle): ");
+    fgets(sender, sizeof(sender), stdin);
+    sender[strcspn(sender, "\n")] = '\0';
+
+    printf("Betreff enthält (leer = alle): ");
+    fgets(subject, sizeof(subject), stdin);
+    subject[strcspn(subject, "\n")] = '\0';
+
+    printf("Seite (Standard 1): ");
+    fgets(page_str, sizeof(page_str), stdin);
+    int page = atoi(page_str);
+    if (page < 1) page = 1;
+
+    // Der Server filtert und schickt nur die angefragte Seite (subject= muss am Ende stehen)
+    char command[LINE_LEN];
+    int len = snprintf(command, sizeof(command), "%s %s=%s %s=%d %s=%d", CMD_LIST, LIST_PARAM_ORDER, LIST_ORDER_DESC,
+                       LIST_PARAM_OFFSET, (page - 1) * LIST_PAGE_SIZE, LIST_PARAM_LIMIT, LIST_PAGE_SIZE);
+    if (sender[0]) len += snprintf(command + len, sizeof(command) - len, " %s=%s", LIST_PARAM_FROM, sender);
+    if (subject[0]) snprintf(command + len, sizeof(command) - len, " %s=%s", LIST_PARAM_SUBJECT, subject);
+
+    const char *lines[] = { command };
+    send_lines(sock, lines, 1);
+
+    // "<anzahl> <gesamt>" oder ERR (älterer Server)
+    char count_str[32];
+    read_server_line(sock, count_str, sizeof(count_str));
+    if (strcmp(count_str, RESP_ERR) == 0)
+    {
+        printf("Server: %s (Suche nicht unterstützt oder ungültige Eingabe)\n", count_str);
+        return;
+    }
+    int count = 0;
+    unsigned int total = 0;
+    sscanf(count_str, "%d %u", &count, &total);
+
+    printf("\nSeite %d: %d Treffer (Mailbox: %u Nachrichten)\n", page, count, total);
+
+    // "<nummer> <id> <absender> <betreff>"
+    for (int i = 0; i < count; i++)
+    {
+        char line[LINE_LEN];
+        read_server_line(sock, line, sizeof(line));
+
+        int number = 0;
+        char from[USER_LEN + 1] = "";
+        int subject_start = 0;
+        sscanf(line, "%d %*u %8s %n", &number, from, &subject_start);
+        printf("%d. [%s] %s\n", number, from, subject_start > 0 ? line + subject_start : "");
+    }
+    if (count == LIST_PAGE_SIZE) printf("Evtl. weitere Treffer auf Seite %d\n", page + 1);
+}
+
 void read_single_message(int sock) 
 {
     char msg_num_str[10];
@@ -194,10 +387,8 @@ void read_single_message(int sock)
     
     // Befehl an Server senden
 
-    write(sock, CMD_READ, strlen(CMD_READ));
-    write(sock, "\n", 1);
-    write(sock, msg_num_str, strlen(msg_num_str));
-    write(sock, "\n", 1);
+    const char *command[] = { CMD_READ, msg_num_str };
+    send_lines(sock, command, 2);
     
     char response[10];
     read_server_line(sock, response, sizeof(response));
@@ -231,10 +422,8 @@ void delete_message(int sock)
     
     // Befehl an Server senden
 
-    write(sock, CMD_DEL, strlen(CMD_DEL));
-    write(sock, "\n", 1);
-    write(sock, msg_num_str, strlen(msg_num_str));
-    write(sock, "\n", 1);
+    const char *command[] = { CMD_DEL, msg_num_str };
+    send_lines(sock, command, 2);
     
     // Antwort vom Server lesen
 
@@ -243,17 +432,140 @@ void delete_message(int sock)
     printf("Server: %s\n", response);
 }
 
+void print_usage(const char *program)
+{
+    printf("Benutzung: %s [-t [-C ca.pem] [-R session.pem]] [-z] [-b befehlsdatei|- -u user [-p passwort]] <server-ip> <port>\n", program);
+    printf("Beispiel: %s localhost 8080\n", program);
+    printf("          %s -b befehle.txt -u if23b001 localhost 8080\n", program);
+    printf("          %s -t -C cert.pem -R ~/.twmailer-session localhost 8080\n", program);
+    printf("  -t  Verbindung mit TLS (Server mit -S gestartet)\n");
+    printf("  -C  CA-Zertifikat(e) für die Prüfung des Servers, z.B. dessen selbst signiertes\n");
+    printf("      Zertifikat (Standard: System-CAs)\n");
+    printf("  -R  Session-Ticket in dieser Datei speichern und beim nächsten Start wiederverwenden\n");
+    printf("  -z  Verbindung komprimieren (deflate), falls der Server es anbietet; lohnt bei langsamen Leitungen\n");
+    printf("  -b  Batch-Modus: Commands aus der Datei (- = stdin) ohne Rückfragen\n");
+    printf("      und ohne auf Antworten zu warten senden (LIST [order=desc limit=20 ...], READ 1-20, DEL 3,\n");
+    printf("      SEND <empfänger> <betreff> + Text bis '.')\n");
+    printf("  -u  Benutzer für den Batch-Modus\n");
+    printf("  -p  Passwort (Standard: Umgebungsvariable TWMAILER_PASSWORD)\n");
+}
+
+int run_batch(const char *path, const char *server_ip, int port, int use_tls, int use_compress, const char *user, const char *password)
+{
+    FILE *input = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!input)
+    {
+        fprintf(stderr, "Fehler: %s kann nicht gelesen werden\n", path);
+        return 1;
+    }
+
+    // Erst die ganze Datei prüfen, damit Syntaxfehler nichts halb ausführen
+    struct batch *batch = batch_load(input);
+    if (input != stdin) fclose(input);
+    if (!batch) return 1;
+
+    int sock = connect_to_server(server_ip, port);
+    if (sock < 0)
+    {
+        batch_free(batch);
+        return 1;
+    }
+
+    int nodelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    if (use_tls)
+    {
+        signal(SIGPIPE, SIG_IGN); // SSL_write() kennt kein MSG_NOSIGNAL
+        if (!start_tls(sock, server_ip))
+        {
+            close(sock);
+            batch_free(batch);
+            return 1;
+        }
+    }
+
+    // Aushandeln noch blockierend und Antwort für Antwort, danach läuft alles gepipelined
+    if (use_compress)
+    {
+        lr_init(&server_reader, sock, LINE_LEN);
+        if (server_tls) lr_set_source(&server_reader, tls_read, server_tls);
+        int started = start_compress(sock);
+        lr_free(&server_reader);
+        if (!started)
+        {
+            close_connection(sock);
+            batch_free(batch);
+            return 1;
+        }
+    }
+
+    int ok = batch_run(batch, sock, server_tls, server_wire, user, password);
+    close_connection(sock);
+    batch_free(batch);
+    return ok ? 0 : 1;
+}
+
 int main(int argc, char *argv[]) 
 {
-    if (argc != 3) 
+    const char *batch_path = NULL;
+    const char *batch_user = NULL;
+    const char *batch_password = getenv("TWMAILER_PASSWORD");
+    int use_tls = 0;
+    int use_compress = 0;
+    const char *ca_file = NULL;
+    const char *session_file = NULL;
+
+    int opt_char;
+    while ((opt_char = getopt(argc, argv, "b:u:p:tzC:R:")) != -1)
+    {
+        switch (opt_char)
+        {
+            case 't':
+                use_tls = 1;
+                break;
+            case 'z':
+                use_compress = 1;
+                break;
+            case 'C':
+                ca_file = optarg;
+                break;
+            case 'R':
+                session_file = optarg;
+                break;
+            case 'b':
+                batch_path = optarg;
+                break;
+            case 'u':
+                batch_user = optarg;
+                break;
+            case 'p':
+                batch_password = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind != 2 || (batch_path && (!batch_user || !batch_password)) ||
+        ((ca_file || session_file) && !use_tls))
     {
-        printf("Benutzung: %s <server-ip> <port>\n", argv[0]);
-        printf("Beispiel: %s localhost 8080\n", argv[0]);
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (use_tls && !tls_client_init(ca_file, session_file))
+    {
+        printf("Fehler: TLS konnte nicht initialisiert werden (%s)\n", tls_last_error());
         return 1;
     }
     
-    char *server_ip = argv[1];
-    int port = atoi(argv[2]);
+    char *server_ip = argv[optind];
+    int port = atoi(argv[optind + 1]);
+
+    if (batch_path)
+    {
+        return run_batch(batch_path, server_ip, port, use_tls, use_compress, batch_user, batch_password);
+    }
     
     int sock = connect_to_server(server_ip, port);
     if (sock < 0) 
@@ -261,6 +573,22 @@ int main(int argc, char *argv[])
         return 1;
     }
     
+    lr_init(&server_reader, sock, LINE_LEN);
+    if (use_tls)
+    {
+        if (!start_tls(sock, server_ip))
+        {
+            close(sock);
+            return 1;
+        }
+        lr_set_source(&server_reader, tls_read, server_tls);
+    }
+    if (use_compress && !start_compress(sock))
+    {
+        printf("Error: Connection to server failed\n");
+        close_connection(sock);
+        return 1;
+    }
     printf("Verbindung zum Mail Server %s erfolgreich:%d\n", server_ip, port);
   
     int logged_in = 0;
@@ -282,9 +610,8 @@ int main(int argc, char *argv[])
         }
         else if(c[0] == '2')
         {
-            write(sock, CMD_QUIT, strlen(CMD_QUIT));
-            write(sock, "\n", 1);
-            close(sock);
+            send_lines(sock, (const char *[]){ CMD_QUIT }, 1);
+            close_connection(sock);
             return 0;
         }
     }
@@ -297,6 +624,7 @@ int main(int argc, char *argv[])
         printf("3. Nachricht lesen\n");
         printf("4. Nachricht löschen\n");
         printf("5. Beenden\n");
+        printf("6. Nachrichten suchen\n");
         printf("Wähle: ");
         
         char choice[10];
@@ -316,16 +644,18 @@ int main(int argc, char *argv[])
                 delete_message(sock);
                 break;
             case '5':
-                write(sock, CMD_QUIT, strlen(CMD_QUIT));
-                write(sock, "\n", 1);
-                close(sock);
+                send_lines(sock, (const char *[]){ CMD_QUIT }, 1);
+                close_connection(sock);
                 printf("Auf Wiedersehen!\n");
                 return 0;
+            case '6':
+                search_user_messages(sock);
+                break;
             default:
                 printf("Ungültige Wahl\n");
         }
     }
     
-    close(sock);
+    close_connection(sock);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,403 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <zlib.h>
+#include "Headers/compress.h"
+
+#define GZIP_WINDOW_BITS (16 + MAX_WBITS)   // zlib mit gzip Header und Trailer (CRC32, Länge)
+#define GZIP_TRAILER_LEN 8
+#define WRITER_BUFFER_SIZE (64 * 1024)      // stdio-Puffer vor deflate(): wenige, große Aufrufe
+#define WIRE_WINDOW_BITS (-MAX_WBITS)       // Raw deflate ohne Header, wie IMAP COMPRESS
+
+static int compress_level = 0;              // 0 = aus
+
+int compress_configure(const char *spec)
+{
+    if (strcmp(spec, "none") == 0)
+    {
+        compress_level = 0;
+        return 1;
+    }
+    if (strcmp(spec, "gzip") == 0)
+    {
+        compress_level = COMPRESS_DEFAULT_LEVEL;
+        return 1;
+    }
+    if (strncmp(spec, "gzip:", 5) == 0 && spec[5] >= '1' && spec[5] <= '9' && spec[6] == '\0')
+    {
+        compress_level = spec[5] - '0';
+        return 1;
+    }
+    return 0;
+}
+
+int compress_enabled(void)
+{
+    return compress_level > 0;
+}
+
+// -=- Schreiben -=-
+
+struct gzip_writer
+{
+    FILE *raw;
+    z_stream z;
+    unsigned char out[COMPRESS_BUFFER_SIZE];
+};
+
+// Gibt alles, was deflate() gerade liefert, an raw weiter; 0 = Fehler
+static int writer_drain(struct gzip_writer *w, int flush)
+{
+    int rc;
+    do
+    {
+        w->z.next_out = w->out;
+        w->z.avail_out = sizeof(w->out);
+        rc = deflate(&w->z, flush);
+        if (rc == Z_STREAM_ERROR) return 0;
+
+        size_t have = sizeof(w->out) - w->z.avail_out;
+        if (have > 0 && fwrite(w->out, 1, have, w->raw) != have) return 0;
+    } while (w->z.avail_out == 0 || (flush == Z_FINISH && rc != Z_STREAM_END));
+    return 1;
+}
+
+static ssize_t writer_write(void *cookie, const char *buf, size_t size)
+{
+    struct gzip_writer *w = cookie;
+    w->z.next_in = (Bytef *)buf;
+    w->z.avail_in = (uInt)size;
+    return writer_drain(w, Z_NO_FLUSH) ? (ssize_t)size : 0; // 0 = Fehler für fopencookie
+}
+
+static int writer_close(void *cookie)
+{
+    struct gzip_writer *w = cookie;
+    w->z.next_in = NULL;
+    w->z.avail_in = 0;
+    int ok = writer_drain(w, Z_FINISH);
+    deflateEnd(&w->z);
+    free(w);
+    return ok ? 0 : EOF;
+}
+
+FILE *compress_writer(FILE *raw)
+{
+    struct gzip_writer *w = calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    w->raw = raw;
+    int level = compress_level > 0 ? compress_level : COMPRESS_DEFAULT_LEVEL;
+    if (deflateInit2(&w->z, level, Z_DEFLATED, GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        free(w);
+        return NULL;
+    }
+
+    cookie_io_functions_t functions = { NULL, writer_write, NULL, writer_close };
+    FILE *file = fopencookie(w, "w", functions);
+    if (!file)
+    {
+        deflateEnd(&w->z);
+        free(w);
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, WRITER_BUFFER_SIZE);
+    return file;
+}
+
+// -=- Lesen -=-
+
+int compress_open_message(int fd, off_t offset, size_t length, struct compressed_message *out)
+{
+    char peek[MESSAGE_HEADER_MAX];
+    size_t peek_len = length < sizeof(peek) ? length : sizeof(peek);
+    if (pread(fd, peek, peek_len, offset) != (ssize_t)peek_len) return 0;
+
+    // Kopfzeilen bis zur Leerzeile; die Encoding-Zeile wird beim Senden weggelassen
+    size_t pos = 0;
+    size_t header_len = 0;
+    int compressed = 0;
+    while (pos < peek_len)
+    {
+        char *newline = memchr(peek + pos, '\n', peek_len - pos);
+        if (!newline) return 0;
+        size_t line_len = (size_t)(newline - (peek + pos));
+
+        if (line_len == sizeof(COMPRESS_ENCODING_LINE) - 1 &&
+            memcmp(peek + pos, COMPRESS_ENCODING_LINE, line_len) == 0)
+        {
+            compressed = 1;
+        }
+        else
+        {
+            memcpy(out->header + header_len, peek + pos, line_len + 1);
+            header_len += line_len + 1;
+        }
+        pos += line_len + 1;
+        if (line_len == 0) break;
+    }
+    if (!compressed || pos > length || length - pos < GZIP_TRAILER_LEN) return 0;
+
+    // ISIZE im gzip-Trailer: Länge des Klartexts (modulo 2^32, Texte sind kleiner)
+    unsigned char size_bytes[4];
+    if (pread(fd, size_bytes, sizeof(size_bytes), offset + (off_t)length - 4) != (ssize_t)sizeof(size_bytes)) return 0;
+
+    out->header_len = header_len;
+    out->body_offset = offset + (off_t)pos;
+    out->body_length = length - pos;
+    out->plain_length = (size_t)size_bytes[0] | (size_t)size_bytes[1] << 8 |
+                        (size_t)size_bytes[2] << 16 | (size_t)size_bytes[3] << 24;
+    return 1;
+}
+
+struct inflate_stream
+{
+    int fd;
+    off_t offset;           // Nächstes zu lesendes Byte des gzip-Streams
+    size_t left;            // Noch nicht gelesene komprimierte Bytes
+    int started;
+    int finished;
+    z_stream z;
+    unsigned char in[COMPRESS_BUFFER_SIZE];
+};
+
+void *inflate_stream_open(int fd, const struct compressed_message *message)
+{
+    struct inflate_stream *stream = malloc(sizeof(*stream));
+    if (!stream)
+    {
+        close(fd);
+        return NULL;
+    }
+    stream->fd = fd;
+    stream->offset = message->body_offset;
+    stream->left = message->body_length;
+    stream->started = 0;
+    stream->finished = 0;
+    return stream;
+}
+
+ssize_t inflate_stream_read(void *ctx, void *buf, size_t len)
+{
+    struct inflate_stream *stream = ctx;
+    if (stream->finished) return 0;
+
+    if (!stream->started)
+    {
+        memset(&stream->z, 0, sizeof(stream->z));
+        if (inflateInit2(&stream->z, GZIP_WINDOW_BITS) != Z_OK) return -1;
+        stream->started = 1;
+    }
+
+    stream->z.next_out = buf;
+    stream->z.avail_out = (uInt)len;
+    while (stream->z.avail_out > 0)
+    {
+        if (stream->z.avail_in == 0 && stream->left > 0)
+        {
+            size_t want = stream->left < sizeof(stream->in) ? stream->left : sizeof(stream->in);
+            ssize_t n = pread(stream->fd, stream->in, want, stream->offset);
+            if (n <= 0) return -1;
+            stream->offset += n;
+            stream->left -= (size_t)n;
+            stream->z.next_in = stream->in;
+            stream->z.avail_in = (uInt)n;
+        }
+
+        int rc = inflate(&stream->z, Z_NO_FLUSH);
+        if (rc == Z_STREAM_END)
+        {
+            stream->finished = 1;
+            break;
+        }
+        if (rc != Z_OK && rc != Z_BUF_ERROR) return -1;
+        if (rc == Z_BUF_ERROR && stream->z.avail_in == 0 && stream->left == 0) return -1; // Abgeschnitten
+    }
+    return (ssize_t)(len - stream->z.avail_out);
+}
+
+void inflate_stream_close(void *ctx)
+{
+    struct inflate_stream *stream = ctx;
+    if (!stream) return;
+    if (stream->started) inflateEnd(&stream->z);
+    close(stream->fd);
+    free(stream);
+}
+
+// -=- Komprimierte Verbindung -=-
+
+struct wire_compress
+{
+    int fd;
+    wire_read_fn lower_read;
+    void *read_ctx;
+    wire_write_fn lower_write;
+    void *write_ctx;
+
+    z_stream inflater;
+    unsigned char *in;              // Komprimierte Eingabe
+    size_t in_cap;
+
+    z_stream deflater;
+    unsigned char *out;             // Komprimierte Ausgabe, die die untere Schicht noch nicht genommen hat
+    size_t out_cap;
+    size_t out_len;
+    size_t out_sent;
+    size_t unacked;                 // Eingabe des letzten wire_write(), bestätigt erst nach dem Senden
+
+    uint64_t plain_bytes;
+    uint64_t wire_bytes;
+};
+
+struct wire_compress *wire_compress_new(int fd, wire_read_fn lower_read, void *read_ctx,
+                                        wire_write_fn lower_write, void *write_ctx,
+                                        const void *pending, size_t pending_len)
+{
+    struct wire_compress *w = calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    w->fd = fd;
+    w->lower_read = lower_read;
+    w->read_ctx = read_ctx;
+    w->lower_write = lower_write;
+    w->write_ctx = write_ctx;
+
+    w->in_cap = pending_len > COMPRESS_BUFFER_SIZE ? pending_len : COMPRESS_BUFFER_SIZE;
+    w->out_cap = COMPRESS_BUFFER_SIZE;
+    w->in = malloc(w->in_cap);
+    w->out = malloc(w->out_cap);
+    int inflate_ok = inflateInit2(&w->inflater, WIRE_WINDOW_BITS) == Z_OK;
+    int deflate_ok = deflateInit2(&w->deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED, WIRE_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    if (!w->in || !w->out || !inflate_ok || !deflate_ok)
+    {
+        if (inflate_ok) inflateEnd(&w->inflater);
+        if (deflate_ok) deflateEnd(&w->deflater);
+        free(w->in);
+        free(w->out);
+        free(w);
+        return NULL;
+    }
+
+    if (pending_len > 0) memcpy(w->in, pending, pending_len);
+    w->inflater.next_in = w->in;
+    w->inflater.avail_in = (uInt)pending_len;
+    w->wire_bytes = pending_len;
+    return w;
+}
+
+ssize_t wire_read(void *ctx, void *buf, size_t len)
+{
+    struct wire_compress *w = ctx;
+    if (len == 0) return 0;
+
+    w->inflater.next_out = buf;
+    w->inflater.avail_out = (uInt)len;
+    while (1)
+    {
+        // Erst entpacken, was schon da ist: zlib kann Ausgabe zurückhalten, ohne dass der Socket lesbar wird
+        int rc = inflate(&w->inflater, Z_SYNC_FLUSH);
+        size_t produced = len - w->inflater.avail_out;
+        if (produced > 0)
+        {
+            w->plain_bytes += produced;
+            return (ssize_t)produced;
+        }
+        if (rc == Z_STREAM_END) return 0;   // Gegenseite hat den Stream beendet
+        if ((rc != Z_OK && rc != Z_BUF_ERROR) || w->inflater.avail_in > 0)
+        {
+            errno = EPROTO;
+            return -1;
+        }
+
+        ssize_t n = w->lower_read ? w->lower_read(w->read_ctx, w->in, w->in_cap) : read(w->fd, w->in, w->in_cap);
+        if (n <= 0) return n;               // EOF bzw. Fehler/EAGAIN mit errno der unteren Schicht
+        w->wire_bytes += (uint64_t)n;
+        w->inflater.next_in = w->in;
+        w->inflater.avail_in = (uInt)n;
+    }
+}
+
+// Komprimierte Ausgabe an die untere Schicht; 0 = Rest bleibt (errno gesetzt)
+static int wire_drain(struct wire_compress *w)
+{
+    while (w->out_sent < w->out_len)
+    {
+        const unsigned char *data = w->out + w->out_sent;
+        size_t len = w->out_len - w->out_sent;
+        ssize_t n = w->lower_write ? w->lower_write(w->write_ctx, data, len) : send(w->fd, data, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        w->out_sent += (size_t)n;
+        w->wire_bytes += (uint64_t)n;
+    }
+    w->out_len = w->out_sent = 0;
+    return 1;
+}
+
+ssize_t wire_write(void *ctx, const void *buf, size_t len)
+{
+    struct wire_compress *w = ctx;
+
+    // Wiederholung nach EAGAIN: die Daten sind schon komprimiert, nur noch senden
+    if (w->unacked > 0)
+    {
+        if (!wire_drain(w)) return -1;
+        size_t acked = w->unacked;
+        w->unacked = 0;
+        return (ssize_t)acked;
+    }
+
+    w->deflater.next_in = (Bytef *)buf;
+    w->deflater.avail_in = (uInt)len;
+    do
+    {
+        if (w->out_cap - w->out_len < 64)
+        {
+            unsigned char *grown = realloc(w->out, w->out_cap * 2);
+            if (!grown)
+            {
+                errno = ENOMEM;
+                return -1;
+            }
+            w->out = grown;
+            w->out_cap *= 2;
+        }
+        w->deflater.next_out = w->out + w->out_len;
+        w->deflater.avail_out = (uInt)(w->out_cap - w->out_len);
+        if (deflate(&w->deflater, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+        {
+            errno = EPROTO;
+            return -1;
+        }
+        w->out_len = w->out_cap - w->deflater.avail_out;
+    } while (w->deflater.avail_out == 0);
+    w->plain_bytes += len;
+
+    if (wire_drain(w)) return (ssize_t)len;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) w->unacked = len;
+    return -1;
+}
+
+void wire_compress_stats(const struct wire_compress *w, uint64_t *plain, uint64_t *compressed)
+{
+    *plain = w->plain_bytes;
+    *compressed = w->wire_bytes;
+}
+
+void wire_compress_free(struct wire_compress *w)
+{
+    if (!w) return;
+    inflateEnd(&w->inflater);
+    deflateEnd(&w->deflater);
+    free(w->in);
+    free(w->out);
+    free(w);
+}
@@ -0,0 +1,338 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Headers/common.h"
+#include "Headers/mailbox.h"
+#include "Headers/delivery.h"
+#include "Headers/storage.h"
+#include "Headers/compress.h"
+
+#define GROUP_WAIT_SECONDS 2 // Stirbt der Leader, synct ein Wartender nach dieser Zeit selbst
+
+// Geteilter Zustand für Group Commit. Liegt in MAP_SHARED Speicher, damit
+// auch die geforkten Kindprozesse sich einen syncfs() teilen können.
+struct group_commit
+{
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    uint64_t next_ticket;
+    uint64_t synced_ticket;     // Alle Tickets <= diesem Wert sind auf der Platte
+    int syncing;
+};
+
+static enum delivery_sync_mode sync_mode = SYNC_FSYNC;
+static struct group_commit *group_state = NULL;
+
+int delivery_set_sync_mode(const char *name)
+{
+    if (strcmp(name, "none") == 0) sync_mode = SYNC_NONE;
+    else if (strcmp(name, "fsync") == 0) sync_mode = SYNC_FSYNC;
+    else if (strcmp(name, "group") == 0) sync_mode = SYNC_GROUP;
+    else return 0;
+
+    if (sync_mode == SYNC_GROUP && !group_state)
+    {
+        group_state = mmap(NULL, sizeof(*group_state), PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (group_state == MAP_FAILED)
+        {
+            group_state = NULL;
+            return 0;
+        }
+        memset(group_state, 0, sizeof(*group_state));
+
+        pthread_mutexattr_t mutex_attr;
+        pthread_mutexattr_init(&mutex_attr);
+        pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&group_state->lock, &mutex_attr);
+        pthread_mutexattr_destroy(&mutex_attr);
+
+        pthread_condattr_t cond_attr;
+        pthread_condattr_init(&cond_attr);
+        pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+        pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&group_state->done, &cond_attr);
+        pthread_condattr_destroy(&cond_attr);
+    }
+    return 1;
+}
+
+enum delivery_sync_mode delivery_sync_mode(void)
+{
+    return sync_mode;
+}
+
+static int sync_filesystem(const char *mail_dir)
+{
+    int fd = open(mail_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    int ok = syncfs(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+static int group_lock(void)
+{
+    int rc = pthread_mutex_lock(&group_state->lock);
+    if (rc == EOWNERDEAD)
+    {
+        // Vorheriger Besitzer ist abgestürzt: Zustand ist trotzdem konsistent
+        group_state->syncing = 0;
+        pthread_mutex_consistent(&group_state->lock);
+        rc = 0;
+    }
+    return rc == 0;
+}
+
+int delivery_barrier(const char *mail_dir)
+{
+    if (sync_mode != SYNC_GROUP) return 1;
+    if (!group_lock()) return sync_filesystem(mail_dir);
+
+    // Ticket erst nach dem Schreiben ziehen: jeder syncfs(), der danach
+    // startet, deckt die eigenen Daten mit ab
+    uint64_t ticket = ++group_state->next_ticket;
+    int ok = 1;
+
+    while (group_state->synced_ticket < ticket)
+    {
+        if (!group_state->syncing)
+        {
+            // Leader: ein syncfs() für alle bis hierhin gezogenen Tickets
+            uint64_t target = group_state->next_ticket;
+            group_state->syncing = 1;
+            pthread_mutex_unlock(&group_state->lock);
+
+            ok = sync_filesystem(mail_dir);
+
+            group_lock();
+            group_state->syncing = 0;
+            if (ok && target > group_state->synced_ticket) group_state->synced_ticket = target;
+            pthread_cond_broadcast(&group_state->done);
+            if (!ok) break;
+            continue;
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += GROUP_WAIT_SECONDS;
+        int rc = pthread_cond_timedwait(&group_state->done, &group_state->lock, &deadline);
+        if (rc == EOWNERDEAD)
+        {
+            group_state->syncing = 0;
+            pthread_mutex_consistent(&group_state->lock);
+        }
+        else if (rc == ETIMEDOUT)
+        {
+            group_state->syncing = 0; // Leader hängt oder ist weg
+        }
+    }
+
+    pthread_mutex_unlock(&group_state->lock);
+    return ok;
+}
+
+// -=- Zustellung einer Nachricht -=-
+
+// Legt <user>/tmp/<id>.msg an: neu (source == NULL) oder als Hardlink auf source
+static int delivery_create(struct mail_delivery *d, const char *mail_dir, const char *user, const struct mail_delivery *source)
+{
+    memset(d, 0, sizeof(*d));
+    d->mail_dir = mail_dir;
+    d->source = source;
+    snprintf(d->user, sizeof(d->user), "%s", user);
+
+    char tmp_dir[256];
+    snprintf(tmp_dir, sizeof(tmp_dir), "%s/%s/%s", mail_dir, user, DELIVERY_TMP_DIR);
+    if (mkdir(tmp_dir, 0700) < 0 && errno != EEXIST) return 0;
+
+    // Index vor der ersten Nachricht anlegen: ein Neuaufbau während paralleler
+    // Zustellungen würde deren Nachrichten sonst doppelt erfassen
+    if (!mailbox_index_prepare(mail_dir, user)) return 0;
+
+    for (int attempt = 0; attempt < MAILBOX_CREATE_RETRIES; attempt++)
+    {
+        uint32_t id = mailbox_next_id(mail_dir, user);
+        if (id == 0) return 0;
+
+        // Zurückgesetzter Zähler: vorhandene Nachrichten überspringen
+        snprintf(d->final_path, sizeof(d->final_path), "%s/%s/%u.msg", mail_dir, user, id);
+        if (access(d->final_path, F_OK) == 0) continue;
+
+        snprintf(d->tmp_path, sizeof(d->tmp_path), "%s/%s/%s/%u.msg", mail_dir, user, DELIVERY_TMP_DIR, id);
+        if (source)
+        {
+            if (link(source->tmp_path, d->tmp_path) < 0)
+            {
+                d->tmp_path[0] = '\0';
+                if (errno == EEXIST) continue;
+                return 0;
+            }
+            d->record.id = id;
+            return 1;
+        }
+
+        int fd = open(d->tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            d->tmp_path[0] = '\0';
+            if (errno == EEXIST) continue;
+            return 0;
+        }
+
+        d->file = fdopen(fd, "w");
+        if (!d->file)
+        {
+            close(fd);
+            unlink(d->tmp_path);
+            d->tmp_path[0] = '\0';
+            return 0;
+        }
+        d->record.id = id;
+        return 1;
+    }
+    return 0;
+}
+
+int delivery_begin(struct mail_delivery *d, const char *mail_dir, const char *user)
+{
+    return delivery_create(d, mail_dir, user, NULL);
+}
+
+int delivery_begin_shared(struct mail_delivery *d, const char *mail_dir, const char *user, const struct mail_delivery *source)
+{
+    return delivery_create(d, mail_dir, user, source);
+}
+
+int delivery_write_header(struct mail_delivery *d, const char *sender, const char *receivers, const char *subject)
+{
+    fprintf(d->file, "Sender: %s\n", sender);
+    fprintf(d->file, "Receiver: %s\n", receivers);
+    fprintf(d->file, "Subject: %s\n", subject);
+    if (!compress_enabled())
+    {
+        return fprintf(d->file, "\n") > 0;
+    }
+
+    // Kopfzeilen bleiben lesbar (Index-Neuaufbau), nur der Text wird komprimiert
+    fprintf(d->file, "%s\n\n", COMPRESS_ENCODING_LINE);
+    FILE *compressed = compress_writer(d->file);
+    if (!compressed) return 0;
+    d->raw = d->file;
+    d->file = compressed;
+    d->record.flags |= MI_FLAG_COMPRESSED;
+    return 1;
+}
+
+void delivery_abort(struct mail_delivery *d)
+{
+    if (d->file) fclose(d->file);
+    d->file = NULL;
+    if (d->raw) fclose(d->raw);
+    d->raw = NULL;
+    if (d->tmp_path[0]) unlink(d->tmp_path);
+    d->tmp_path[0] = '\0';
+}
+
+int delivery_close(struct mail_delivery *d)
+{
+    // Geteilter Inhalt: wurde mit der Quelle geschrieben und gesynct
+    if (d->source)
+    {
+        d->record.size = d->source->record.size;
+        d->record.flags |= d->source->record.flags & MI_FLAG_COMPRESSED;
+        return d->source->file == NULL && d->tmp_path[0] != '\0';
+    }
+
+    int ok = 1;
+    if (d->raw)
+    {
+        // gzip-Stream abschließen, danach weiter mit der eigentlichen Datei
+        ok = fclose(d->file) == 0;
+        d->file = d->raw;
+        d->raw = NULL;
+    }
+
+    d->record.size = (uint64_t)ftell(d->file);
+
+    if (ok) ok = fflush(d->file) == 0;
+    if (ok && sync_mode == SYNC_FSYNC) ok = fsync(fileno(d->file)) == 0;
+    if (fclose(d->file) != 0) ok = 0;
+    d->file = NULL;
+
+    if (!ok) delivery_abort(d);
+    return ok;
+}
+
+int delivery_publish(struct mail_delivery *d)
+{
+    // Das Backend übernimmt die Datei aus tmp/ (link() bzw. Append ins Segment)
+    if (!storage()->publish(d))
+    {
+        delivery_abort(d);
+        return 0;
+    }
+
+    // Ein Absturz vor diesem Schritt wird von delivery_recover() beim Start erkannt
+    return mailbox_index_append(d->mail_dir, d->user, &d->record);
+}
+
+int delivery_commit(struct mail_delivery *d)
+{
+    if (!delivery_close(d)) return 0;
+    if (!delivery_barrier(d->mail_dir))     // Inhalt ist auf der Platte ...
+    {
+        delivery_abort(d);
+        return 0;
+    }
+    if (!delivery_publish(d)) return 0;
+    return delivery_barrier(d->mail_dir);   // ... und der Verzeichniseintrag auch
+}
+
+// -=- Wiederherstellung nach einem Absturz -=-
+
+static void clean_tmp_dir(const char *tmp_dir)
+{
+    DIR *folder = opendir(tmp_dir);
+    if (!folder) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(folder)) != NULL)
+    {
+        if (entry->d_name[0] == '.') continue;
+        char file_path[512];
+        snprintf(file_path, sizeof(file_path), "%s/%s", tmp_dir, entry->d_name);
+        unlink(file_path); // Abgebrochene Zustellung, nie bestätigt
+    }
+    closedir(folder);
+}
+
+void delivery_recover(const char *mail_dir)
+{
+    DIR *spool = opendir(mail_dir);
+    if (!spool) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(spool)) != NULL)
+    {
+        if (entry->d_name[0] == '.') continue;
+
+        char tmp_dir[512];
+        snprintf(tmp_dir, sizeof(tmp_dir), "%s/%s/%s", mail_dir, entry->d_name, DELIVERY_TMP_DIR);
+        clean_tmp_dir(tmp_dir);
+        storage()->recover(mail_dir, entry->d_name);
+        mailbox_index_verify(mail_dir, entry->d_name);
+    }
+    closedir(spool);
+}
@@ -0,0 +1,414 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <crypt.h>
+#include <sys/random.h>
+#include <sys/eventfd.h>
+#include <openssl/crypto.h>
+#include "Headers/common.h"
+#include "Headers/auth.h"
+#include "Headers/htpasswd.h"
+#include "Headers/log.h"
+
+struct htpasswd_entry
+{
+    char user[USER_LEN + 1];
+    char hash[HTPASSWD_HASH_LEN];
+    int verified;                               // digest gilt für das zuletzt bestätigte Passwort
+    unsigned char digest[AUTH_DIGEST_LEN];
+};
+
+struct htpasswd_table
+{
+    struct htpasswd_entry *entries;             // Nach user sortiert
+    size_t count;
+};
+
+static const char *file_path = HTPASSWD_DEFAULT_FILE;
+static struct htpasswd_table table = { NULL, 0 };
+static unsigned char digest_salt[HTPASSWD_SALT_LEN];
+static struct crypt_data crypt_state;           // Groß: nicht auf den Stack; nur authenticate()
+
+int htpasswd_set_file(const char *path)
+{
+    if (!path || !*path) return 0;
+    file_path = path;
+    return 1;
+}
+
+// -=- Datei laden -=-
+
+static int valid_user(const char *user, size_t len)
+{
+    if (len == 0 || len > USER_LEN) return 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!((user[i] >= 'a' && user[i] <= 'z') || (user[i] >= '0' && user[i] <= '9'))) return 0;
+    }
+    return 1;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    return strcmp(((const struct htpasswd_entry *)a)->user, ((const struct htpasswd_entry *)b)->user);
+}
+
+static int table_load(const char *path, struct htpasswd_table *out)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        log_error("htpasswd: %s nicht lesbar", path);
+        return 0;
+    }
+
+    struct htpasswd_table loaded = { NULL, 0 };
+    size_t capacity = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_number = 0;
+    int ok = 1;
+
+    while (getline(&line, &line_size, f) >= 0)
+    {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+
+        char *colon = strchr(line, ':');
+        const char *hash = colon ? colon + 1 : "";
+        if (!colon || !valid_user(line, (size_t)(colon - line)) || strlen(hash) >= HTPASSWD_HASH_LEN ||
+            crypt_checksalt(hash) != CRYPT_SALT_OK)
+        {
+            // Unbekannte oder schwache Verfahren (DES, MD5) nicht stillschweigend akzeptieren
+            log_warn("htpasswd: %s:%d ignoriert (ungültiger Benutzer oder Hash)", path, line_number);
+            continue;
+        }
+
+        if (loaded.count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            struct htpasswd_entry *grown = realloc(loaded.entries, capacity * sizeof(*grown));
+            if (!grown)
+            {
+                ok = 0;
+                break;
+            }
+            loaded.entries = grown;
+        }
+
+        struct htpasswd_entry *entry = &loaded.entries[loaded.count++];
+        memset(entry, 0, sizeof(*entry));
+        memcpy(entry->user, line, (size_t)(colon - line));
+        strcpy(entry->hash, hash);
+    }
+    free(line);
+    fclose(f);
+
+    if (!ok)
+    {
+        free(loaded.entries);
+        return 0;
+    }
+
+    qsort(loaded.entries, loaded.count, sizeof(*loaded.entries), compare_entries);
+    for (size_t i = 1; i < loaded.count; i++)
+    {
+        if (strcmp(loaded.entries[i - 1].user, loaded.entries[i].user) == 0)
+        {
+            log_error("htpasswd: %s mehrfach in %s", loaded.entries[i].user, path);
+            free(loaded.entries);
+            return 0;
+        }
+    }
+
+    *out = loaded;
+    return 1;
+}
+
+// -=- Prüfen -=-
+
+static int hash_matches(const char *hash, const char *password, struct crypt_data *state)
+{
+    const char *computed = crypt_r(password, hash, state);
+    if (!computed || computed[0] == '*') return 0; // crypt_r meldet Fehler mit "*0"/"*1"
+
+    size_t len = strlen(hash);
+    return strlen(computed) == len && CRYPTO_memcmp(computed, hash, len) == 0;
+}
+
+static int request_valid(const char *username, const char *password)
+{
+    return username && password && *username && *password && strlen(password) < AUTH_PASSWORD_LEN;
+}
+
+static struct htpasswd_entry *table_find(const char *username)
+{
+    struct htpasswd_entry key;
+    snprintf(key.user, sizeof(key.user), "%s", username);
+    struct htpasswd_entry *entry = bsearch(&key, table.entries, table.count, sizeof(key), compare_entries);
+    return entry && strcmp(entry->user, username) == 0 ? entry : NULL;
+}
+
+// Schon einmal mit diesem Passwort bestätigt? Kostet nur einen SHA-256
+static int digest_confirms(const struct htpasswd_entry *entry, const char *password)
+{
+    unsigned char digest[AUTH_DIGEST_LEN];
+    return entry->verified && auth_password_digest(digest_salt, sizeof(digest_salt), password, digest) &&
+           CRYPTO_memcmp(digest, entry->digest, sizeof(digest)) == 0;
+}
+
+static void digest_remember(struct htpasswd_entry *entry, const char *password)
+{
+    if (!auth_password_digest(digest_salt, sizeof(digest_salt), password, entry->digest)) return;
+    entry->verified = 1;
+}
+
+static int htpasswd_check(const char *username, const char *password)
+{
+    if (!request_valid(username, password)) return 0;
+
+    struct htpasswd_entry *entry = table_find(username);
+    if (!entry)
+    {
+        // Gleicher Aufwand wie bei existierenden Benutzern: keine Rückschlüsse über die Laufzeit
+        if (table.count > 0) hash_matches(table.entries[0].hash, password, &crypt_state);
+        return 0;
+    }
+
+    if (digest_confirms(entry, password)) return 1;
+    if (!hash_matches(entry->hash, password, &crypt_state)) return 0;
+    digest_remember(entry, password);
+    return 1;
+}
+
+// -=- crypt() in eigenen Threads (epoll/prefork) -=-
+
+struct htpasswd_job
+{
+    struct htpasswd_job *next;
+    char user[USER_LEN + 1];
+    char hash[HTPASSWD_HASH_LEN];       // Kopie: SIGHUP kann die Tabelle inzwischen ersetzen
+    char password[AUTH_PASSWORD_LEN];
+    int known;                          // 0 = unbekannter Benutzer, Hash nur für gleiche Laufzeit
+    int event_fd;                       // -1 = Reactor fragt zeitgesteuert ab
+    int done;
+    int matches;
+    int abandoned;                      // Session ist weg: der Thread gibt den Job frei
+};
+
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct htpasswd_job *head;
+    struct htpasswd_job *tail;
+    pid_t owner;                        // Prozess, in dem die Threads laufen
+} workers = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0 };
+
+static void job_free(struct htpasswd_job *job)
+{
+    if (job->event_fd >= 0) close(job->event_fd);
+    explicit_bzero(job->password, sizeof(job->password));
+    free(job);
+}
+
+static void *crypt_worker(void *arg)
+{
+    struct crypt_data *state = arg;
+
+    pthread_mutex_lock(&workers.lock);
+    while (1)
+    {
+        while (!workers.head) pthread_cond_wait(&workers.wake, &workers.lock);
+        struct htpasswd_job *job = workers.head;
+        workers.head = job->next;
+        if (!workers.head) workers.tail = NULL;
+        int abandoned = job->abandoned;
+        pthread_mutex_unlock(&workers.lock);
+
+        int matches = !abandoned && hash_matches(job->hash, job->password, state);
+
+        pthread_mutex_lock(&workers.lock);
+        job->matches = matches && job->known;
+        job->done = 1;
+        if (job->abandoned)
+        {
+            job_free(job);
+        }
+        else if (job->event_fd >= 0)
+        {
+            uint64_t one = 1;
+            if (write(job->event_fd, &one, sizeof(one)) < 0) log_warn("htpasswd: eventfd: %s", strerror(errno));
+        }
+    }
+    return NULL;
+}
+
+// Aufrufer hält workers.lock. Threads überleben fork() nicht: pro Prozess eigene starten
+static int workers_start(void)
+{
+    if (workers.owner == getpid()) return 1;
+    workers.head = workers.tail = NULL; // Jobs des Elternprozesses gehören nicht zu uns
+
+    int started = 0;
+    for (int i = 0; i < HTPASSWD_WORKERS; i++)
+    {
+        struct crypt_data *state = calloc(1, sizeof(*state));
+        if (!state) break;
+
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int rc = pthread_create(&thread, &attr, crypt_worker, state);
+        pthread_attr_destroy(&attr);
+        if (rc != 0)
+        {
+            free(state);
+            break;
+        }
+        started++;
+    }
+    if (started == 0)
+    {
+        log_error("htpasswd: keine crypt()-Threads gestartet, Logins werden direkt geprüft");
+        return 0;
+    }
+    workers.owner = getpid();
+    return 1;
+}
+
+// -=- Anbieter -=-
+
+static int htpasswd_init(void)
+{
+    if (getrandom(digest_salt, sizeof(digest_salt), 0) != (ssize_t)sizeof(digest_salt)) return 0;
+    if (!table_load(file_path, &table)) return 0;
+
+    log_info("htpasswd: %zu Benutzer aus %s geladen", table.count, file_path);
+    return 1;
+}
+
+static int htpasswd_reload(void)
+{
+    struct htpasswd_table loaded;
+    if (!table_load(file_path, &loaded))
+    {
+        log_error("htpasswd: Neu laden fehlgeschlagen, %zu Benutzer bleiben aktiv", table.count);
+        return 0;
+    }
+
+    free(table.entries);
+    table = loaded;
+    log_info("htpasswd: %zu Benutzer aus %s neu geladen", table.count, file_path);
+    return 1;
+}
+
+static int htpasswd_authenticate(const char *username, const char *password)
+{
+    return htpasswd_check(username, password);
+}
+
+static enum auth_status htpasswd_start(struct auth_request *req, const char *username, const char *password)
+{
+    memset(req, 0, sizeof(*req));
+    if (!request_valid(username, password)) return AUTH_FAILED;
+
+    struct htpasswd_entry *entry = table_find(username);
+    if (entry && digest_confirms(entry, password)) return AUTH_OK;
+    if (!entry && table.count == 0) return AUTH_FAILED;
+
+    struct htpasswd_job *job = calloc(1, sizeof(*job));
+    if (!job) return AUTH_FAILED;
+    snprintf(job->user, sizeof(job->user), "%s", username);
+    strcpy(job->hash, entry ? entry->hash : table.entries[0].hash);
+    strcpy(job->password, password);
+    job->known = entry != NULL;
+    job->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    pthread_mutex_lock(&workers.lock);
+    int queued = workers_start();
+    if (queued)
+    {
+        if (workers.tail) workers.tail->next = job;
+        else workers.head = job;
+        workers.tail = job;
+        pthread_cond_signal(&workers.wake);
+    }
+    pthread_mutex_unlock(&workers.lock);
+
+    if (!queued)
+    {
+        job_free(job);
+        return htpasswd_check(username, password) ? AUTH_OK : AUTH_FAILED;
+    }
+    req->job = job;
+    return AUTH_PENDING;
+}
+
+static enum auth_status htpasswd_poll(struct auth_request *req)
+{
+    struct htpasswd_job *job = req->job;
+    if (!job) return AUTH_FAILED;
+
+    pthread_mutex_lock(&workers.lock);
+    int done = job->done;
+    pthread_mutex_unlock(&workers.lock);
+    if (!done) return AUTH_PENDING;
+
+    // Nach SIGHUP zählt nur ein Hash, der noch in der Tabelle steht
+    int matches = job->matches;
+    struct htpasswd_entry *entry = matches ? table_find(job->user) : NULL;
+    if (entry && strcmp(entry->hash, job->hash) == 0) digest_remember(entry, job->password);
+    else matches = 0;
+
+    req->job = NULL;
+    job_free(job);
+    return matches ? AUTH_OK : AUTH_FAILED;
+}
+
+static int htpasswd_fd(const struct auth_request *req)
+{
+    return req->job ? req->job->event_fd : -1;
+}
+
+static long htpasswd_remaining_ms(const struct auth_request *req)
+{
+    (void)req;
+    return HTPASSWD_POLL_MS;
+}
+
+static void htpasswd_cancel(struct auth_request *req)
+{
+    struct htpasswd_job *job = req->job;
+    if (!job) return;
+    req->job = NULL;
+
+    // Läuft der Hash noch, gibt der Thread den Job danach frei
+    pthread_mutex_lock(&workers.lock);
+    int done = job->done;
+    if (!done) job->abandoned = 1;
+    pthread_mutex_unlock(&workers.lock);
+    if (done) job_free(job);
+}
+
+const struct auth_provider htpasswd_provider =
+{
+    .name = "htpasswd",
+    .init = htpasswd_init,
+    .warm = NULL,
+    .authenticate = htpasswd_authenticate,
+    .start = htpasswd_start,
+    .poll = htpasswd_poll,
+    .fd = htpasswd_fd,
+    .remaining_ms = htpasswd_remaining_ms,
+    .cancel = htpasswd_cancel,
+    .reload = htpasswd_reload,
+};
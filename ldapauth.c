@@ -0,0 +1,533 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <openssl/crypto.h>
+#include "Headers/common.h"
+#include "Headers/ldapauth.h"
+#include "Headers/log.h"
+#define LDAP_DEPRECATED 1
+#include <ldap.h>
+
+static const char *ldap_uri = LDAP_DEFAULT_URI;
+static const char *ldap_dn_template = LDAP_DEFAULT_DN_TEMPLATE;
+static int ldap_starttls = 1;
+static int cache_ttl = 0;
+static int auth_timeout = LDAP_AUTH_TIMEOUT;
+static time_t ldap_down_until = 0;     // Nach einem Verbindungsfehler kurz nicht neu versuchen
+
+// -=- Konfiguration -=-
+
+int ldap_auth_set_uri(const char *uri)
+{
+    if (!uri || !*uri) return 0;
+    ldap_uri = uri;
+    return 1;
+}
+
+int ldap_auth_set_dn_template(const char *dn_template)
+{
+    // Genau ein %s und sonst kein %, damit die Vorlage sicher ersetzt werden kann
+    const char *placeholder = strstr(dn_template, "%s");
+    if (!placeholder || strchr(placeholder + 2, '%')) return 0;
+    if (strchr(dn_template, '%') != placeholder) return 0;
+    ldap_dn_template = dn_template;
+    return 1;
+}
+
+void ldap_auth_set_starttls(int enabled)
+{
+    ldap_starttls = enabled;
+}
+
+int ldap_auth_set_cache_ttl(const char *seconds)
+{
+    char *end;
+    long ttl = strtol(seconds, &end, 10);
+    if (*end || ttl < 0 || ttl > LDAP_CACHE_MAX_TTL) return 0;
+    cache_ttl = (int)ttl;
+    return 1;
+}
+
+int ldap_auth_set_timeout(const char *seconds)
+{
+    char *end;
+    long timeout = strtol(seconds, &end, 10);
+    if (*end || timeout < 1 || timeout > LDAP_CACHE_MAX_TTL) return 0;
+    auth_timeout = (int)timeout;
+    return 1;
+}
+
+static void build_user_dn(char *dn, size_t size, const char *username)
+{
+    const char *placeholder = strstr(ldap_dn_template, "%s");
+    snprintf(dn, size, "%.*s%s%s", (int)(placeholder - ldap_dn_template), ldap_dn_template,
+             username, placeholder + 2);
+}
+
+// -=- Cache erfolgreicher Logins (Shared Memory, gilt auch für geforkte Kinder) -=-
+
+struct cache_entry
+{
+    char user[USER_LEN + 1];
+    unsigned char salt[LDAP_CACHE_SALT_LEN];
+    unsigned char hash[AUTH_DIGEST_LEN];
+    time_t expires;
+};
+
+struct auth_cache
+{
+    pthread_mutex_t lock;
+    struct cache_entry entries[LDAP_CACHE_SLOTS];
+};
+
+static struct auth_cache *cache = NULL;
+
+static int cache_lock(void)
+{
+    int rc = pthread_mutex_lock(&cache->lock);
+    if (rc == EOWNERDEAD)
+    {
+        pthread_mutex_consistent(&cache->lock); // Einträge werden nur komplett ersetzt
+        rc = 0;
+    }
+    return rc == 0;
+}
+
+static time_t monotonic_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+static struct cache_entry *cache_slot(const char *username)
+{
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (const char *c = username; *c; c++) hash = (hash ^ (unsigned char)*c) * 16777619u;
+    return &cache->entries[hash % LDAP_CACHE_SLOTS];
+}
+
+static int cache_lookup(const char *username, const char *password)
+{
+    if (!cache || !cache_lock()) return 0;
+    struct cache_entry entry = *cache_slot(username);
+    pthread_mutex_unlock(&cache->lock);
+
+    if (strcmp(entry.user, username) != 0 || entry.expires <= monotonic_seconds()) return 0;
+
+    // Hash außerhalb des Locks berechnen
+    unsigned char hash[AUTH_DIGEST_LEN];
+    return auth_password_digest(entry.salt, sizeof(entry.salt), password, hash) &&
+           CRYPTO_memcmp(hash, entry.hash, sizeof(hash)) == 0;
+}
+
+static void cache_store(const char *username, const char *password)
+{
+    if (!cache) return;
+
+    struct cache_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    snprintf(entry.user, sizeof(entry.user), "%s", username);
+    if (getrandom(entry.salt, sizeof(entry.salt), 0) != (ssize_t)sizeof(entry.salt)) return;
+    if (!auth_password_digest(entry.salt, sizeof(entry.salt), password, entry.hash)) return;
+    entry.expires = monotonic_seconds() + cache_ttl;
+
+    if (!cache_lock()) return;
+    *cache_slot(username) = entry;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+static int ldap_auth_init(void)
+{
+    if (cache_ttl == 0 || cache) return 1;
+
+    cache = mmap(NULL, sizeof(*cache), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (cache == MAP_FAILED)
+    {
+        cache = NULL;
+        return 0;
+    }
+    memset(cache, 0, sizeof(*cache));
+
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&cache->lock, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+    return 1;
+}
+
+// -=- Verbindungs-Pool (pro Prozess) -=-
+
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wake;            // Für den Verbindungs-Thread: requests > 0
+    pid_t owner;                    // Nach fork() geerbte Verbindungen nicht weiterverwenden
+    LDAP *idle[LDAP_POOL_SIZE];
+    int idle_count;
+    int requests;                   // Noch aufzubauende Verbindungen
+    pid_t connector;                // Prozess, in dem der Verbindungs-Thread läuft
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, { NULL }, 0, 0, 0 };
+
+// Aufrufer hält pool.lock
+static void pool_adopt(void)
+{
+    if (pool.owner != getpid())
+    {
+        // Geerbte Verbindungen gehören dem Elternprozess: vergessen, nicht schließen
+        pool.owner = getpid();
+        pool.idle_count = 0;
+        pool.requests = 0;
+    }
+}
+
+static int ldap_is_down(void)
+{
+    pthread_mutex_lock(&pool.lock);
+    int down = monotonic_seconds() < ldap_down_until;
+    pthread_mutex_unlock(&pool.lock);
+    return down;
+}
+
+static void ldap_mark_down(void)
+{
+    pthread_mutex_lock(&pool.lock);
+    ldap_down_until = monotonic_seconds() + LDAP_RETRY_BACKOFF;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+// Blockiert bis zu LDAP_NETWORK_TIMEOUT (Verbindung + StartTLS): im epoll-Modus
+// nur im Verbindungs-Thread, sonst im Kindprozess des Clients
+static LDAP *ldap_connect(void)
+{
+    // Einen unerreichbaren Server nicht bei jedem Login erneut abwarten
+    if (ldap_is_down()) return NULL;
+
+    LDAP *ld = NULL;
+    int rc = ldap_initialize(&ld, ldap_uri);
+    if (rc != LDAP_SUCCESS || !ld)
+    {
+        log_error("LDAP initialize: %s", ldap_err2string(rc));
+        return NULL;
+    }
+
+    int version = LDAP_VERSION3;
+    struct timeval timeout = { LDAP_NETWORK_TIMEOUT, 0 };
+    ldap_set_option(ld, LDAP_OPT_PROTOCOL_VERSION, &version);
+    ldap_set_option(ld, LDAP_OPT_REFERRALS, LDAP_OPT_OFF);
+    ldap_set_option(ld, LDAP_OPT_NETWORK_TIMEOUT, &timeout);
+
+    // TLS nur einmal pro Verbindung aushandeln, nicht pro Login
+    if (ldap_starttls)
+    {
+        rc = ldap_start_tls_s(ld, NULL, NULL);
+        if (rc != LDAP_SUCCESS)
+        {
+            log_error("LDAP start_tls: %s", ldap_err2string(rc));
+            ldap_unbind_ext_s(ld, NULL, NULL);
+            if (rc < 0) ldap_mark_down();
+            return NULL;
+        }
+    }
+    return ld;
+}
+
+static LDAP *pool_checkout(void)
+{
+    LDAP *ld = NULL;
+    pthread_mutex_lock(&pool.lock);
+    pool_adopt();
+    if (pool.idle_count > 0) ld = pool.idle[--pool.idle_count];
+    pthread_mutex_unlock(&pool.lock);
+    return ld;
+}
+
+static void pool_checkin(LDAP *ld)
+{
+    pthread_mutex_lock(&pool.lock);
+    pool_adopt();
+    if (pool.idle_count < LDAP_POOL_SIZE)
+    {
+        pool.idle[pool.idle_count++] = ld;
+        ld = NULL;
+    }
+    pthread_mutex_unlock(&pool.lock);
+    if (ld) ldap_unbind_ext_s(ld, NULL, NULL);
+}
+
+// Baut angeforderte Verbindungen auf und legt sie in den Pool
+static void *pool_connector(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&pool.lock);
+    while (1)
+    {
+        while (pool.requests == 0) pthread_cond_wait(&pool.wake, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+
+        LDAP *ld = ldap_connect();
+        if (ld) pool_checkin(ld);
+        else if (!ldap_is_down()) ldap_mark_down(); // Auch bei Fehlern ohne Netzwerkbezug (z.B. Zertifikat)
+
+        pthread_mutex_lock(&pool.lock);
+        if (ld && pool.requests > 0) pool.requests--;
+        if (!ld) pool.requests = 0; // Wartende Logins sehen ldap_is_down() und scheitern sofort
+    }
+    return NULL;
+}
+
+// count Verbindungen im Hintergrund anfordern; 0 = Server gilt als nicht erreichbar
+static int pool_request(int count)
+{
+    pthread_mutex_lock(&pool.lock);
+    pool_adopt();
+    if (monotonic_seconds() < ldap_down_until)
+    {
+        pthread_mutex_unlock(&pool.lock);
+        return 0;
+    }
+
+    // Threads überleben fork() nicht: pro Prozess einen eigenen starten
+    if (pool.connector != getpid())
+    {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int rc = pthread_create(&thread, &attr, pool_connector, NULL);
+        pthread_attr_destroy(&attr);
+        if (rc != 0)
+        {
+            pthread_mutex_unlock(&pool.lock);
+            log_error("LDAP Pool: Thread nicht gestartet: %s", strerror(rc));
+            return 0;
+        }
+        pool.connector = getpid();
+    }
+
+    pool.requests += count;
+    if (pool.requests > LDAP_POOL_SIZE) pool.requests = LDAP_POOL_SIZE;
+    pthread_cond_signal(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+    return 1;
+}
+
+static void ldap_pool_warm(void)
+{
+    if (pool_request(LDAP_POOL_SIZE)) log_info("LDAP Pool: %d Verbindungen zu %s werden aufgebaut", LDAP_POOL_SIZE, ldap_uri);
+}
+
+static long monotonic_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
+// Bind auf req->ld asynchron absenden; 0 = Verbindung unbrauchbar (wurde freigegeben)
+static int ldap_bind_on(struct auth_request *req)
+{
+    // Simple SASL Bind (wie im Unterricht)
+    struct berval cred;
+    cred.bv_val = req->password;
+    cred.bv_len = strlen(req->password);
+    int rc = ldap_sasl_bind(req->ld, req->user_dn, LDAP_SASL_SIMPLE, &cred, NULL, NULL, &req->msgid);
+    if (rc == LDAP_SUCCESS) return 1;
+
+    ldap_unbind_ext_s(req->ld, NULL, NULL);
+    req->ld = NULL;
+    if (!req->pooled && rc < 0) ldap_mark_down();
+    return 0;
+}
+
+// Bind absenden; die Antwort holt ldap_auth_wait() ab. 0 = Fehler. Ohne blocking
+// und ohne Verbindung im Pool: req->connecting, ldap_auth_poll() sendet später
+static int ldap_send_bind(struct auth_request *req)
+{
+    // Verbindung aus dem Pool wurde evtl. inzwischen getrennt: dann frisch versuchen
+    req->ld = pool_checkout();
+    req->pooled = req->ld != NULL;
+    if (req->ld && ldap_bind_on(req)) return 1;
+
+    req->pooled = 0;
+    if (!req->blocking)
+    {
+        req->connecting = pool_request(1);
+        return req->connecting;
+    }
+    req->ld = ldap_connect();
+    return req->ld && ldap_bind_on(req);
+}
+
+static enum auth_status ldap_auth_finish(struct auth_request *req, int rc)
+{
+    log_debug("LDAP bind result: %s", ldap_err2string(rc));
+
+    if (req->ld)
+    {
+        if (rc >= 0) pool_checkin(req->ld); // Wird beim nächsten Login einfach neu gebunden
+        else ldap_unbind_ext_s(req->ld, NULL, NULL);
+        req->ld = NULL;
+    }
+    req->connecting = 0;
+    if (rc == LDAP_SUCCESS && cache_ttl > 0) cache_store(req->user, req->password);
+
+    explicit_bzero(req->password, sizeof(req->password));
+    return rc == LDAP_SUCCESS ? AUTH_OK : AUTH_FAILED;
+}
+
+// Wartet höchstens timeout auf die Bind-Antwort (NULL-Timeout ist nicht erlaubt)
+static enum auth_status ldap_auth_wait(struct auth_request *req, struct timeval *timeout)
+{
+    if (req->connecting) return AUTH_PENDING;
+    if (!req->ld) return AUTH_FAILED;
+
+    LDAPMessage *result = NULL;
+    int type = ldap_result(req->ld, req->msgid, LDAP_MSG_ALL, timeout, &result);
+    if (type == 0)
+    {
+        if (monotonic_ms() < req->deadline_ms) return AUTH_PENDING;
+
+        log_warn("LDAP: Timeout für %s", req->user);
+        ldap_abandon_ext(req->ld, req->msgid, NULL, NULL);
+        return ldap_auth_finish(req, LDAP_TIMEOUT);
+    }
+    if (type < 0)
+    {
+        // Verbindung abgerissen: bei einer Pool-Verbindung einmal neu senden
+        int pooled = req->pooled;
+        ldap_unbind_ext_s(req->ld, NULL, NULL);
+        req->ld = NULL;
+        if (pooled && ldap_send_bind(req)) return AUTH_PENDING;
+        return ldap_auth_finish(req, LDAP_SERVER_DOWN);
+    }
+
+    int rc = LDAP_OTHER;
+    if (ldap_parse_result(req->ld, result, &rc, NULL, NULL, NULL, NULL, 1) != LDAP_SUCCESS) rc = LDAP_OTHER;
+    return ldap_auth_finish(req, rc);
+}
+
+// -=- Authentifizierung -=-
+
+static enum auth_status ldap_auth_begin(struct auth_request *req, const char *username, const char *password, int blocking)
+{
+    memset(req, 0, sizeof(*req));
+    if (!username || !password || strlen(username) == 0 || strlen(password) == 0 ||
+        strlen(username) > USER_LEN || strlen(password) >= sizeof(req->password))
+    {
+        log_debug("LDAP: empty username or password");
+        return AUTH_FAILED;
+    }
+
+    if (cache_lookup(username, password))
+    {
+        log_debug("LDAP: %s aus dem Cache bestätigt", username);
+        return AUTH_OK;
+    }
+
+    strcpy(req->user, username);
+    strcpy(req->password, password);
+    build_user_dn(req->user_dn, sizeof(req->user_dn), username);
+    req->deadline_ms = monotonic_ms() + auth_timeout * 1000L;
+    req->blocking = blocking;
+    log_debug("Binding with DN: %s", req->user_dn);
+
+    if (!ldap_send_bind(req)) return ldap_auth_finish(req, LDAP_SERVER_DOWN);
+
+    // Schnelle Antworten (oder Cache im Directory) gleich abholen
+    struct timeval no_wait = { 0, 0 };
+    return ldap_auth_wait(req, &no_wait);
+}
+
+static enum auth_status ldap_auth_start(struct auth_request *req, const char *username, const char *password)
+{
+    return ldap_auth_begin(req, username, password, 0);
+}
+
+static enum auth_status ldap_auth_poll(struct auth_request *req)
+{
+    if (req->connecting)
+    {
+        // Verbindung aus dem Hintergrund abholen, sobald eine im Pool liegt
+        req->ld = pool_checkout();
+        if (!req->ld)
+        {
+            if (ldap_is_down()) return ldap_auth_finish(req, LDAP_SERVER_DOWN);
+            if (monotonic_ms() < req->deadline_ms) return AUTH_PENDING;
+            log_warn("LDAP: Timeout beim Verbindungsaufbau für %s", req->user);
+            return ldap_auth_finish(req, LDAP_TIMEOUT);
+        }
+        req->connecting = 0;
+        req->pooled = 1;
+        if (!ldap_bind_on(req) && !ldap_send_bind(req)) return ldap_auth_finish(req, LDAP_SERVER_DOWN);
+    }
+
+    struct timeval no_wait = { 0, 0 };
+    return ldap_auth_wait(req, &no_wait);
+}
+
+static int ldap_auth_fd(const struct auth_request *req)
+{
+    int fd = -1;
+    if (req->ld) ldap_get_option(req->ld, LDAP_OPT_DESC, &fd);
+    return fd;
+}
+
+static long ldap_auth_remaining_ms(const struct auth_request *req)
+{
+    long remaining = req->deadline_ms - monotonic_ms();
+    return remaining > 0 ? remaining : 0;
+}
+
+static void ldap_auth_cancel(struct auth_request *req)
+{
+    // Eine angeforderte Verbindung landet trotzdem im Pool
+    req->connecting = 0;
+    if (req->ld)
+    {
+        // Die Verbindung trägt noch eine offene Anfrage: nicht in den Pool zurück
+        ldap_abandon_ext(req->ld, req->msgid, NULL, NULL);
+        ldap_unbind_ext_s(req->ld, NULL, NULL);
+        req->ld = NULL;
+    }
+    explicit_bzero(req->password, sizeof(req->password));
+}
+
+static int ldap_authenticate(const char *username, const char *password)
+{
+    // Blockierende Variante (fork-Modus): gleicher Ablauf, aber mit Warten bis zum Timeout
+    // und eigenem Verbindungsaufbau statt Verbindungs-Thread
+    struct auth_request req;
+    enum auth_status status = ldap_auth_begin(&req, username, password, 1);
+    while (status == AUTH_PENDING)
+    {
+        long remaining = ldap_auth_remaining_ms(&req);
+        struct timeval timeout = { remaining / 1000, (remaining % 1000) * 1000 };
+        status = ldap_auth_wait(&req, &timeout);
+    }
+    return status == AUTH_OK;
+}
+
+const struct auth_provider ldap_provider =
+{
+    .name = "ldap",
+    .init = ldap_auth_init,
+    .warm = ldap_pool_warm,
+    .authenticate = ldap_authenticate,
+    .start = ldap_auth_start,
+    .poll = ldap_auth_poll,
+    .fd = ldap_auth_fd,
+    .remaining_ms = ldap_auth_remaining_ms,
+    .cancel = ldap_auth_cancel,
+    .reload = NULL,
+};
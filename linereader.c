@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "Headers/linereader.h"
+
+void lr_init(struct line_reader *r, int fd, size_t max_line)
+{
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+    r->max_line = max_line;
+}
+
+void lr_set_source(struct line_reader *r, lr_read_fn read_fn, void *ctx)
+{
+    r->read_fn = read_fn;
+    r->read_ctx = ctx;
+}
+
+void lr_free(struct line_reader *r)
+{
+    free(r->buf);
+    r->buf = NULL;
+    r->head = r->tail = 0;
+    r->has_saved = 0;
+}
+
+static void lr_restore(struct line_reader *r)
+{
+    // Zeichen zurückschreiben, das für die letzte geteilte Zeile '\0' wurde
+    if (r->has_saved)
+    {
+        r->buf[r->saved_pos] = r->saved_char;
+        r->has_saved = 0;
+    }
+}
+
+void lr_shrink(struct line_reader *r)
+{
+    if (r->buf && r->head == r->tail) lr_free(r);
+}
+
+size_t lr_pending(const struct line_reader *r)
+{
+    return r->tail - r->head;
+}
+
+size_t lr_take(struct line_reader *r, size_t max, char **data)
+{
+    lr_restore(r);
+
+    size_t n = r->tail - r->head;
+    if (n > max) n = max;
+    if (n == 0) return 0;
+    *data = r->buf + r->head;
+    r->head += n;
+    return n;
+}
+
+ssize_t lr_fill(struct line_reader *r)
+{
+    lr_restore(r);
+
+    if (!r->buf)
+    {
+        r->buf = malloc(LR_BUFFER_SIZE);
+        if (!r->buf)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        r->head = r->tail = 0;
+    }
+
+    // Ungelesenes an den Anfang schieben, damit ein großer Block Platz hat
+    if (r->head == r->tail)
+    {
+        r->head = r->tail = 0;
+    }
+    else if (r->head > 0 && r->tail == LR_BUFFER_SIZE)
+    {
+        memmove(r->buf, r->buf + r->head, r->tail - r->head);
+        r->tail -= r->head;
+        r->head = 0;
+    }
+    if (r->tail == LR_BUFFER_SIZE)
+    {
+        errno = ENOBUFS; // Puffer voll, erst Zeilen abholen
+        return -1;
+    }
+
+    ssize_t n;
+    do
+    {
+        n = r->read_fn ? r->read_fn(r->read_ctx, r->buf + r->tail, LR_BUFFER_SIZE - r->tail)
+                       : read(r->fd, r->buf + r->tail, LR_BUFFER_SIZE - r->tail);
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0) r->tail += n;
+    return n;
+}
+
+int lr_next_line(struct line_reader *r, char **line, size_t *len)
+{
+    if (!r->buf) return 0;
+    lr_restore(r);
+
+    char *start = r->buf + r->head;
+    size_t avail = r->tail - r->head;
+    size_t limit = r->max_line - 1;
+    char *newline = memchr(start, '\n', avail < limit ? avail : limit);
+
+    if (newline)
+    {
+        *newline = '\0';
+        *line = start;
+        *len = newline - start;
+        r->head += *len + 1;
+        return 1;
+    }
+
+    // Zu lange Zeile: Teilstück liefern, der Rest folgt als eigene Zeile
+    // (gleiches Verhalten wie das frühere zeichenweise Lesen)
+    if (avail >= limit && r->head + limit < r->tail)
+    {
+        r->saved_pos = r->head + limit;
+        r->saved_char = r->buf[r->saved_pos];
+        r->has_saved = 1;
+        r->buf[r->saved_pos] = '\0';
+        *line = start;
+        *len = limit;
+        r->head += limit;
+        return 1;
+    }
+
+    return 0;
+}
+
+int lr_read_line(struct line_reader *r, char **line, size_t *len)
+{
+    while (!lr_next_line(r, line, len))
+    {
+        if (lr_fill(r) <= 0) return -1; // Fehler oder Verbindung geschlossen
+    }
+    return (int)*len;
+}
@@ -0,0 +1,285 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include "Headers/log.h"
+
+// Bounded MPMC Queue nach Vyukov: sequence == Position → frei zum Schreiben,
+// sequence == Position + 1 → fertig geschrieben, bereit für den Flusher.
+struct log_slot
+{
+    uint64_t sequence;
+    struct timespec time;
+    int level;
+    int length;
+    char message[LOG_MESSAGE_LEN];
+};
+
+static const char *level_names[] = { "debug", "info", "warn", "error" };
+static const char *level_tags[] = { "DEBUG", "INFO ", "WARN ", "ERROR" };
+
+int log_level = LOG_LEVEL_INFO;
+static int log_json = 0;
+
+static struct log_slot ring[LOG_RING_SLOTS];
+static uint64_t ring_head = 0;      // Nächste zu belegende Position (Produzenten)
+static uint64_t ring_tail = 0;      // Nächste zu schreibende Position (nur unter flush_lock)
+static uint64_t dropped = 0;
+
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static int ring_ready = 0;
+static int flusher_running = 0;
+
+// Ausgabepuffer des Flushers: eine Runde = möglichst ein write()
+static char out[64 * 1024];
+static size_t out_len = 0;
+
+int log_set_level(const char *name)
+{
+    for (int level = LOG_LEVEL_DEBUG; level <= LOG_LEVEL_ERROR; level++)
+    {
+        if (strcmp(name, level_names[level]) == 0)
+        {
+            log_level = level;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void log_set_json(int enabled)
+{
+    log_json = enabled;
+}
+
+// -=- Ausgabe (Aufrufer hält flush_lock) -=-
+
+static void out_write(void)
+{
+    size_t written = 0;
+    while (written < out_len)
+    {
+        ssize_t n = write(STDOUT_FILENO, out + written, out_len - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break; // stdout weg: Einträge verwerfen statt hängen
+        written += (size_t)n;
+    }
+    out_len = 0;
+}
+
+static void out_append(const char *data, size_t len)
+{
+    if (out_len + len > sizeof(out)) out_write();
+    if (len > sizeof(out)) len = sizeof(out);
+    memcpy(out + out_len, data, len);
+    out_len += len;
+}
+
+static void out_json_string(const char *text, int length)
+{
+    char escaped[LOG_MESSAGE_LEN * 6 + 2];
+    size_t len = 0;
+    escaped[len++] = '"';
+    for (int i = 0; i < length; i++)
+    {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '"' || c == '\\')
+        {
+            escaped[len++] = '\\';
+            escaped[len++] = (char)c;
+        }
+        else if (c < 0x20)
+        {
+            len += (size_t)snprintf(escaped + len, 7, "\\u%04x", c);
+        }
+        else
+        {
+            escaped[len++] = (char)c;
+        }
+    }
+    escaped[len++] = '"';
+    out_append(escaped, len);
+}
+
+static void out_entry(const struct timespec *time, int level, const char *message, int length)
+{
+    struct tm tm;
+    gmtime_r(&time->tv_sec, &tm);
+
+    char prefix[96];
+    int prefix_len;
+    if (log_json)
+    {
+        prefix_len = snprintf(prefix, sizeof(prefix),
+                              "{\"ts\":\"%04d-%02d-%02dT%02d:%02d:%02d.%03ldZ\",\"level\":\"%s\",\"pid\":%d,\"msg\":",
+                              tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                              time->tv_nsec / 1000000, level_names[level], (int)getpid());
+        out_append(prefix, (size_t)prefix_len);
+        out_json_string(message, length);
+        out_append("}\n", 2);
+        return;
+    }
+
+    prefix_len = snprintf(prefix, sizeof(prefix), "%04d-%02d-%02dT%02d:%02d:%02d.%03ldZ %s [%d] ",
+                          tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                          time->tv_nsec / 1000000, level_tags[level], (int)getpid());
+    out_append(prefix, (size_t)prefix_len);
+    out_append(message, (size_t)length);
+    out_append("\n", 1);
+}
+
+static void drain_locked(void)
+{
+    while (1)
+    {
+        struct log_slot *slot = &ring[ring_tail & (LOG_RING_SLOTS - 1)];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != ring_tail + 1) break;
+
+        out_entry(&slot->time, slot->level, slot->message, slot->length);
+        __atomic_store_n(&slot->sequence, ring_tail + LOG_RING_SLOTS, __ATOMIC_RELEASE);
+        ring_tail++;
+    }
+
+    uint64_t lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_ACQ_REL);
+    if (lost > 0)
+    {
+        char message[64];
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        int length = snprintf(message, sizeof(message), "%llu Log-Einträge verworfen (Ring voll)", (unsigned long long)lost);
+        out_entry(&now, LOG_LEVEL_WARN, message, length);
+    }
+    if (out_len > 0) out_write();
+}
+
+void log_flush(void)
+{
+    if (!ring_ready) return;
+    pthread_mutex_lock(&flush_lock);
+    drain_locked();
+    pthread_mutex_unlock(&flush_lock);
+}
+
+// -=- Flusher-Thread und fork() -=-
+
+static void *flusher_main(void *arg)
+{
+    (void)arg;
+    struct timespec interval = { 0, LOG_FLUSH_INTERVAL_MS * 1000000L };
+    while (1)
+    {
+        nanosleep(&interval, NULL);
+        log_flush();
+    }
+    return NULL;
+}
+
+// Vor fork(): Ring leeren, damit das Kind keine Einträge des Elternprozesses doppelt schreibt
+static void before_fork(void)
+{
+    pthread_mutex_lock(&flush_lock);
+    drain_locked();
+}
+
+static void after_fork_parent(void)
+{
+    pthread_mutex_unlock(&flush_lock);
+}
+
+// Threads überleben fork() nicht: das Kind startet beim ersten Eintrag einen eigenen Flusher
+static void after_fork_child(void)
+{
+    pthread_mutex_init(&flush_lock, NULL);
+    flusher_running = 0;
+}
+
+static void log_start(void)
+{
+    if (!ring_ready)
+    {
+        for (uint64_t i = 0; i < LOG_RING_SLOTS; i++) ring[i].sequence = i;
+        ring_ready = 1;
+        pthread_atfork(before_fork, after_fork_parent, after_fork_child);
+        atexit(log_flush);
+    }
+
+    // Signale bleiben beim Haupt-Thread
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, flusher_main, NULL) == 0)
+    {
+        pthread_detach(thread);
+        flusher_running = 1;
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+}
+
+static struct log_slot *ring_claim(uint64_t *position)
+{
+    uint64_t pos = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+    while (1)
+    {
+        struct log_slot *slot = &ring[pos & (LOG_RING_SLOTS - 1)];
+        uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (sequence == pos)
+        {
+            if (__atomic_compare_exchange_n(&ring_head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                *position = pos;
+                return slot;
+            }
+        }
+        else if (sequence < pos)
+        {
+            return NULL; // Ring voll
+        }
+        else
+        {
+            pos = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void log_write(int level, const char *format, ...)
+{
+    if (!flusher_running) log_start();
+
+    uint64_t position;
+    struct log_slot *slot = ring_claim(&position);
+    if (!slot && pthread_mutex_trylock(&flush_lock) == 0)
+    {
+        // Flusher kommt nicht nach: selbst schreiben statt Einträge zu verlieren
+        drain_locked();
+        pthread_mutex_unlock(&flush_lock);
+        slot = ring_claim(&position);
+    }
+    if (!slot)
+    {
+        __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &slot->time);
+    slot->level = level;
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(slot->message, sizeof(slot->message), format, args);
+    va_end(args);
+    if (length < 0) length = 0;
+    if (length >= (int)sizeof(slot->message)) length = sizeof(slot->message) - 1;
+    slot->length = length;
+
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+}
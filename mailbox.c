@@ -0,0 +1,858 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "Headers/common.h"
+#include "Headers/mailbox.h"
+#include "Headers/delivery.h"
+#include "Headers/storage.h"
+
+#define INDEX_BATCH 256            // Records pro pread() beim sequentiellen Lesen
+#define INDEX_COMPACT_MIN 64       // Ab so vielen Tombstones ...
+                                   // ... und mehr als der Hälfte gelöschter Records wird kompaktiert
+
+struct mail_index
+{
+    int fd;
+    const char *mail_dir;
+    const char *user;
+    int rebuilt;        // Beim Öffnen aus dem Backend neu aufgebaut
+    struct mail_index_header header;
+};
+
+static off_t tombstone_offset(uint32_t slot)
+{
+    return (off_t)sizeof(struct mail_index_header) + (off_t)slot * sizeof(uint32_t);
+}
+
+static off_t record_offset(uint32_t position)
+{
+    return tombstone_offset(MAILBOX_INDEX_TOMBSTONES) + (off_t)position * sizeof(struct mail_index_record);
+}
+
+static int write_all_at(int fd, const void *data, size_t len, off_t offset)
+{
+    const char *src = data;
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, src, len, offset);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        src += n;
+        len -= n;
+        offset += n;
+    }
+    return 1;
+}
+
+static int read_all_at(int fd, void *data, size_t len, off_t offset)
+{
+    char *dst = data;
+    while (len > 0)
+    {
+        ssize_t n = pread(fd, dst, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        dst += n;
+        len -= n;
+        offset += n;
+    }
+    return 1;
+}
+
+// -=- Neuaufbau aus dem Speicher-Backend -=-
+
+static int compare_records_by_id(const void *a, const void *b)
+{
+    const struct mail_index_record *ra = a;
+    const struct mail_index_record *rb = b;
+    return (ra->id > rb->id) - (ra->id < rb->id);
+}
+
+struct record_collector
+{
+    struct mail_index_record *records;
+    size_t count;
+    size_t capacity;
+};
+
+static int collect_record(const struct mail_index_record *record, void *ctx)
+{
+    struct record_collector *collector = ctx;
+    if (collector->count == collector->capacity)
+    {
+        collector->capacity = collector->capacity ? collector->capacity * 2 : 64;
+        struct mail_index_record *grown = realloc(collector->records, collector->capacity * sizeof(*grown));
+        if (!grown) return 1;
+        collector->records = grown;
+    }
+    collector->records[collector->count++] = *record;
+    return 0;
+}
+
+static int index_rebuild_locked(struct mail_index *idx)
+{
+    // Das Backend kennt die Ablage (Dateien oder Segmente) und liefert Sender/Betreff mit
+    struct record_collector collector = { NULL, 0, 0 };
+    if (!storage()->scan(idx->mail_dir, idx->user, 1, collect_record, &collector))
+    {
+        // Mailbox ohne gespeicherte Nachrichten ergibt einen leeren Index
+        collector.count = 0;
+    }
+
+    qsort(collector.records, collector.count, sizeof(*collector.records), compare_records_by_id);
+
+    memset(&idx->header, 0, sizeof(idx->header));
+    memcpy(idx->header.magic, MAILBOX_INDEX_MAGIC, sizeof(MAILBOX_INDEX_MAGIC));
+    idx->header.version = MAILBOX_INDEX_VERSION;
+    idx->header.record_size = sizeof(struct mail_index_record);
+    idx->header.record_count = (uint32_t)collector.count;
+
+    // Leere Tombstone-Liste: das Loch vor den Records liest sich als Nullen
+    int ok = ftruncate(idx->fd, 0) == 0 &&
+             ftruncate(idx->fd, record_offset(idx->header.record_count)) == 0 &&
+             write_all_at(idx->fd, collector.records, collector.count * sizeof(*collector.records), record_offset(0)) &&
+             write_all_at(idx->fd, &idx->header, sizeof(idx->header), 0);
+    free(collector.records);
+    return ok;
+}
+
+// -=- Öffnen / Validieren -=-
+
+static int index_is_valid(struct mail_index *idx)
+{
+    struct stat st;
+    if (fstat(idx->fd, &st) < 0) return 0;
+    if ((size_t)st.st_size < sizeof(idx->header)) return 0;
+    if (!read_all_at(idx->fd, &idx->header, sizeof(idx->header), 0)) return 0;
+
+    return memcmp(idx->header.magic, MAILBOX_INDEX_MAGIC, sizeof(MAILBOX_INDEX_MAGIC)) == 0 &&
+           idx->header.version == MAILBOX_INDEX_VERSION &&
+           idx->header.record_size == sizeof(struct mail_index_record) &&
+           idx->header.deleted_count <= idx->header.record_count &&
+           idx->header.deleted_count <= MAILBOX_INDEX_TOMBSTONES &&
+           st.st_size == record_offset(idx->header.record_count);
+}
+
+// Öffnet und sperrt den Index (LOCK_SH oder LOCK_EX). 0 = Mailbox existiert nicht / Fehler
+static int index_open(struct mail_index *idx, const char *mail_dir, const char *user, int lock_type)
+{
+    char index_path[256];
+    snprintf(index_path, sizeof(index_path), "%s/%s/%s", mail_dir, user, MAILBOX_INDEX_FILE);
+
+    idx->mail_dir = mail_dir;
+    idx->user = user;
+    idx->rebuilt = 0;
+    idx->fd = open(index_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (idx->fd < 0) return 0;
+
+    if (flock(idx->fd, lock_type) < 0)
+    {
+        close(idx->fd);
+        return 0;
+    }
+    if (index_is_valid(idx)) return 1;
+
+    // Fehlend oder beschädigt: exklusiv sperren, erneut prüfen, neu aufbauen
+    if (lock_type != LOCK_EX) flock(idx->fd, LOCK_EX);
+    int ok = index_is_valid(idx) || (idx->rebuilt = index_rebuild_locked(idx));
+    if (lock_type != LOCK_EX) flock(idx->fd, lock_type);
+    if (ok && lock_type != LOCK_EX) ok = index_is_valid(idx);
+
+    if (!ok)
+    {
+        close(idx->fd);
+        return 0;
+    }
+    return 1;
+}
+
+static void index_close(struct mail_index *idx)
+{
+    close(idx->fd); // Gibt auch den flock() frei
+}
+
+// -=- Tombstone-Liste -=-
+// Die Positionen stehen in Löschreihenfolge hinter dem Header, gültig sind die ersten
+// deleted_count. Neue Einträge werden nur angehängt und zählen erst mit dem Header,
+// ein abgebrochenes DEL lässt die gültigen Einträge also unverändert.
+
+static int compare_positions(const void *a, const void *b)
+{
+    uint32_t pa = *(const uint32_t *)a;
+    uint32_t pb = *(const uint32_t *)b;
+    return (pa > pb) - (pa < pb);
+}
+
+// Liest die Liste aufsteigend sortiert nach positions (MAILBOX_INDEX_TOMBSTONES Plätze).
+// 0 = nicht lesbar oder unstimmig, dann bleibt nur der Durchlauf über die Records
+static int load_tombstones(struct mail_index *idx, uint32_t *positions)
+{
+    uint32_t count = idx->header.deleted_count;
+    if (!read_all_at(idx->fd, positions, count * sizeof(*positions), tombstone_offset(0))) return 0;
+    qsort(positions, count, sizeof(*positions), compare_positions);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (positions[i] >= idx->header.record_count || (i > 0 && positions[i] == positions[i - 1])) return 0;
+    }
+    return 1;
+}
+
+// Position des number-ten nicht gelöschten Records: number - 1 plus die Tombstones davor.
+// tombstones[k] - k steigt monoton, gesucht ist das erste k mit tombstones[k] - k >= number
+static uint32_t live_position(const uint32_t *tombstones, uint32_t count, uint32_t number)
+{
+    uint32_t low = 0;
+    uint32_t high = count;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if (tombstones[mid] - mid < number) low = mid + 1;
+        else high = mid;
+    }
+    return number - 1 + low;
+}
+
+// Neue Tombstones anhängen; gültig erst, wenn danach der Header geschrieben ist
+static int append_tombstones(struct mail_index *idx, const uint32_t *positions, int count)
+{
+    return write_all_at(idx->fd, positions, count * sizeof(*positions), tombstone_offset(idx->header.deleted_count));
+}
+
+// -=- Suche nach Nummern -=-
+
+// Durchlauf über alle Records, falls die Tombstone-Liste nicht zu den Records passt
+static int index_find_scan(struct mail_index *idx, int number, struct mail_index_record *out, uint32_t *out_position)
+{
+    struct mail_index_record batch[INDEX_BATCH];
+    uint32_t seen = 0;
+    for (uint32_t position = 0; position < idx->header.record_count; position += INDEX_BATCH)
+    {
+        uint32_t n = idx->header.record_count - position;
+        if (n > INDEX_BATCH) n = INDEX_BATCH;
+        if (!read_all_at(idx->fd, batch, n * sizeof(batch[0]), record_offset(position))) return 0;
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            if (batch[i].flags & MI_FLAG_DELETED) continue;
+            if (++seen == (uint32_t)number)
+            {
+                *out = batch[i];
+                *out_position = position + i;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Sucht den number-ten nicht gelöschten Record (1-basiert)
+static int index_find(struct mail_index *idx, int number, struct mail_index_record *out, uint32_t *out_position)
+{
+    uint32_t live = idx->header.record_count - idx->header.deleted_count;
+    if (number < 1 || (uint32_t)number > live) return 0;
+
+    uint32_t tombstones[MAILBOX_INDEX_TOMBSTONES];
+    if (!load_tombstones(idx, tombstones)) return index_find_scan(idx, number, out, out_position);
+
+    uint32_t position = live_position(tombstones, idx->header.deleted_count, (uint32_t)number);
+    if (!read_all_at(idx->fd, out, sizeof(*out), record_offset(position))) return 0;
+
+    // Markiert, aber nicht in der Liste (Absturz vor dem Header): Liste unvollständig
+    if (out->flags & MI_FLAG_DELETED) return index_find_scan(idx, number, out, out_position);
+    *out_position = position;
+    return 1;
+}
+
+struct number_slot
+{
+    int number;
+    int slot;           // Stelle in der Anfrage
+};
+
+static int compare_slots(const void *a, const void *b)
+{
+    const struct number_slot *sa = a;
+    const struct number_slot *sb = b;
+    return (sa->number > sb->number) - (sa->number < sb->number);
+}
+
+// Wie index_find_scan für mehrere Nummern in einem Durchlauf
+static int index_find_many_scan(struct mail_index *idx, const int *numbers, int count,
+                                struct mail_index_record *out, uint32_t *positions, int *found)
+{
+    for (int i = 0; i < count; i++) found[i] = 0;
+
+    // Nummern sortieren und den Index einmal sequentiell lesen
+    struct number_slot *order = malloc(count * sizeof(*order));
+    if (!order) return 0;
+    for (int i = 0; i < count; i++)
+    {
+        order[i].number = numbers[i];
+        order[i].slot = i;
+    }
+    qsort(order, count, sizeof(*order), compare_slots);
+
+    struct mail_index_record batch[INDEX_BATCH];
+    uint32_t seen = 0;
+    int next = 0;
+    int ok = 1;
+    while (next < count && order[next].number < 1) next++;
+
+    for (uint32_t position = 0; next < count && position < idx->header.record_count; position += INDEX_BATCH)
+    {
+        uint32_t n = idx->header.record_count - position;
+        if (n > INDEX_BATCH) n = INDEX_BATCH;
+        if (!read_all_at(idx->fd, batch, n * sizeof(batch[0]), record_offset(position)))
+        {
+            ok = 0;
+            break;
+        }
+
+        for (uint32_t i = 0; i < n && next < count; i++)
+        {
+            if (batch[i].flags & MI_FLAG_DELETED) continue;
+            seen++;
+            while (next < count && (uint32_t)order[next].number == seen)
+            {
+                int slot = order[next++].slot;
+                out[slot] = batch[i];
+                positions[slot] = position + i;
+                found[slot] = 1;
+            }
+        }
+    }
+
+    free(order);
+    return ok;
+}
+
+// Wie index_find für mehrere Nummern; found[i] = 0 für unbekannte Nummern
+static int index_find_many(struct mail_index *idx, const int *numbers, int count,
+                           struct mail_index_record *out, uint32_t *positions, int *found)
+{
+    uint32_t tombstones[MAILBOX_INDEX_TOMBSTONES];
+    if (!load_tombstones(idx, tombstones)) return index_find_many_scan(idx, numbers, count, out, positions, found);
+
+    uint32_t live = idx->header.record_count - idx->header.deleted_count;
+    for (int i = 0; i < count; i++)
+    {
+        found[i] = 0;
+        if (numbers[i] < 1 || (uint32_t)numbers[i] > live) continue;
+        positions[i] = live_position(tombstones, idx->header.deleted_count, (uint32_t)numbers[i]);
+        if (!read_all_at(idx->fd, &out[i], sizeof(out[i]), record_offset(positions[i]))) return 0;
+        if (out[i].flags & MI_FLAG_DELETED) return index_find_many_scan(idx, numbers, count, out, positions, found);
+        found[i] = 1;
+    }
+    return 1;
+}
+
+// Record mit dieser id (nicht gelöscht), out darf NULL sein
+static int index_find_id(struct mail_index *idx, uint32_t id, struct mail_index_record *out)
+{
+    struct mail_index_record batch[INDEX_BATCH];
+    for (uint32_t position = 0; position < idx->header.record_count; position += INDEX_BATCH)
+    {
+        uint32_t n = idx->header.record_count - position;
+        if (n > INDEX_BATCH) n = INDEX_BATCH;
+        if (!read_all_at(idx->fd, batch, n * sizeof(batch[0]), record_offset(position))) return 0;
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            if (batch[i].id == id && !(batch[i].flags & MI_FLAG_DELETED))
+            {
+                if (out) *out = batch[i];
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int index_compact(struct mail_index *idx)
+{
+    size_t total = idx->header.record_count;
+    struct mail_index_record *records = malloc(total * sizeof(*records));
+    if (!records) return 0;
+    if (!read_all_at(idx->fd, records, total * sizeof(*records), record_offset(0)))
+    {
+        free(records);
+        return 0;
+    }
+
+    size_t live = 0;
+    for (size_t i = 0; i < total; i++)
+    {
+        if (!(records[i].flags & MI_FLAG_DELETED)) records[live++] = records[i];
+    }
+
+    idx->header.record_count = (uint32_t)live;
+    idx->header.deleted_count = 0;
+    int ok = write_all_at(idx->fd, records, live * sizeof(*records), record_offset(0)) &&
+             write_all_at(idx->fd, &idx->header, sizeof(idx->header), 0) &&
+             ftruncate(idx->fd, record_offset(idx->header.record_count)) == 0;
+    free(records);
+    return ok;
+}
+
+// Kompaktieren, sobald genug Tombstones und mehr als die Hälfte der Records gelöscht sind
+static void index_maybe_compact(struct mail_index *idx)
+{
+    if (idx->header.deleted_count >= INDEX_COMPACT_MIN && idx->header.deleted_count * 2 > idx->header.record_count)
+    {
+        index_compact(idx);
+    }
+}
+
+// Platz für count neue Tombstones schaffen; vor der Suche aufrufen, weil das
+// Kompaktieren die Positionen verschiebt
+static int index_reserve_tombstones(struct mail_index *idx, int count)
+{
+    if (count > MAILBOX_INDEX_TOMBSTONES) return 0;
+    if (idx->header.deleted_count + (uint32_t)count <= MAILBOX_INDEX_TOMBSTONES) return 1;
+    return index_compact(idx);
+}
+
+// -=- Öffentliche Funktionen -=-
+
+int mailbox_index_append(const char *mail_dir, const char *user, const struct mail_index_record *record)
+{
+    struct mail_index idx;
+    if (!index_open(&idx, mail_dir, user, LOCK_EX)) return 0;
+
+    // Die Nachricht liegt schon im Backend, ein Neuaufbau hat sie also meist erfasst
+    if (idx.rebuilt && index_find_id(&idx, record->id, NULL))
+    {
+        index_close(&idx);
+        return 1;
+    }
+
+    // Erst den Record, dann den Header: ein Absturz dazwischen ergibt eine
+    // Größenabweichung und damit einen Neuaufbau beim nächsten Öffnen
+    int ok = write_all_at(idx.fd, record, sizeof(*record), record_offset(idx.header.record_count));
+    if (ok)
+    {
+        idx.header.record_count++;
+        ok = write_all_at(idx.fd, &idx.header, sizeof(idx.header), 0);
+    }
+
+    index_close(&idx);
+    return ok;
+}
+
+int mailbox_index_prepare(const char *mail_dir, const char *user)
+{
+    struct mail_index idx;
+    if (!index_open(&idx, mail_dir, user, LOCK_SH)) return 0;
+    index_close(&idx);
+    return 1;
+}
+
+int mailbox_index_foreach(const char *mail_dir, const char *user, mailbox_visit_fn visit, void *ctx)
+{
+    struct mail_index idx;
+    if (!index_open(&idx, mail_dir, user, LOCK_SH)) return 0;
+
+    // Gesamtzahl unter demselben Lock wie die Records, damit sie zusammenpassen
+    uint32_t total = idx.header.record_count - idx.header.deleted_count;
+    struct mail_index_record batch[INDEX_BATCH];
+    int visited = 0;
+    int stop = 0;
+
+    for (uint32_t position = 0; !stop && position < idx.header.record_count; position += INDEX_BATCH)
+    {
+        uint32_t n = idx.header.record_count - position;
+        if (n > INDEX_BATCH) n = INDEX_BATCH;
+        if (!read_all_at(idx.fd, batch, n * sizeof(batch[0]), record_offset(position)))
+        {
+            visited = -1;
+            break;
+        }
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            if (batch[i].flags & MI_FLAG_DELETED) continue;
+            visited++;
+            if (visit(&batch[i], total, ctx) != 0)
+            {
+                stop = 1; // Abbruch durch Aufrufer
+                break;
+            }
+        }
+    }
+
+    index_close(&idx);
+    return visited;
+}
+
+int mailbox_index_get(const char *mail_dir, const char *user, int number, struct mail_index_record *out)
+{
+    struct mail_index idx;
+    if (!index_open(&idx, mail_dir, user, LOCK_SH)) return 0;
+
+    uint32_t position;
+    int found = index_find(&idx, number, out, &position);
+    index_close(&idx);
+    return found;
+}
+
+int mailbox_index_get_id(const char *mail_dir, const char *user, uint32_t id, struct mail_index_record *out)
+{
+    struct mail_index idx;
+    if (!index_open(&idx, mail_dir, user, LOCK_SH)) return 0;
+
+    int found = index_find_id(&idx, id, out);
+    index_close(&idx);
+    return found;
+}
+
+// -=- LIST mit Ausschnitt und Filtern -=-
+
+static int query_matches(const struct mailbox_query *query, const struct mail_index_record *record)
+{
+    if (record->id <= query->since_id) return 0;
+    if (query->sender[0] && strcmp(record->sender, query->sender) != 0) return 0;
+    if (query->subject[0] && !strcasestr(record->subject, query->subject)) return 0;
+    return 1;
+}
+
+int mailbox_index_query(const char *mail_dir, const char *user, const struct mailbox_query *query,
+                        struct mail_index_record *out, int *numbers, uint32_t *total)
+{
+    struct mail_index idx;
+    if (!index_open(&idx, mail_dir, user, LOCK_SH)) return -1;
+
+    uint32_t records = idx.header.record_count;
+    uint32_t live = records - idx.header.deleted_count;
+    *total = live;
+
+    // Nummer = Rang unter den nicht gelöschten Records, wie bei READ/DEL.
+    // seen zählt sie in Laufrichtung; rückwärts ergibt das live - seen + 1
+    int filtered = query->since_id || query->sender[0] || query->subject[0];
+    uint32_t tombstones[MAILBOX_INDEX_TOMBSTONES];
+    int direct = !filtered && load_tombstones(&idx, tombstones);
+    uint32_t skip = query->offset;
+    uint32_t seen = 0;
+    uint32_t position = query->newest_first ? records : 0;   // Rückwärts: Ende (exklusiv)
+    if (direct)
+    {
+        // Jeder nicht gelöschte Record ist ein Treffer: der Ausschnitt beginnt direkt
+        // beim offset-ten, seine Position liefert die Tombstone-Liste
+        seen = skip < live ? skip : live;
+        skip = 0;
+        if (seen == live) position = query->newest_first ? 0 : records;
+        else if (query->newest_first) position = live_position(tombstones, idx.header.deleted_count, live - seen) + 1;
+        else position = live_position(tombstones, idx.header.deleted_count, seen + 1);
+    }
+
+    struct mail_index_record batch[INDEX_BATCH];
+    int found = 0;
+    while (found < (int)query->limit)
+    {
+        uint32_t left = query->newest_first ? position : records - position;
+        if (left == 0) break;
+        uint32_t n = left < INDEX_BATCH ? left : INDEX_BATCH;
+        if (direct && n > query->limit - (uint32_t)found) n = query->limit - (uint32_t)found;
+        uint32_t first = query->newest_first ? position - n : position;
+
+        if (!read_all_at(idx.fd, batch, n * sizeof(batch[0]), record_offset(first)))
+        {
+            found = -1;
+            break;
+        }
+
+        for (uint32_t i = 0; i < n && found < (int)query->limit; i++)
+        {
+            const struct mail_index_record *record = &batch[query->newest_first ? n - 1 - i : i];
+            if (record->flags & MI_FLAG_DELETED) continue;
+            seen++;
+            if (!query_matches(query, record)) continue;
+            if (skip > 0)
+            {
+                skip--;
+                continue;
+            }
+            out[found] = *record;
+            numbers[found] = (int)(query->newest_first ? live - seen + 1 : seen);
+            found++;
+        }
+        position = query->newest_first ? first : position + n;
+    }
+
+    index_close(&idx);
+    return found;
+}
+
+int mailbox_index_delete(const char *mail_dir, const char *user, int number, struct mail_index_record *out)
+{
+    struct mail_index idx;
+    if (!index_open(&idx, mail_dir, user, LOCK_EX)) return 0;
+
+    uint32_t position;
+    int found = index_reserve_tombstones(&idx, 1) && index_find(&idx, number, out, &position);
+    if (found)
+    {
+        // Record, Liste, zuletzt der Header
+        struct mail_index_record tombstone = *out;
+        tombstone.flags |= MI_FLAG_DELETED;
+        found = write_all_at(idx.fd, &tombstone, sizeof(tombstone), record_offset(position)) &&
+                append_tombstones(&idx, &position, 1);
+        idx.header.deleted_count++;
+        found = found && write_all_at(idx.fd, &idx.header, sizeof(idx.header), 0);
+        if (found) index_maybe_compact(&idx);
+    }
+
+    index_close(&idx);
+    return found;
+}
+
+int mailbox_index_get_many(const char *mail_dir, const char *user, const int *numbers, int count,
+                           struct mail_index_record *out, int *found)
+{
+    struct mail_index idx;
+    if (!index_open(&idx, mail_dir, user, LOCK_SH)) return 0;
+
+    uint32_t *positions = malloc(count * sizeof(*positions));
+    int ok = positions && index_find_many(&idx, numbers, count, out, positions, found);
+    free(positions);
+    index_close(&idx);
+    return ok;
+}
+
+int mailbox_index_delete_many(const char *mail_dir, const char *user, const int *numbers, int count,
+                              struct mail_index_record *out)
+{
+    struct mail_index idx;
+    if (!index_open(&idx, mail_dir, user, LOCK_EX)) return 0;
+
+    uint32_t *positions = malloc(count * sizeof(*positions));
+    int *found = malloc(count * sizeof(*found));
+    int ok = positions && found && index_reserve_tombstones(&idx, count) &&
+             index_find_many(&idx, numbers, count, out, positions, found);
+
+    // Alle oder keine: alle Nummern beziehen sich auf denselben Stand
+    for (int i = 0; ok && i < count; i++)
+    {
+        if (!found[i]) ok = 0;
+    }
+
+    int marked = 0;
+    if (ok)
+    {
+        // Erst alle Tombstones, dann die Liste, dann der Header
+        for (int i = 0; ok && i < count; i++)
+        {
+            struct mail_index_record tombstone = out[i];
+            tombstone.flags |= MI_FLAG_DELETED;
+            ok = write_all_at(idx.fd, &tombstone, sizeof(tombstone), record_offset(positions[i]));
+            if (ok) marked++;
+        }
+        if (ok) ok = append_tombstones(&idx, positions, marked);
+        if (ok)
+        {
+            idx.header.deleted_count += (uint32_t)marked;
+            ok = write_all_at(idx.fd, &idx.header, sizeof(idx.header), 0);
+            if (!ok) idx.header.deleted_count -= (uint32_t)marked;
+        }
+
+        // Fehler: geschriebene Tombstones von hinten zurücknehmen. Scheitert auch das,
+        // bleibt ein Präfix von out gelöscht; der Header zählt genau diese
+        while (!ok && marked > 0 && write_all_at(idx.fd, &out[marked - 1], sizeof(out[0]), record_offset(positions[marked - 1])))
+        {
+            marked--;
+        }
+        if (!ok && marked > 0 && append_tombstones(&idx, positions, marked))
+        {
+            idx.header.deleted_count += (uint32_t)marked;
+            write_all_at(idx.fd, &idx.header, sizeof(idx.header), 0); // Sonst baut index_open() neu auf
+        }
+        if (ok) index_maybe_compact(&idx);
+    }
+
+    free(positions);
+    free(found);
+    index_close(&idx);
+    return marked;
+}
+
+static int count_record(const struct mail_index_record *record, void *ctx)
+{
+    (void)record;
+    (*(uint32_t *)ctx)++;
+    return 0;
+}
+
+int mailbox_index_verify(const char *mail_dir, const char *user)
+{
+    struct mail_index idx;
+    if (!index_open(&idx, mail_dir, user, LOCK_EX)) return 0;
+
+    // Nur zählen, keine Header lesen: fehlt ein Record (Absturz zwischen
+    // Zustellung und Indexierung), passt die Anzahl nicht mehr
+    uint32_t stored = 0;
+    storage()->scan(mail_dir, user, 0, count_record, &stored);
+
+    int ok = 1;
+    if (stored != idx.header.record_count - idx.header.deleted_count)
+    {
+        ok = index_rebuild_locked(&idx);
+    }
+    index_close(&idx);
+    return ok;
+}
+
+int mailbox_index_rebuild(const char *mail_dir, const char *user)
+{
+    struct mail_index idx;
+    if (!index_open(&idx, mail_dir, user, LOCK_EX)) return 0;
+
+    int ok = index_rebuild_locked(&idx);
+    index_close(&idx);
+    return ok;
+}
+
+int mailbox_index_relocate(const char *mail_dir, const char *user, const struct mail_index_record *moved, int count)
+{
+    struct mail_index idx;
+    if (!index_open(&idx, mail_dir, user, LOCK_EX)) return 0;
+
+    // Records und moved sind beide nach id sortiert: ein gemeinsamer Durchlauf reicht
+    struct mail_index_record batch[INDEX_BATCH];
+    int next = 0;
+    int ok = 1;
+    for (uint32_t position = 0; ok && next < count && position < idx.header.record_count; position += INDEX_BATCH)
+    {
+        uint32_t n = idx.header.record_count - position;
+        if (n > INDEX_BATCH) n = INDEX_BATCH;
+        if (!read_all_at(idx.fd, batch, n * sizeof(batch[0]), record_offset(position)))
+        {
+            ok = 0;
+            break;
+        }
+
+        int changed = 0;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            while (next < count && moved[next].id < batch[i].id) next++;
+            if (next < count && moved[next].id == batch[i].id)
+            {
+                batch[i].segment = moved[next].segment;
+                batch[i].offset = moved[next].offset;
+                changed = 1;
+            }
+        }
+        if (changed) ok = write_all_at(idx.fd, batch, n * sizeof(batch[0]), record_offset(position));
+    }
+
+    if (ok && delivery_sync_mode() != SYNC_NONE) ok = fdatasync(idx.fd) == 0;
+    index_close(&idx);
+    return ok;
+}
+
+static int compare_record_id(const void *key, const void *element)
+{
+    uint32_t id = *(const uint32_t *)key;
+    const struct mail_index_record *record = element;
+    return id < record->id ? -1 : id > record->id;
+}
+
+int mailbox_index_replace(const char *mail_dir, const char *user, const struct mail_index_record *updated, int count,
+                          mailbox_apply_fn apply, void *ctx)
+{
+    struct mail_index idx;
+    if (!index_open(&idx, mail_dir, user, LOCK_EX)) return -1;
+
+    // Nachschlagen statt gemeinsamer Durchlauf: parallele Zustellungen können
+    // Records leicht außerhalb der id-Reihenfolge anhängen
+    struct mail_index_record batch[INDEX_BATCH];
+    int replaced = 0;
+    int ok = 1;
+    for (uint32_t position = 0; ok && replaced < count && position < idx.header.record_count; position += INDEX_BATCH)
+    {
+        uint32_t n = idx.header.record_count - position;
+        if (n > INDEX_BATCH) n = INDEX_BATCH;
+        if (!read_all_at(idx.fd, batch, n * sizeof(batch[0]), record_offset(position)))
+        {
+            ok = 0;
+            break;
+        }
+
+        int changed = 0;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            if (batch[i].flags & MI_FLAG_DELETED) continue; // DEL war schneller
+            const struct mail_index_record *update = bsearch(&batch[i].id, updated, count, sizeof(*updated), compare_record_id);
+            if (!update || !apply(update, ctx)) continue;
+
+            batch[i].size = update->size;
+            batch[i].flags = update->flags;
+            changed = 1;
+            replaced++;
+        }
+        if (changed) ok = write_all_at(idx.fd, batch, n * sizeof(batch[0]), record_offset(position));
+    }
+
+    if (ok && replaced > 0 && delivery_sync_mode() != SYNC_NONE) ok = fdatasync(idx.fd) == 0;
+    index_close(&idx);
+    return ok ? replaced : -1;
+}
+
+// -=- Vergabe der Nachrichtennummern -=-
+
+static int track_highest_id(const struct mail_index_record *record, void *ctx)
+{
+    uint32_t *highest = ctx;
+    if (record->id > *highest) *highest = record->id;
+    return 0;
+}
+
+static uint32_t scan_highest_id(const char *mail_dir, const char *user)
+{
+    uint32_t highest = 0;
+    storage()->scan(mail_dir, user, 0, track_highest_id, &highest);
+    return highest;
+}
+
+uint32_t mailbox_next_id(const char *mail_dir, const char *user)
+{
+    char folder_path[256];
+    char counter_path[300];
+    snprintf(folder_path, sizeof(folder_path), "%s/%s", mail_dir, user);
+    snprintf(counter_path, sizeof(counter_path), "%s/%s", folder_path, MAILBOX_COUNTER_FILE);
+
+    int fd = open(counter_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) return 0;
+    if (flock(fd, LOCK_EX) < 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    char text[32];
+    uint32_t next = 0;
+    ssize_t n = pread(fd, text, sizeof(text) - 1, 0);
+    if (n > 0)
+    {
+        text[n] = '\0';
+        next = (uint32_t)strtoul(text, NULL, 10);
+    }
+
+    // Neuer oder beschädigter Zähler: einmalig aus dem Verzeichnis bestimmen
+    if (next == 0) next = scan_highest_id(mail_dir, user) + 1;
+
+    int len = snprintf(text, sizeof(text), "%u\n", next + 1);
+    if (ftruncate(fd, 0) < 0 || !write_all_at(fd, text, len, 0)) next = 0;
+
+    close(fd); // Gibt auch den flock() frei
+    return next;
+}
@@ -0,0 +1,311 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "Headers/metrics.h"
+#include "Headers/log.h"
+
+// Buckets nicht kumuliert; der letzte Eintrag zählt alles über der höchsten Grenze
+struct metrics_histogram
+{
+    uint64_t buckets[METRICS_BUCKETS + 1];
+    uint64_t sum_ns;
+};
+
+struct metrics_shared
+{
+    struct metrics_histogram commands[METRIC_COMMANDS];
+    uint64_t command_errors[METRIC_COMMANDS];
+    struct metrics_histogram phases[METRIC_PHASES];
+    uint64_t connections_accepted;
+    uint64_t connections_rejected;
+};
+
+static const char *command_names[METRIC_COMMANDS] = { "LOGIN", "SEND", "LIST", "READ", "DEL", "MSEND", "MREAD", "MDEL" };
+static const char *phase_names[METRIC_PHASES] = { "auth", "index", "file_io", "socket_write" };
+
+static struct metrics_shared *shared = NULL;
+static uint64_t bounds_us[METRICS_BUCKETS];
+static struct sockaddr_in listen_address;
+static int listen_configured = 0;
+
+int metrics_configure(const char *spec)
+{
+    memset(&listen_address, 0, sizeof(listen_address));
+    listen_address.sin_family = AF_INET;
+    listen_address.sin_addr.s_addr = INADDR_ANY;
+
+    const char *port_text = spec;
+    const char *colon = strrchr(spec, ':');
+    if (colon)
+    {
+        char host[INET_ADDRSTRLEN];
+        size_t host_len = (size_t)(colon - spec);
+        if (host_len == 0 || host_len >= sizeof(host)) return 0;
+        memcpy(host, spec, host_len);
+        host[host_len] = '\0';
+        if (inet_pton(AF_INET, host, &listen_address.sin_addr) != 1) return 0;
+        port_text = colon + 1;
+    }
+
+    char *end;
+    long port = strtol(port_text, &end, 10);
+    if (*port_text == '\0' || *end != '\0' || port <= 0 || port > 65535) return 0;
+    listen_address.sin_port = htons((uint16_t)port);
+    listen_configured = 1;
+    return 1;
+}
+
+int metrics_init(void)
+{
+    if (!listen_configured || shared) return 1;
+
+    // 1, 2, 3, 4, 6, 8, 12, 16, ... µs
+    bounds_us[0] = 1;
+    for (int i = 1; i < METRICS_BUCKETS; i++)
+    {
+        int power = (i + 1) / 2;
+        bounds_us[i] = (i % 2) ? (1ULL << power) : (3ULL << (power - 1));
+    }
+
+    shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+    {
+        shared = NULL;
+        return 0;
+    }
+    return 1; // Anonyme Mappings sind bereits genullt
+}
+
+// -=- Messen -=-
+
+uint64_t metrics_now(void)
+{
+    if (!shared) return 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static void histogram_observe(struct metrics_histogram *histogram, uint64_t start)
+{
+    uint64_t elapsed_ns = metrics_now() - start;
+    uint64_t elapsed_us = (elapsed_ns + 999) / 1000;
+
+    // Kleinste Grenze >= Messwert (binäre Suche)
+    int low = 0, high = METRICS_BUCKETS;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (bounds_us[middle] < elapsed_us) low = middle + 1;
+        else high = middle;
+    }
+
+    __atomic_add_fetch(&histogram->buckets[low], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->sum_ns, elapsed_ns, __ATOMIC_RELAXED);
+}
+
+void metrics_observe_command(enum metric_command command, uint64_t start, int failed)
+{
+    if (!shared || start == 0 || command >= METRIC_COMMANDS) return;
+
+    histogram_observe(&shared->commands[command], start);
+    if (failed) __atomic_add_fetch(&shared->command_errors[command], 1, __ATOMIC_RELAXED);
+}
+
+void metrics_observe_phase(enum metric_phase phase, uint64_t start)
+{
+    if (!shared || start == 0) return;
+    histogram_observe(&shared->phases[phase], start);
+}
+
+void metrics_count_connection(int accepted)
+{
+    if (!shared) return;
+    __atomic_add_fetch(accepted ? &shared->connections_accepted : &shared->connections_rejected, 1, __ATOMIC_RELAXED);
+}
+
+// -=- Prometheus Textformat -=-
+
+struct render_buffer
+{
+    char data[METRICS_RESPONSE_LEN];
+    size_t len;
+};
+
+static void render(struct render_buffer *out, const char *format, ...)
+{
+    if (out->len >= sizeof(out->data)) return;
+
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(out->data + out->len, sizeof(out->data) - out->len, format, args);
+    va_end(args);
+    if (n > 0) out->len += (size_t)n;
+    if (out->len > sizeof(out->data)) out->len = sizeof(out->data);
+}
+
+static void render_histogram(struct render_buffer *out, const char *name, const char *label,
+                             const char *value, const struct metrics_histogram *histogram)
+{
+    uint64_t cumulative = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++)
+    {
+        cumulative += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+        render(out, "%s_bucket{%s=\"%s\",le=\"%.6f\"} %llu\n", name, label, value,
+               bounds_us[i] / 1e6, (unsigned long long)cumulative);
+    }
+    cumulative += __atomic_load_n(&histogram->buckets[METRICS_BUCKETS], __ATOMIC_RELAXED);
+    render(out, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %llu\n", name, label, value, (unsigned long long)cumulative);
+    render(out, "%s_sum{%s=\"%s\"} %.9f\n", name, label, value,
+           __atomic_load_n(&histogram->sum_ns, __ATOMIC_RELAXED) / 1e9);
+    render(out, "%s_count{%s=\"%s\"} %llu\n", name, label, value, (unsigned long long)cumulative);
+}
+
+static void render_metrics(struct render_buffer *out)
+{
+    out->len = 0;
+
+    render(out, "# HELP twmailer_command_duration_seconds Dauer vom Command-Wort bis zur Antwort.\n");
+    render(out, "# TYPE twmailer_command_duration_seconds histogram\n");
+    for (int i = 0; i < METRIC_COMMANDS; i++)
+    {
+        render_histogram(out, "twmailer_command_duration_seconds", "command", command_names[i], &shared->commands[i]);
+    }
+
+    render(out, "# HELP twmailer_command_errors_total Commands, die mit ERR beantwortet wurden.\n");
+    render(out, "# TYPE twmailer_command_errors_total counter\n");
+    for (int i = 0; i < METRIC_COMMANDS; i++)
+    {
+        render(out, "twmailer_command_errors_total{command=\"%s\"} %llu\n", command_names[i],
+               (unsigned long long)__atomic_load_n(&shared->command_errors[i], __ATOMIC_RELAXED));
+    }
+
+    render(out, "# HELP twmailer_phase_duration_seconds Zeit pro Phase innerhalb der Commands.\n");
+    render(out, "# TYPE twmailer_phase_duration_seconds histogram\n");
+    for (int i = 0; i < METRIC_PHASES; i++)
+    {
+        render_histogram(out, "twmailer_phase_duration_seconds", "phase", phase_names[i], &shared->phases[i]);
+    }
+
+    render(out, "# HELP twmailer_connections_total Angenommene und abgewiesene Client-Verbindungen.\n");
+    render(out, "# TYPE twmailer_connections_total counter\n");
+    render(out, "twmailer_connections_total{result=\"accepted\"} %llu\n",
+           (unsigned long long)__atomic_load_n(&shared->connections_accepted, __ATOMIC_RELAXED));
+    render(out, "twmailer_connections_total{result=\"rejected\"} %llu\n",
+           (unsigned long long)__atomic_load_n(&shared->connections_rejected, __ATOMIC_RELAXED));
+}
+
+// -=- Admin-Prozess -=-
+
+static void send_all(int sock, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(sock, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+static void serve_request(int client, struct render_buffer *body)
+{
+    // Nur die Request-Zeile ist interessant; Header werden ignoriert
+    char request[METRICS_REQUEST_LEN];
+    size_t len = 0;
+    while (len < sizeof(request) - 1 && !memchr(request, '\n', len))
+    {
+        ssize_t n = read(client, request + len, sizeof(request) - 1 - len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        len += (size_t)n;
+    }
+    request[len] = '\0';
+
+    char header[256];
+    int header_len;
+    if (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET /metrics?", 13) == 0)
+    {
+        render_metrics(body);
+        header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.1 200 OK\r\n"
+                              "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                              "Content-Length: %zu\r\n"
+                              "Connection: close\r\n\r\n", body->len);
+        send_all(client, header, (size_t)header_len);
+        send_all(client, body->data, body->len);
+        return;
+    }
+
+    header_len = snprintf(header, sizeof(header),
+                          "HTTP/1.1 404 Not Found\r\n"
+                          "Content-Type: text/plain\r\n"
+                          "Content-Length: 10\r\n"
+                          "Connection: close\r\n\r\n"
+                          "Not Found\n");
+    send_all(client, header, (size_t)header_len);
+}
+
+void metrics_start_server(void)
+{
+    if (!shared) return;
+
+    int admin_socket = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    if (admin_socket < 0 ||
+        setsockopt(admin_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        bind(admin_socket, (struct sockaddr*)&listen_address, sizeof(listen_address)) < 0 ||
+        listen(admin_socket, 16) < 0)
+    {
+        log_error("Metrics port %d: %s", ntohs(listen_address.sin_port), strerror(errno));
+        if (admin_socket >= 0) close(admin_socket);
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        log_error("Metrics server fork failed: %s", strerror(errno));
+        close(admin_socket);
+        return;
+    }
+    if (pid > 0)
+    {
+        close(admin_socket);
+        log_info("Metriken unter http://%s:%d/metrics", inet_ntoa(listen_address.sin_addr), ntohs(listen_address.sin_port));
+        return;
+    }
+
+    // Kindprozess: liest nur die gemeinsamen Zähler, stirbt mit dem Server
+    signal(SIGCHLD, SIG_DFL);
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+    static struct render_buffer body;
+    while (1)
+    {
+        int client = accept(admin_socket, NULL, NULL);
+        if (client < 0) continue;
+
+        // Langsame Scraper dürfen den Admin-Port nicht blockieren
+        struct timeval timeout = { 2, 0 };
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        serve_request(client, &body);
+        close(client);
+    }
+}
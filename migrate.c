@@ -0,0 +1,377 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "Headers/common.h"
+#include "Headers/mailbox.h"
+#include "Headers/delivery.h"
+#include "Headers/storage.h"
+#include "Headers/compress.h"
+
+// Offline-Migration eines Mail-Verzeichnisses zwischen zwei Speicher-Backends.
+// Der Server darf währenddessen nicht laufen.
+//
+// Mit --compress werden stattdessen vorhandene .msg Dateien (file-Backend)
+// nachträglich komprimiert, das geht auch bei laufendem Server: die neue
+// Datei entsteht in tmp/ und ersetzt die alte per rename() unter dem Index-Lock,
+// gelöschte Nachrichten werden dabei übersprungen. Ein READ, der die alte
+// Datei schon offen hat, liest sie zu Ende; spätere erkennen das neue Format.
+// Nachrichten an mehrere Empfänger (Hardlinks) bleiben unverändert.
+
+#define COMPRESS_BATCH 64   // Nachrichten pro Index-Update
+
+struct migration
+{
+    struct mail_index_record *records;
+    size_t count;
+    size_t capacity;
+};
+
+static int collect_message(const struct mail_index_record *record, void *ctx)
+{
+    struct migration *m = ctx;
+    if (m->count == m->capacity)
+    {
+        m->capacity = m->capacity ? m->capacity * 2 : 64;
+        struct mail_index_record *grown = realloc(m->records, m->capacity * sizeof(*grown));
+        if (!grown) return 1;
+        m->records = grown;
+    }
+    m->records[m->count++] = *record;
+    return 0;
+}
+
+static int migrate_mailbox(const char *mail_dir, const char *user,
+                           const struct storage_backend *from, const struct storage_backend *to)
+{
+    from->recover(mail_dir, user);
+
+    struct migration m = { NULL, 0, 0 };
+    if (!from->scan(mail_dir, user, 0, collect_message, &m))
+    {
+        free(m.records);
+        return 1; // Keine Nachrichten
+    }
+
+    int ok = 1;
+    for (size_t i = 0; ok && i < m.count; i++)
+    {
+        struct mail_index_record *record = &m.records[i];
+        struct message_ref message;
+        if (!from->open_message(mail_dir, user, record, &message))
+        {
+            printf("Fehler: Nachricht %s/%u nicht lesbar\n", user, record->id);
+            ok = 0;
+            break;
+        }
+
+        record->size = message.length;
+        ok = to->import(mail_dir, user, record, message.fd, message.offset);
+        message_ref_close(&message);
+        if (!ok) printf("Fehler: Nachricht %s/%u konnte nicht übernommen werden\n", user, record->id);
+    }
+
+    // Erst wenn alles kopiert ist: Index auf das neue Backend umstellen, Quelle löschen
+    if (ok)
+    {
+        storage_select(to->name);
+        ok = mailbox_index_rebuild(mail_dir, user);
+        storage_select(from->name);
+    }
+    if (ok)
+    {
+        from->destroy(mail_dir, user);
+        printf("%s: %zu Nachrichten migriert\n", user, m.count);
+    }
+
+    free(m.records);
+    return ok;
+}
+
+// -=- Nachträgliche Komprimierung -=-
+
+struct recompress_batch
+{
+    const char *mail_dir;
+    const char *user;
+    struct mail_index_record records[COMPRESS_BATCH];   // Neue Größe und Flags, nach id sortiert
+    uint64_t old_size[COMPRESS_BATCH];
+    int count;
+    uint64_t saved;
+};
+
+static int collect_uncompressed(const struct mail_index_record *record, uint32_t total, void *ctx)
+{
+    (void)total;
+    if (record->flags & MI_FLAG_COMPRESSED) return 0;
+    return collect_message(record, ctx);
+}
+
+static void recompress_tmp_path(char *path, size_t size, const char *mail_dir, const char *user, uint32_t id)
+{
+    snprintf(path, size, "%s/%s/%s/%u.recompress", mail_dir, user, DELIVERY_TMP_DIR, id);
+}
+
+// Schreibt <user>/tmp/<id>.recompress; 1 = kleiner als das Original, record hat die neue Größe
+static int recompress_message(const char *mail_dir, const char *user, struct mail_index_record *record, uint64_t *old_size)
+{
+    char file_path[256];
+    char tmp_path[256];
+    snprintf(file_path, sizeof(file_path), "%s/%s/%u.msg", mail_dir, user, record->id);
+    recompress_tmp_path(tmp_path, sizeof(tmp_path), mail_dir, user, record->id);
+
+    int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0; // Inzwischen gelöscht oder anderes Backend
+
+    // Geteilter Inhalt (mehrere Empfänger): umschreiben würde die Links trennen
+    struct stat st;
+    char header[MESSAGE_HEADER_MAX];
+    ssize_t n = 0;
+    if (fstat(fd, &st) == 0 && st.st_nlink == 1) n = pread(fd, header, sizeof(header), 0);
+    char *blank = n > 0 ? memmem(header, (size_t)n, "\n\n", 2) : NULL;
+    if (!blank)
+    {
+        close(fd);
+        return 0;
+    }
+    size_t header_len = (size_t)(blank - header) + 1; // Ohne Leerzeile
+    *old_size = (uint64_t)st.st_size;
+
+    FILE *raw = fopen(tmp_path, "w");
+    if (!raw)
+    {
+        close(fd);
+        return 0;
+    }
+    fwrite(header, 1, header_len, raw);
+    fprintf(raw, "%s\n\n", COMPRESS_ENCODING_LINE);
+
+    int ok = 0;
+    FILE *compressed = compress_writer(raw);
+    if (compressed)
+    {
+        char buffer[COMPRESS_BUFFER_SIZE];
+        off_t offset = (off_t)header_len + 1;
+        ok = 1;
+        while (ok && (n = pread(fd, buffer, sizeof(buffer), offset)) > 0)
+        {
+            ok = fwrite(buffer, 1, (size_t)n, compressed) == (size_t)n;
+            offset += n;
+        }
+        if (n < 0) ok = 0;
+        if (fclose(compressed) != 0) ok = 0;
+    }
+    close(fd);
+
+    record->size = (uint64_t)ftell(raw);
+    if (ok) ok = fflush(raw) == 0 && fsync(fileno(raw)) == 0;
+    if (fclose(raw) != 0) ok = 0;
+    if (!ok || record->size >= *old_size)
+    {
+        unlink(tmp_path);
+        return 0;
+    }
+    record->flags |= MI_FLAG_COMPRESSED;
+    return 1;
+}
+
+// Unter dem Index-Lock: neue Datei an die Stelle der alten
+static int replace_message(const struct mail_index_record *updated, void *ctx)
+{
+    struct recompress_batch *batch = ctx;
+    char file_path[256];
+    char tmp_path[256];
+    snprintf(file_path, sizeof(file_path), "%s/%s/%u.msg", batch->mail_dir, batch->user, updated->id);
+    recompress_tmp_path(tmp_path, sizeof(tmp_path), batch->mail_dir, batch->user, updated->id);
+    if (rename(tmp_path, file_path) < 0) return 0;
+
+    batch->saved += batch->old_size[updated - batch->records] - updated->size;
+    return 1;
+}
+
+static int compare_id(const void *a, const void *b)
+{
+    const struct mail_index_record *left = a;
+    const struct mail_index_record *right = b;
+    return left->id < right->id ? -1 : left->id > right->id;
+}
+
+static int commit_batch(struct recompress_batch *batch)
+{
+    if (batch->count == 0) return 1;
+
+    // Nach id sortieren, alte Größen wandern mit (record ist jeweils das erste Feld)
+    struct { struct mail_index_record record; uint64_t old_size; } pairs[COMPRESS_BATCH];
+    for (int i = 0; i < batch->count; i++)
+    {
+        pairs[i].record = batch->records[i];
+        pairs[i].old_size = batch->old_size[i];
+    }
+    qsort(pairs, batch->count, sizeof(pairs[0]), compare_id);
+    for (int i = 0; i < batch->count; i++)
+    {
+        batch->records[i] = pairs[i].record;
+        batch->old_size[i] = pairs[i].old_size;
+    }
+
+    int replaced = mailbox_index_replace(batch->mail_dir, batch->user, batch->records, batch->count, replace_message, batch);
+
+    // Übrig gebliebene tmp-Dateien (gelöschte Nachrichten) wegräumen
+    for (int i = 0; i < batch->count; i++)
+    {
+        char tmp_path[256];
+        recompress_tmp_path(tmp_path, sizeof(tmp_path), batch->mail_dir, batch->user, batch->records[i].id);
+        unlink(tmp_path);
+    }
+    batch->count = 0;
+
+    char folder_path[256];
+    snprintf(folder_path, sizeof(folder_path), "%s/%s", batch->mail_dir, batch->user);
+    int fd = open(folder_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        fsync(fd); // rename() dauerhaft machen
+        close(fd);
+    }
+    return replaced >= 0;
+}
+
+static int compress_mailbox(const char *mail_dir, const char *user)
+{
+    char tmp_dir[256];
+    snprintf(tmp_dir, sizeof(tmp_dir), "%s/%s/%s", mail_dir, user, DELIVERY_TMP_DIR);
+    if (mkdir(tmp_dir, 0700) < 0 && errno != EEXIST) return 0;
+
+    struct migration m = { NULL, 0, 0 };
+    if (mailbox_index_foreach(mail_dir, user, collect_uncompressed, &m) < 0)
+    {
+        printf("Fehler: Index von %s nicht lesbar\n", user);
+        free(m.records);
+        return 0;
+    }
+
+    struct recompress_batch *batch = calloc(1, sizeof(*batch));
+    if (!batch)
+    {
+        free(m.records);
+        return 0;
+    }
+    batch->mail_dir = mail_dir;
+    batch->user = user;
+
+    int ok = 1;
+    uint64_t before = 0;
+    for (size_t i = 0; ok && i < m.count; i++)
+    {
+        struct mail_index_record *record = &batch->records[batch->count];
+        *record = m.records[i];
+        if (recompress_message(mail_dir, user, record, &batch->old_size[batch->count]))
+        {
+            before += batch->old_size[batch->count];
+            batch->count++;
+        }
+        if (batch->count == COMPRESS_BATCH) ok = commit_batch(batch);
+    }
+    if (ok) ok = commit_batch(batch);
+
+    if (ok)
+    {
+        printf("%s: %zu Nachrichten geprüft, %llu von %llu Bytes gespart\n", user, m.count,
+               (unsigned long long)batch->saved, (unsigned long long)before);
+    }
+    else
+    {
+        printf("Fehler: Index von %s konnte nicht aktualisiert werden\n", user);
+    }
+    free(batch);
+    free(m.records);
+    return ok;
+}
+
+static int compress_spool(const char *mail_dir, const char *spec)
+{
+    if (!compress_configure(spec) || !compress_enabled())
+    {
+        printf("Fehler: ungültige Komprimierung %s (gzip oder gzip:1-9)\n", spec);
+        return 1;
+    }
+    if (nice(19) < 0) perror("nice"); // Neben dem Server: CPU nur, wenn sonst nichts anliegt
+
+    DIR *spool = opendir(mail_dir);
+    if (!spool)
+    {
+        perror("Mail-Verzeichnis nicht lesbar");
+        return 1;
+    }
+
+    int failed = 0;
+    struct dirent *entry;
+    while ((entry = readdir(spool)) != NULL)
+    {
+        if (entry->d_name[0] == '.') continue;
+
+        char folder_path[512];
+        struct stat st;
+        snprintf(folder_path, sizeof(folder_path), "%s/%s", mail_dir, entry->d_name);
+        if (stat(folder_path, &st) < 0 || !S_ISDIR(st.st_mode)) continue;
+
+        if (!compress_mailbox(mail_dir, entry->d_name)) failed = 1;
+    }
+    closedir(spool);
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 3 && argc <= 4 && strcmp(argv[2], "--compress") == 0)
+    {
+        return compress_spool(argv[1], argc == 4 ? argv[3] : "gzip");
+    }
+    if (argc != 4)
+    {
+        printf("Verwendung: %s <Mail-Verzeichnis> <von: file|segment> <nach: file|segment>\n", argv[0]);
+        printf("       %s <Mail-Verzeichnis> --compress [gzip[:stufe]]   (file-Backend, auch im laufenden Betrieb)\n", argv[0]);
+        printf("Beispiel: %s mailspool file segment\n", argv[0]);
+        return 1;
+    }
+
+    const char *mail_dir = argv[1];
+    const struct storage_backend *from = storage_find(argv[2]);
+    const struct storage_backend *to = storage_find(argv[3]);
+    if (!from || !to || from == to)
+    {
+        printf("Fehler: ungültige Backends %s -> %s\n", argv[2], argv[3]);
+        return 1;
+    }
+    storage_select(from->name);
+
+    DIR *spool = opendir(mail_dir);
+    if (!spool)
+    {
+        perror("Mail-Verzeichnis nicht lesbar");
+        return 1;
+    }
+
+    int failed = 0;
+    struct dirent *entry;
+    while ((entry = readdir(spool)) != NULL)
+    {
+        if (entry->d_name[0] == '.') continue;
+
+        char folder_path[512];
+        struct stat st;
+        snprintf(folder_path, sizeof(folder_path), "%s/%s", mail_dir, entry->d_name);
+        if (stat(folder_path, &st) < 0 || !S_ISDIR(st.st_mode)) continue;
+
+        if (!migrate_mailbox(mail_dir, entry->d_name, from, to)) failed = 1;
+    }
+    closedir(spool);
+
+    return failed;
+}
@@ -0,0 +1,316 @@
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include "Headers/outbuf.h"
+
+void ob_init(struct out_buffer *ob, int fd)
+{
+    ob->fd = fd;
+    ob->write_fn = NULL;
+    ob->write_ctx = NULL;
+    ob->head = ob->tail = NULL;
+    ob->pending = 0;
+    ob->open_chunks = 0;
+}
+
+void ob_set_writer(struct out_buffer *ob, ob_write_fn write_fn, void *ctx)
+{
+    ob->write_fn = write_fn;
+    ob->write_ctx = ctx;
+}
+
+// Nur reine Speicher-Chunks dürfen erweitert und per writev() gesammelt werden
+static int is_memory_chunk(const struct ob_chunk *chunk)
+{
+    return chunk->file_fd < 0 && !chunk->stream;
+}
+
+static void free_chunk(struct out_buffer *ob, struct ob_chunk *chunk)
+{
+    if (!is_memory_chunk(chunk)) ob->open_chunks--;
+    if (chunk->file_fd >= 0) close(chunk->file_fd);
+    if (chunk->stream_close) chunk->stream_close(chunk->stream_ctx);
+    free(chunk->block);
+    free(chunk);
+}
+
+static struct ob_chunk *new_chunk(struct out_buffer *ob, size_t cap)
+{
+    struct ob_chunk *chunk = malloc(sizeof(*chunk) + cap);
+    if (!chunk) return NULL;
+    chunk->next = NULL;
+    chunk->file_fd = -1;
+    chunk->file_offset = 0;
+    chunk->stream = NULL;
+    chunk->stream_close = NULL;
+    chunk->stream_ctx = NULL;
+    chunk->stream_left = 0;
+    chunk->block = NULL;
+    chunk->cap = cap;
+    chunk->len = chunk->sent = 0;
+    if (ob->tail) ob->tail->next = chunk;
+    else ob->head = chunk;
+    ob->tail = chunk;
+    return chunk;
+}
+
+void ob_free(struct out_buffer *ob)
+{
+    struct ob_chunk *chunk = ob->head;
+    while (chunk)
+    {
+        struct ob_chunk *next = chunk->next;
+        free_chunk(ob, chunk);
+        chunk = next;
+    }
+    ob->head = ob->tail = NULL;
+    ob->pending = 0;
+}
+
+int ob_append(struct out_buffer *ob, const void *data, size_t len)
+{
+    const char *src = data;
+
+    while (len > 0)
+    {
+        struct ob_chunk *tail = ob->tail;
+        if (!tail || !is_memory_chunk(tail) || tail->len == tail->cap)
+        {
+            // Hinter einem Datei- oder Stream-Chunk klein anfangen: bei gepipelinetem
+            // READ folgen nur ".\n" und das nächste "OK", dann wieder eine Datei
+            size_t cap = tail && !is_memory_chunk(tail) ? OB_SMALL_CHUNK_SIZE : OB_CHUNK_SIZE;
+            tail = new_chunk(ob, len > cap ? len : cap);
+            if (!tail) return -1;
+        }
+
+        size_t space = tail->cap - tail->len;
+        size_t n = len < space ? len : space;
+        memcpy(tail->data + tail->len, src, n);
+        tail->len += n;
+        ob->pending += n;
+        src += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int ob_append_line(struct out_buffer *ob, const char *text)
+{
+    if (ob_append(ob, text, strlen(text)) < 0) return -1;
+    return ob_append(ob, "\n", 1);
+}
+
+int ob_append_file(struct out_buffer *ob, int fd, off_t offset, size_t len)
+{
+    if (len == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    struct ob_chunk *chunk = new_chunk(ob, 0);
+    if (!chunk)
+    {
+        close(fd);
+        return -1;
+    }
+    chunk->file_fd = fd;
+    chunk->file_offset = offset;
+    chunk->len = len;
+    ob->pending += len;
+    ob->open_chunks++;
+    return 0;
+}
+
+int ob_append_stream(struct out_buffer *ob, ob_stream_fn stream, ob_stream_close_fn close_fn, void *ctx, size_t len)
+{
+    if (len == 0)
+    {
+        close_fn(ctx);
+        return 0;
+    }
+
+    // Nur der Verwaltungsteil: Block und Quelle kosten erst etwas, wenn der Chunk dran ist
+    struct ob_chunk *chunk = new_chunk(ob, 0);
+    if (!chunk)
+    {
+        close_fn(ctx);
+        return -1;
+    }
+    chunk->stream = stream;
+    chunk->stream_close = close_fn;
+    chunk->stream_ctx = ctx;
+    chunk->stream_left = len;
+    ob->pending += len;
+    ob->open_chunks++;
+    return 0;
+}
+
+// Sendet den Datei-Chunk am Anfang der Liste. Rückgabe wie ob_flush(), 0 = Chunk fertig
+static int flush_file_chunk(struct out_buffer *ob)
+{
+    struct ob_chunk *chunk = ob->head;
+    while (chunk->sent < chunk->len)
+    {
+        off_t offset = chunk->file_offset + (off_t)chunk->sent;
+        ssize_t n = sendfile(ob->fd, chunk->file_fd, &offset, chunk->len - chunk->sent);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+            return -1;
+        }
+        if (n == 0) return -1; // Datei kürzer als angekündigt
+        chunk->sent += n;
+        ob->pending -= n;
+    }
+
+    ob->head = chunk->next;
+    if (!ob->head) ob->tail = NULL;
+    free_chunk(ob, chunk);
+    return 0;
+}
+
+// Stream-Chunk: Block erzeugen, senden, nächster Block erst wenn alles raus ist
+static int flush_stream_chunk(struct out_buffer *ob)
+{
+    struct ob_chunk *chunk = ob->head;
+    while (chunk->sent < chunk->len || chunk->stream_left > 0)
+    {
+        if (chunk->sent == chunk->len)
+        {
+            if (!chunk->block && !(chunk->block = malloc(OB_CHUNK_SIZE))) return -1;
+            size_t want = chunk->stream_left < OB_CHUNK_SIZE ? chunk->stream_left : OB_CHUNK_SIZE;
+            ssize_t got = chunk->stream(chunk->stream_ctx, chunk->block, want);
+            if (got <= 0) return -1; // Stream kürzer als angekündigt oder defekt
+            chunk->len = got;
+            chunk->sent = 0;
+            chunk->stream_left -= got;
+        }
+
+        const char *data = chunk->block + chunk->sent;
+        size_t len = chunk->len - chunk->sent;
+        ssize_t n = ob->write_fn ? ob->write_fn(ob->write_ctx, data, len) : write(ob->fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+            return -1;
+        }
+        chunk->sent += n;
+        ob->pending -= n;
+    }
+
+    ob->head = chunk->next;
+    if (!ob->head) ob->tail = NULL;
+    free_chunk(ob, chunk);
+    return 0;
+}
+
+// Ein Chunk über write_fn. Dateien werden abschnittsweise per pread() geholt;
+// nach EAGAIN liest der nächste Versuch denselben Abschnitt erneut.
+static int flush_chunk_with_writer(struct out_buffer *ob)
+{
+    struct ob_chunk *chunk = ob->head;
+    char bounce[OB_CHUNK_SIZE];
+
+    while (chunk->sent < chunk->len)
+    {
+        const char *data = chunk->data + chunk->sent;
+        size_t len = chunk->len - chunk->sent;
+        if (chunk->file_fd >= 0)
+        {
+            if (len > sizeof(bounce)) len = sizeof(bounce);
+            ssize_t got = pread(chunk->file_fd, bounce, len, chunk->file_offset + (off_t)chunk->sent);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return -1; // Datei kürzer als angekündigt
+            data = bounce;
+            len = got;
+        }
+
+        ssize_t n = ob->write_fn(ob->write_ctx, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+            return -1;
+        }
+        chunk->sent += n;
+        ob->pending -= n;
+    }
+
+    ob->head = chunk->next;
+    if (!ob->head) ob->tail = NULL;
+    free_chunk(ob, chunk);
+    return 0;
+}
+
+int ob_flush(struct out_buffer *ob)
+{
+    while (ob->head)
+    {
+        if (ob->head->stream)
+        {
+            int rc = flush_stream_chunk(ob);
+            if (rc != 0) return rc;
+            continue;
+        }
+
+        if (ob->write_fn)
+        {
+            int rc = flush_chunk_with_writer(ob);
+            if (rc != 0) return rc;
+            continue;
+        }
+
+        if (ob->head->file_fd >= 0)
+        {
+            int rc = flush_file_chunk(ob);
+            if (rc != 0) return rc;
+            continue;
+        }
+
+        // Speicher-Chunks bis zum nächsten Datei- oder Stream-Chunk gesammelt mit writev()
+        struct iovec iov[OB_MAX_IOV];
+        int iov_count = 0;
+        for (struct ob_chunk *chunk = ob->head; chunk && is_memory_chunk(chunk) && iov_count < OB_MAX_IOV; chunk = chunk->next)
+        {
+            iov[iov_count].iov_base = chunk->data + chunk->sent;
+            iov[iov_count].iov_len = chunk->len - chunk->sent;
+            iov_count++;
+        }
+
+        ssize_t n = writev(ob->fd, iov, iov_count);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+            return -1;
+        }
+        ob->pending -= n;
+
+        // Vollständig gesendete Chunks freigeben
+        size_t written = n;
+        while (ob->head && is_memory_chunk(ob->head) && written >= ob->head->len - ob->head->sent)
+        {
+            struct ob_chunk *done = ob->head;
+            written -= done->len - done->sent;
+            ob->head = done->next;
+            free_chunk(ob, done);
+        }
+        if (!ob->head)
+        {
+            ob->tail = NULL;
+        }
+        else
+        {
+            ob->head->sent += written;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include "Headers/server.h"
+#include "Headers/reactor.h"
+#include "Headers/auth.h"
+#include "Headers/prefork.h"
+#include "Headers/log.h"
+
+// Worker i auf die i-te erlaubte CPU setzen (reihum, falls mehr Worker als CPUs)
+static void pin_to_cpu(int worker)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) return;
+
+    int cpu_count = CPU_COUNT(&allowed);
+    if (cpu_count == 0) return;
+
+    int wanted = worker % cpu_count;
+    for (int cpu = 0, seen = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        if (seen++ != wanted) continue;
+
+        cpu_set_t single;
+        CPU_ZERO(&single);
+        CPU_SET(cpu, &single);
+        if (sched_setaffinity(0, sizeof(single), &single) == 0)
+        {
+            log_info("[Worker %d] an CPU %d gebunden", worker, cpu);
+        }
+        return;
+    }
+}
+
+static void worker_main(int worker, int port, const char *mail_dir, const struct prefork_config *config)
+{
+    prctl(PR_SET_PDEATHSIG, SIGTERM); // Worker sterben mit dem Master
+    signal(SIGCHLD, SIG_IGN);
+    if (config->pin_cpus) pin_to_cpu(worker);
+
+    int server_socket = server_socket_create(port, 1);
+    if (server_socket < 0)
+    {
+        log_flush();
+        _exit(1);
+    }
+
+    log_info("[Worker %d] PID %d bereit", worker, getpid());
+    if (auth()->warm) auth()->warm(); // Pro Worker eigene Verbindungen, geerbte werden nie benutzt
+    int rc = reactor_run(server_socket, mail_dir, config->max_connections);
+    close(server_socket);
+    log_flush();
+    _exit(rc);
+}
+
+static pid_t spawn_worker(int worker, int port, const char *mail_dir, const struct prefork_config *config)
+{
+    pid_t pid = fork();
+    if (pid < 0) log_error("Worker fork failed: %s", strerror(errno));
+    if (pid == 0) worker_main(worker, port, mail_dir, config);
+    return pid;
+}
+
+int prefork_run(int port, const char *mail_dir, const struct prefork_config *config)
+{
+    pid_t workers[PREFORK_MAX_WORKERS];
+    time_t started[PREFORK_MAX_WORKERS];
+
+    // Master wartet selbst auf seine Worker
+    signal(SIGCHLD, SIG_DFL);
+
+    for (int i = 0; i < config->workers; i++)
+    {
+        workers[i] = spawn_worker(i, port, mail_dir, config);
+        started[i] = time(NULL);
+    }
+
+    while (1)
+    {
+        // SIGHUP an alle Worker weitergeben; der Master lädt selbst neu für spätere Neustarts
+        if (auth_reload_requested())
+        {
+            if (auth()->reload) auth()->reload();
+            for (int i = 0; i < config->workers; i++)
+            {
+                if (workers[i] > 0) kill(workers[i], SIGHUP);
+            }
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0)
+        {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        // Auch Compactor/Reaper sind Kinder des Masters: nur Worker neu starten
+        for (int i = 0; i < config->workers; i++)
+        {
+            if (workers[i] != pid) continue;
+
+            log_warn("[Master] Worker %d (PID %d) beendet, starte neu", i, pid);
+            if (time(NULL) - started[i] < PREFORK_RESPAWN_DELAY) sleep(PREFORK_RESPAWN_DELAY);
+            workers[i] = spawn_worker(i, port, mail_dir, config);
+            started[i] = time(NULL);
+            break;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,220 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "Headers/ratelimit.h"
+#include "Headers/log.h"
+
+// Zustand eines Buckets in einem Wort, damit er mit einem CAS aktualisiert
+// werden kann: obere 32 Bit Tokens, untere 32 Bit Zeitstempel in ms.
+// 0 = frischer Bucket (voll).
+struct rl_slot
+{
+    uint64_t key;       // 0 = frei
+    uint64_t state;
+};
+
+struct rl_limit
+{
+    uint32_t rate;      // Tokens pro Sekunde, 0 = kein Limit
+    uint32_t burst;
+};
+
+static const char *kind_names[RL_KINDS] = { "connect", "login", "send", "bytes" };
+static struct rl_limit limits[RL_KINDS];
+static struct rl_slot *slots = NULL;
+
+int ratelimit_configure(const char *spec)
+{
+    const char *equals = strchr(spec, '=');
+    if (!equals) return 0;
+
+    for (int kind = 0; kind < RL_KINDS; kind++)
+    {
+        if (strncmp(spec, kind_names[kind], equals - spec) != 0 || kind_names[kind][equals - spec] != '\0') continue;
+
+        char *end;
+        unsigned long rate = strtoul(equals + 1, &end, 10);
+        unsigned long burst = rate;
+        if (*end == '/') burst = strtoul(end + 1, &end, 10);
+        if (*end || rate == 0 || burst < rate || burst > UINT32_MAX) return 0;
+
+        limits[kind].rate = (uint32_t)rate;
+        limits[kind].burst = (uint32_t)burst;
+        return 1;
+    }
+    return 0;
+}
+
+int ratelimit_init(void)
+{
+    int any = 0;
+    for (int kind = 0; kind < RL_KINDS; kind++) any |= limits[kind].rate != 0;
+    if (!any || slots) return 1;
+
+    slots = mmap(NULL, RL_SLOTS * sizeof(*slots), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (slots == MAP_FAILED)
+    {
+        slots = NULL;
+        return 0;
+    }
+    return 1; // Anonyme Mappings sind bereits genullt
+}
+
+int ratelimit_enabled(enum rl_kind kind)
+{
+    return slots && limits[kind].rate != 0;
+}
+
+static uint32_t now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000ULL + now.tv_nsec / 1000000); // Überlauf ist gewollt
+}
+
+static uint64_t bucket_key(enum rl_kind kind, char scope, const char *name)
+{
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a 64
+    hash = (hash ^ (unsigned char)kind) * 1099511628211ULL;
+    hash = (hash ^ (unsigned char)scope) * 1099511628211ULL;
+    for (const char *c = name; *c; c++) hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    return hash ? hash : 1;
+}
+
+// Bucket nach der vergangenen Zeit auffüllen (ohne ihn zu schreiben)
+static void bucket_refill(const struct rl_limit *limit, uint64_t state, uint32_t now, uint32_t *tokens, uint32_t *stamp)
+{
+    if (state == 0)
+    {
+        *tokens = limit->burst;
+        *stamp = now;
+        return;
+    }
+
+    *tokens = (uint32_t)(state >> 32);
+    *stamp = (uint32_t)state;
+    uint32_t elapsed = now - *stamp;
+    uint64_t added = (uint64_t)elapsed * limit->rate / 1000;
+    if (added == 0) return;
+
+    if (*tokens + added >= limit->burst)
+    {
+        *tokens = limit->burst;
+        *stamp = now;
+    }
+    else
+    {
+        // Nur die verbrauchte Zeit abbuchen, damit bei kleinen Raten nichts verloren geht
+        *tokens += (uint32_t)added;
+        *stamp += (uint32_t)(added * 1000 / limit->rate);
+    }
+}
+
+static struct rl_slot *find_slot(uint64_t key, const struct rl_limit *limit, uint32_t now)
+{
+    uint32_t mask = RL_SLOTS - 1;
+    uint32_t index = (uint32_t)key & mask;
+
+    for (int probe = 0; probe < RL_MAX_PROBES; probe++, index = (index + 1) & mask)
+    {
+        struct rl_slot *slot = &slots[index];
+        uint64_t current = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+        if (current == key) return slot;
+
+        if (current == 0)
+        {
+            uint64_t expected = 0;
+            if (__atomic_compare_exchange_n(&slot->key, &expected, key, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return slot;
+            if (expected == key) return slot; // Gleichzeitig vom selben Schlüssel belegt
+            continue;
+        }
+
+        // Lange unbenutzter, wieder voller Bucket eines anderen Schlüssels: übernehmen
+        uint64_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+        uint32_t tokens, stamp;
+        bucket_refill(limit, state, now, &tokens, &stamp);
+        if (state != 0 && tokens == limit->burst && now - (uint32_t)state > RL_IDLE_MS &&
+            __atomic_compare_exchange_n(&slot->key, &current, key, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            __atomic_store_n(&slot->state, 0, __ATOMIC_RELEASE);
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+static int bucket_take(enum rl_kind kind, char scope, const char *name, uint32_t amount)
+{
+    const struct rl_limit *limit = &limits[kind];
+    uint32_t now = now_ms();
+    struct rl_slot *slot = find_slot(bucket_key(kind, scope, name), limit, now);
+    if (!slot) return 1; // Tabelle voll: lieber durchlassen als alle blockieren
+
+    uint64_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+    while (1)
+    {
+        uint32_t tokens, stamp;
+        bucket_refill(limit, state, now, &tokens, &stamp);
+        if (tokens < amount) return 0;
+
+        uint64_t next = ((uint64_t)(tokens - amount) << 32) | stamp;
+        if (next == 0) next = 1; // 0 ist für "frisch" reserviert
+        if (__atomic_compare_exchange_n(&slot->state, &state, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return 1;
+    }
+}
+
+// Abgebuchte Tokens zurückgeben (höchstens bis burst)
+static void bucket_give(enum rl_kind kind, char scope, const char *name, uint32_t amount)
+{
+    const struct rl_limit *limit = &limits[kind];
+    uint32_t now = now_ms();
+    struct rl_slot *slot = find_slot(bucket_key(kind, scope, name), limit, now);
+    if (!slot) return;
+
+    uint64_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+    while (1)
+    {
+        uint32_t tokens, stamp;
+        bucket_refill(limit, state, now, &tokens, &stamp);
+        tokens = limit->burst - tokens < amount ? limit->burst : tokens + amount;
+
+        uint64_t next = ((uint64_t)tokens << 32) | stamp;
+        if (next == 0) next = 1;
+        if (__atomic_compare_exchange_n(&slot->state, &state, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return;
+    }
+}
+
+int ratelimit_allow(enum rl_kind kind, const char *ip, const char *user, uint32_t amount)
+{
+    if (!ratelimit_enabled(kind)) return 1;
+
+    // Größer als der ganze Bucket kann nie durchgehen
+    if (amount > limits[kind].burst) return 0;
+
+    int allowed = bucket_take(kind, 'i', ip, amount);
+    if (allowed && user && user[0] && !bucket_take(kind, 'u', user, amount))
+    {
+        // Abgelehnte Anfrage darf das IP-Budget nicht verbrauchen
+        bucket_give(kind, 'i', ip, amount);
+        allowed = 0;
+    }
+    if (!allowed) log_warn("[Ratelimit] %s: Limit erreicht (IP %s, User %s)", kind_names[kind], ip, user ? user : "-");
+    return allowed;
+}
+
+int ratelimit_allow_split(enum rl_kind kind, const char *ip, const char *user, size_t amount)
+{
+    if (!ratelimit_enabled(kind)) return 1;
+
+    while (amount > 0)
+    {
+        uint32_t piece = amount < limits[kind].burst ? (uint32_t)amount : limits[kind].burst;
+        if (!ratelimit_allow(kind, ip, user, piece)) return 0;
+        amount -= piece;
+    }
+    return 1;
+}
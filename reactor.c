@@ -0,0 +1,486 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "Headers/common.h"
+#include "Headers/server.h"
+#include "Headers/reactor.h"
+#include "Headers/linereader.h"
+#include "Headers/outbuf.h"
+#include "Headers/blacklist.h"
+#include "Headers/ratelimit.h"
+#include "Headers/tls.h"
+#include "Headers/log.h"
+
+// Quelle eines epoll-Events (erstes Feld von data.ptr, NULL = Listen-Socket)
+enum reactor_source
+{
+    SOURCE_CLIENT,
+    SOURCE_LDAP
+};
+
+struct connection;
+
+// LDAP Socket eines laufenden Logins, level-triggered überwacht
+struct ldap_watch
+{
+    enum reactor_source source;
+    struct connection *connection;
+    int fd;             // -1 = nicht registriert
+};
+
+// Speicher pro Verbindung: struct connection + Puffer, die nur solange
+// existieren, wie wirklich Daten darin liegen (idle = nur das struct).
+struct connection
+{
+    enum reactor_source source;
+    struct session session;
+    struct line_reader reader;
+    struct ssl_st *handshake;   // TLS-Handshake läuft noch, danach in session.tls
+    int closing;    // Nach dem Leeren des Ausgabepuffers schließen
+    int peer_eof;
+    int commit_queued;
+    int login_queued;
+    struct ldap_watch ldap;
+    int closed;                         // Abgebaut, Speicher wird erst nach der Runde freigegeben
+    struct connection *next_closed;
+};
+
+// Verbindungen, deren SEND in dieser Runde auf den Group Commit wartet
+static struct connection **pending_commits = NULL;
+static int pending_count = 0;
+static int pending_capacity = 0;
+
+// In dieser Runde geschlossene Verbindungen: spätere Events derselben epoll_wait()-Runde
+// (z.B. vom LDAP Socket) zeigen noch in ihren Speicher, free() erst danach
+static struct connection *closed_connections = NULL;
+
+// Offene Client-Verbindungen dieses Prozesses und das Limit (0 = unbegrenzt)
+static int active_connections = 0;
+static int connection_limit = 0;
+
+static void queue_commit(struct connection *c)
+{
+    if (pending_count == pending_capacity)
+    {
+        int capacity = pending_capacity ? pending_capacity * 2 : 64;
+        struct connection **grown = realloc(pending_commits, capacity * sizeof(*grown));
+        if (!grown) return;
+        pending_commits = grown;
+        pending_capacity = capacity;
+    }
+    pending_commits[pending_count++] = c;
+    c->commit_queued = 1;
+}
+
+static void unqueue_commit(struct connection *c)
+{
+    for (int i = 0; i < pending_count; i++)
+    {
+        if (pending_commits[i] == c)
+        {
+            pending_commits[i] = pending_commits[--pending_count];
+            break;
+        }
+    }
+    c->commit_queued = 0;
+}
+
+// Verbindungen, deren LOGIN auf LDAP wartet (für Timeouts und Bibliotheken ohne FD)
+static struct connection **pending_logins = NULL;
+static int login_count = 0;
+static int login_capacity = 0;
+
+static void ldap_watch_stop(int epoll_fd, struct connection *c)
+{
+    if (c->ldap.fd < 0) return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->ldap.fd, NULL);
+    c->ldap.fd = -1;
+}
+
+static void queue_login(int epoll_fd, struct connection *c)
+{
+    if (login_count == login_capacity)
+    {
+        int capacity = login_capacity ? login_capacity * 2 : 64;
+        struct connection **grown = realloc(pending_logins, capacity * sizeof(*grown));
+        if (!grown) return;
+        pending_logins = grown;
+        login_capacity = capacity;
+    }
+    pending_logins[login_count++] = c;
+    c->login_queued = 1;
+
+    int fd = auth()->fd(&c->session.auth);
+    if (fd >= 0)
+    {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &c->ldap;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0) c->ldap.fd = fd;
+    }
+}
+
+static void unqueue_login(int epoll_fd, struct connection *c)
+{
+    for (int i = 0; i < login_count; i++)
+    {
+        if (pending_logins[i] == c)
+        {
+            pending_logins[i] = pending_logins[--login_count];
+            break;
+        }
+    }
+    c->login_queued = 0;
+    ldap_watch_stop(epoll_fd, c);
+}
+
+static void connection_close(int epoll_fd, struct connection *c)
+{
+    if (c->closed) return;
+    if (c->commit_queued) unqueue_commit(c);
+    if (c->login_queued) unqueue_login(epoll_fd, c);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->session.sock, NULL);
+    tls_free(c->handshake);
+    session_cleanup(&c->session);   // Vor close(): TLS close_notify
+    close(c->session.sock);
+    log_info("[Client %d] Verbindung geschlossen", c->session.id);
+    lr_free(&c->reader);
+    c->closed = 1;
+    c->next_closed = closed_connections;
+    closed_connections = c;
+    active_connections--;
+}
+
+static void reactor_free_closed(void)
+{
+    while (closed_connections)
+    {
+        struct connection *c = closed_connections;
+        closed_connections = c->next_closed;
+        free(c);
+    }
+}
+
+// Vollständige Zeilen (bzw. Rohdaten von SEND <bytes>) aus dem Eingabepuffer an die State-Machine geben.
+// Rückgabe: Anzahl verarbeiteter Eingaben
+static int connection_process_input(struct connection *c)
+{
+    int processed = 0;
+    while (!c->closing && ob_pending(&c->session.out) < REACTOR_OUT_HIGH_WATER && session_accepts_input(&c->session))
+    {
+        int rc = session_feed_input(&c->session, &c->reader);
+        if (rc == 0) break;
+        if (rc < 0) c->closing = 1;
+        processed++;
+    }
+    return processed;
+}
+
+// Liest bis EAGAIN (edge-triggered) und verarbeitet dabei laufend Zeilen,
+// damit der Eingabepuffer nie über LR_BUFFER_SIZE wächst.
+static int connection_pump(struct connection *c)
+{
+    while (1)
+    {
+        connection_process_input(c);
+        if (session_flush(&c->session) < 0) return -1;
+
+        if (c->closing) return ob_pending(&c->session.out) == 0 ? -1 : 0;
+        if (ob_pending(&c->session.out) >= REACTOR_OUT_HIGH_WATER) return 0; // Warten auf EPOLLOUT
+        if (!session_accepts_input(&c->session)) return 0;                   // Group Commit, Login oder EPOLLOUT (Dateigrenze)
+        // Was eine Grenze zurückgehalten hat und nach dem Flush wieder geht, zuerst
+        // abarbeiten: sonst fehlt bei leerem Socket das Event, das es wieder anstößt
+        if (connection_process_input(c) > 0) continue;
+        if (c->peer_eof) return ob_pending(&c->session.out) == 0 ? -1 : 0; // Antworten noch zustellen
+
+        ssize_t n = lr_fill(&c->reader);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                lr_shrink(&c->reader);
+                return 0;
+            }
+            return -1;
+        }
+        if (n == 0)
+        {
+            c->peer_eof = 1; // Restliche Zeilen noch verarbeiten
+        }
+    }
+}
+
+// Nicht-blockierender TLS-Handshake, weiter bei EPOLLIN/EPOLLOUT (edge-triggered)
+// 1 = fertig, 0 = Socket nicht bereit, -1 = Verbindung schließen
+static int connection_handshake(struct connection *c)
+{
+    int rc = tls_handshake(c->handshake);
+    if (rc < 0)
+    {
+        log_warn("[Client %d] TLS: %s", c->session.id, tls_last_error());
+        return -1;
+    }
+    if (rc == 0) return 0;
+
+    session_start_tls(&c->session, &c->reader, c->handshake);
+    c->handshake = NULL;
+    return 1;
+}
+
+// Wartet die Session nach dem Pumpen auf den Group Commit oder auf LDAP?
+static void connection_park(int epoll_fd, struct connection *c)
+{
+    if (c->session.state == STATE_SEND_COMMIT && !c->commit_queued) queue_commit(c);
+    else if (c->session.state == STATE_LOGIN_AUTH && !c->login_queued) queue_login(epoll_fd, c);
+}
+
+// Laufende Logins abfragen: Antworten abholen, Timeouts auslösen.
+// auth()->poll() blockiert nie, langsame Directories bremsen nur ihre eigenen Logins.
+static void reactor_poll_logins(int epoll_fd)
+{
+    if (login_count == 0) return;
+
+    int count = login_count;
+    struct connection **snapshot = malloc(count * sizeof(*snapshot));
+    if (!snapshot) return;
+    memcpy(snapshot, pending_logins, count * sizeof(*snapshot));
+
+    for (int i = 0; i < count; i++)
+    {
+        struct connection *c = snapshot[i];
+        if (!session_poll_login(&c->session)) c->closing = 1; // Blacklist nach zu vielen Fehlversuchen
+
+        if (c->session.state == STATE_LOGIN_AUTH)
+        {
+            // Nach einem Verbindungsabbruch kann der Bind auf einem neuen Socket laufen
+            if (auth()->fd(&c->session.auth) != c->ldap.fd)
+            {
+                unqueue_login(epoll_fd, c);
+                queue_login(epoll_fd, c);
+            }
+            continue;
+        }
+
+        unqueue_login(epoll_fd, c);
+        if (connection_pump(c) < 0) connection_close(epoll_fd, c);
+        else connection_park(epoll_fd, c);
+    }
+    free(snapshot);
+}
+
+// Wie lange epoll_wait() höchstens schlafen darf (-1 = unbegrenzt)
+static int reactor_timeout(void)
+{
+    long timeout = -1;
+    for (int i = 0; i < login_count; i++)
+    {
+        struct connection *c = pending_logins[i];
+        long remaining = c->ldap.fd < 0 ? REACTOR_LDAP_POLL_MS : auth()->remaining_ms(&c->session.auth);
+        if (timeout < 0 || remaining < timeout) timeout = remaining;
+    }
+    return (int)timeout;
+}
+
+// Alle in dieser Runde abgeschlossenen SENDs teilen sich einen Sync
+static void reactor_commit_pending(int epoll_fd)
+{
+    if (pending_count == 0) return;
+
+    struct session *sessions[REACTOR_MAX_EVENTS];
+    while (pending_count > 0)
+    {
+        int batch = pending_count < REACTOR_MAX_EVENTS ? pending_count : REACTOR_MAX_EVENTS;
+        for (int i = 0; i < batch; i++) sessions[i] = &pending_commits[i]->session;
+        session_commit_group(sessions, batch);
+
+        struct connection *committed[REACTOR_MAX_EVENTS];
+        memcpy(committed, pending_commits, batch * sizeof(committed[0]));
+        pending_count -= batch;
+        memmove(pending_commits, pending_commits + batch, pending_count * sizeof(pending_commits[0]));
+
+        // Antwort senden und bereits gepufferte Commands weiterverarbeiten
+        for (int i = 0; i < batch; i++)
+        {
+            struct connection *c = committed[i];
+            c->commit_queued = 0;
+            if (connection_pump(c) < 0) connection_close(epoll_fd, c);
+            else connection_park(epoll_fd, c);
+        }
+    }
+}
+
+static void reactor_accept(int epoll_fd, int server_socket, const char *mail_dir)
+{
+    while (1)
+    {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_socket = accept4(server_socket, (struct sockaddr*)&client_addr, &client_len,
+                                    SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_socket < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) log_error("accept: %s", strerror(errno));
+            return;
+        }
+
+        char client_ip[INET6_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
+        log_info("[Client %d] Connected from IP: %s", client_socket, client_ip);
+
+        //BLACKLIST CHECK
+        if (blacklist_contains(client_ip))
+        {
+            log_warn("[Client %d] IP %s is BLACKLISTED → terminating connection.", client_socket, client_ip);
+            metrics_count_connection(0);
+            write(client_socket, "ERR\n", 4);
+            close(client_socket);
+            continue;
+        }
+        if (!ratelimit_allow(RL_CONNECT, client_ip, NULL, 1))
+        {
+            metrics_count_connection(0);
+            write(client_socket, "ERR\n", 4);
+            close(client_socket);
+            continue;
+        }
+        if (connection_limit > 0 && active_connections >= connection_limit)
+        {
+            log_warn("[Client %d] Verbindungslimit (%d) erreicht → terminating connection.", client_socket, connection_limit);
+            metrics_count_connection(0);
+            write(client_socket, "ERR\n", 4);
+            close(client_socket);
+            continue;
+        }
+
+        struct connection *c = calloc(1, sizeof(*c));
+        if (!c)
+        {
+            close(client_socket);
+            continue;
+        }
+        // Antworten werden ohnehin pro Command gebündelt, Nagle würde nur verzögern
+        int nodelay = 1;
+        setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+        c->source = SOURCE_CLIENT;
+        c->ldap.source = SOURCE_LDAP;
+        c->ldap.connection = c;
+        c->ldap.fd = -1;
+        session_init(&c->session, client_socket, client_socket, client_ip, mail_dir, 1);
+        lr_init(&c->reader, client_socket, LINE_LEN);
+        if (tls_server_enabled() && !(c->handshake = tls_server_new(client_socket)))
+        {
+            log_error("[Client %d] TLS: %s", client_socket, tls_last_error());
+            session_cleanup(&c->session);
+            close(client_socket);
+            free(c);
+            continue;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &ev) < 0)
+        {
+            log_error("epoll_ctl: %s", strerror(errno));
+            tls_free(c->handshake);
+            session_cleanup(&c->session);
+            close(client_socket);
+            free(c);
+            continue;
+        }
+        active_connections++;
+        metrics_count_connection(1);
+    }
+}
+
+int reactor_run(int server_socket, const char *mail_dir, int max_connections)
+{
+    connection_limit = max_connections;
+
+    int flags = fcntl(server_socket, F_GETFL, 0);
+    fcntl(server_socket, F_SETFL, flags | O_NONBLOCK);
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+    {
+        log_error("epoll_create1: %s", strerror(errno));
+        return 1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // NULL = Listen-Socket
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &ev) < 0)
+    {
+        log_error("epoll_ctl: %s", strerror(errno));
+        close(epoll_fd);
+        return 1;
+    }
+
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    while (1)
+    {
+        if (auth_reload_requested() && auth()->reload) auth()->reload(); // SIGHUP
+
+        int ready = epoll_wait(epoll_fd, events, REACTOR_MAX_EVENTS, reactor_timeout());
+        if (ready < 0)
+        {
+            if (errno == EINTR) continue;
+            log_error("epoll_wait: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < ready; i++)
+        {
+            enum reactor_source *source = events[i].data.ptr;
+            if (!source)
+            {
+                reactor_accept(epoll_fd, server_socket, mail_dir);
+                continue;
+            }
+            if (*source == SOURCE_LDAP) continue; // Wird gesammelt in reactor_poll_logins() abgeholt
+
+            struct connection *c = (struct connection *)source;
+            if (c->closed) continue;
+
+            if (events[i].events & EPOLLERR)
+            {
+                connection_close(epoll_fd, c);
+                continue;
+            }
+            if (c->handshake)
+            {
+                int rc = connection_handshake(c);
+                if (rc < 0) connection_close(epoll_fd, c);
+                if (rc <= 0) continue;
+            }
+            if (connection_pump(c) < 0)
+            {
+                connection_close(epoll_fd, c);
+            }
+            else
+            {
+                connection_park(epoll_fd, c);
+            }
+        }
+
+        reactor_poll_logins(epoll_fd);
+        reactor_commit_pending(epoll_fd);
+        reactor_free_closed();
+    }
+
+    close(epoll_fd);
+    return 1;
+}
@@ -0,0 +1,515 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "Headers/common.h"
+#include "Headers/mailbox.h"
+#include "Headers/delivery.h"
+#include "Headers/storage.h"
+#include "Headers/log.h"
+#include "Headers/compress.h"
+
+// Append-only Segment-Store: <user>/segments/<n>.seg
+// Jeder Eintrag besteht aus einem festen Header und den Nutzdaten (die
+// Nachricht im selben Textformat wie eine .msg Datei). DEL hängt einen
+// Tombstone an; alte Segmente werden vom Compactor umkopiert und gelöscht.
+
+#define SEGMENT_DIR "segments"
+#define SEGMENT_MAX_SIZE (64 * 1024 * 1024)     // Danach wird ein neues Segment begonnen
+#define SEGMENT_ENTRY_MAGIC 0x534D5754u         // "TWMS"
+
+enum segment_entry_type
+{
+    SEGMENT_MESSAGE = 1,
+    SEGMENT_TOMBSTONE = 2
+};
+
+struct segment_entry
+{
+    uint32_t magic;
+    uint32_t type;
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t length;    // Nutzdaten nach dem Header
+};
+
+// Ein Fund beim Durchlaufen der Segmente, für die Auflösung von Duplikaten
+struct segment_hit
+{
+    struct mail_index_record record;
+    uint64_t sequence;      // Position im Log: spätere Einträge gewinnen
+    uint32_t type;
+};
+
+static void segment_dir(char *path, size_t size, const char *mail_dir, const char *user)
+{
+    snprintf(path, size, "%s/%s/%s", mail_dir, user, SEGMENT_DIR);
+}
+
+static void segment_path(char *path, size_t size, const char *mail_dir, const char *user, uint32_t number)
+{
+    snprintf(path, size, "%s/%s/%s/%08u.seg", mail_dir, user, SEGMENT_DIR, number);
+}
+
+// Sperrt den Segment-Store einer Mailbox exklusiv; Rückgabe ist der Lock-FD
+static int segment_lock(const char *mail_dir, const char *user)
+{
+    char dir_path[256];
+    segment_dir(dir_path, sizeof(dir_path), mail_dir, user);
+    if (mkdir(dir_path, 0700) < 0 && errno != EEXIST) return -1;
+
+    int fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    if (flock(fd, LOCK_EX) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t ua = *(const uint32_t *)a;
+    uint32_t ub = *(const uint32_t *)b;
+    return (ua > ub) - (ua < ub);
+}
+
+// Aufsteigend sortierte Segmentnummern; Aufrufer gibt *out frei
+static int segment_list(const char *mail_dir, const char *user, uint32_t **out, int *count)
+{
+    char dir_path[256];
+    segment_dir(dir_path, sizeof(dir_path), mail_dir, user);
+
+    *out = NULL;
+    *count = 0;
+    DIR *folder = opendir(dir_path);
+    if (!folder) return 1; // Noch keine Segmente
+
+    int capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(folder)) != NULL)
+    {
+        if (!strstr(entry->d_name, ".seg")) continue;
+        if (*count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            uint32_t *grown = realloc(*out, capacity * sizeof(uint32_t));
+            if (!grown)
+            {
+                closedir(folder);
+                free(*out);
+                *out = NULL;
+                return 0;
+            }
+            *out = grown;
+        }
+        (*out)[(*count)++] = (uint32_t)strtoul(entry->d_name, NULL, 10);
+    }
+    closedir(folder);
+
+    qsort(*out, *count, sizeof(uint32_t), compare_u32);
+    return 1;
+}
+
+static int copy_range(int src_fd, off_t src_offset, int dst_fd, off_t dst_offset, size_t length)
+{
+    loff_t in_offset = src_offset;
+    loff_t out_offset = dst_offset;
+    while (length > 0)
+    {
+        ssize_t n = copy_file_range(src_fd, &in_offset, dst_fd, &out_offset, length, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        length -= n;
+    }
+    return 1;
+}
+
+// Hängt einen Eintrag an das aktive Segment an (Aufrufer hält segment_lock)
+static int segment_append(const char *mail_dir, const char *user, uint32_t type, uint32_t id,
+                          int src_fd, off_t src_offset, uint64_t length,
+                          uint32_t *out_segment, uint64_t *out_offset)
+{
+    uint32_t *numbers;
+    int count;
+    if (!segment_list(mail_dir, user, &numbers, &count)) return 0;
+    uint32_t number = count > 0 ? numbers[count - 1] : 1;
+    free(numbers);
+
+    char path[256];
+    segment_path(path, sizeof(path), mail_dir, user, number);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    int created = st.st_size == 0;
+    if (st.st_size + sizeof(struct segment_entry) + length > SEGMENT_MAX_SIZE && st.st_size > 0)
+    {
+        // Aktives Segment ist voll: neues beginnen
+        close(fd);
+        number++;
+        segment_path(path, sizeof(path), mail_dir, user, number);
+        fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0 || fstat(fd, &st) < 0)
+        {
+            if (fd >= 0) close(fd);
+            return 0;
+        }
+        created = 1;
+    }
+
+    struct segment_entry entry = { SEGMENT_ENTRY_MAGIC, type, id, 0, length };
+    off_t position = st.st_size;
+    int ok = pwrite(fd, &entry, sizeof(entry), position) == (ssize_t)sizeof(entry);
+    if (ok && length > 0) ok = copy_range(src_fd, src_offset, fd, position + sizeof(entry), length);
+    if (!ok && ftruncate(fd, position) < 0) ok = 0; // Halben Eintrag wieder abschneiden
+
+    if (ok && delivery_sync_mode() == SYNC_FSYNC)
+    {
+        ok = fdatasync(fd) == 0;
+        if (created)
+        {
+            char dir_path[256];
+            segment_dir(dir_path, sizeof(dir_path), mail_dir, user);
+            int dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dir_fd >= 0)
+            {
+                fsync(dir_fd);
+                close(dir_fd);
+            }
+        }
+    }
+    close(fd);
+
+    if (ok)
+    {
+        *out_segment = number;
+        *out_offset = (uint64_t)position + sizeof(entry);
+    }
+    return ok;
+}
+
+// -=- Backend-Funktionen -=-
+
+static int segment_import(const char *mail_dir, const char *user, struct mail_index_record *record, int src_fd, off_t src_offset)
+{
+    int lock_fd = segment_lock(mail_dir, user);
+    if (lock_fd < 0) return 0;
+
+    int ok = segment_append(mail_dir, user, SEGMENT_MESSAGE, record->id, src_fd, src_offset,
+                            record->size, &record->segment, &record->offset);
+    close(lock_fd);
+    return ok;
+}
+
+static int segment_publish(struct mail_delivery *d)
+{
+    int tmp_fd = open(d->tmp_path, O_RDONLY | O_CLOEXEC);
+    if (tmp_fd < 0) return 0;
+
+    int ok = segment_import(d->mail_dir, d->user, &d->record, tmp_fd, 0);
+    close(tmp_fd);
+    if (!ok) return 0;
+
+    unlink(d->tmp_path);
+    d->tmp_path[0] = '\0';
+    return 1;
+}
+
+static int segment_open_message(const char *mail_dir, const char *user, const struct mail_index_record *record, struct message_ref *out)
+{
+    char path[256];
+    segment_path(path, sizeof(path), mail_dir, user, record->segment);
+
+    out->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (out->fd < 0) return 0;
+    out->offset = (off_t)record->offset;
+    out->length = (size_t)record->size;
+    return 1;
+}
+
+static int segment_remove_message(const char *mail_dir, const char *user, const struct mail_index_record *record)
+{
+    int lock_fd = segment_lock(mail_dir, user);
+    if (lock_fd < 0) return 0;
+
+    uint32_t segment;
+    uint64_t offset;
+    int ok = segment_append(mail_dir, user, SEGMENT_TOMBSTONE, record->id, -1, 0, 0, &segment, &offset);
+    close(lock_fd);
+    return ok;
+}
+
+static int compare_hits(const void *a, const void *b)
+{
+    const struct segment_hit *ha = a;
+    const struct segment_hit *hb = b;
+    if (ha->record.id != hb->record.id) return (ha->record.id > hb->record.id) - (ha->record.id < hb->record.id);
+    return (ha->sequence > hb->sequence) - (ha->sequence < hb->sequence);
+}
+
+// Liest alle gültigen Einträge eines Segments. Rückgabe: Länge des gültigen Teils
+static off_t segment_read_entries(const char *path, uint32_t number, int with_headers,
+                                  struct segment_hit **hits, size_t *count, size_t *capacity, uint64_t *sequence)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    off_t position = 0;
+    struct segment_entry entry;
+    while (position + (off_t)sizeof(entry) <= st.st_size &&
+           pread(fd, &entry, sizeof(entry), position) == (ssize_t)sizeof(entry))
+    {
+        off_t data = position + sizeof(entry);
+        if (entry.magic != SEGMENT_ENTRY_MAGIC || data + (off_t)entry.length > st.st_size) break;
+
+        if (hits)
+        {
+            if (*count == *capacity)
+            {
+                *capacity = *capacity ? *capacity * 2 : 256;
+                struct segment_hit *grown = realloc(*hits, *capacity * sizeof(**hits));
+                if (!grown) break;
+                *hits = grown;
+            }
+
+            struct segment_hit *hit = &(*hits)[(*count)++];
+            memset(hit, 0, sizeof(*hit));
+            hit->type = entry.type;
+            hit->sequence = (*sequence)++;
+            hit->record.id = entry.id;
+            hit->record.segment = number;
+            hit->record.offset = (uint64_t)data;
+            hit->record.size = entry.length;
+
+            if (with_headers && entry.type == SEGMENT_MESSAGE)
+            {
+                char peek[MESSAGE_HEADER_MAX];
+                size_t want = entry.length < sizeof(peek) ? entry.length : sizeof(peek);
+                ssize_t n = pread(fd, peek, want, data);
+                if (n > 0) parse_message_header(peek, (size_t)n, &hit->record);
+            }
+        }
+        position = data + entry.length;
+    }
+
+    close(fd);
+    return position;
+}
+
+static int segment_scan(const char *mail_dir, const char *user, int with_headers, storage_scan_fn visit, void *ctx)
+{
+    uint32_t *numbers;
+    int segment_count;
+    if (!segment_list(mail_dir, user, &numbers, &segment_count)) return 0;
+
+    struct segment_hit *hits = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    uint64_t sequence = 0;
+    for (int i = 0; i < segment_count; i++)
+    {
+        char path[256];
+        segment_path(path, sizeof(path), mail_dir, user, numbers[i]);
+        segment_read_entries(path, numbers[i], with_headers, &hits, &count, &capacity, &sequence);
+    }
+    free(numbers);
+
+    // Pro id gewinnt der letzte Eintrag im Log, ein Tombstone löscht die id ganz
+    qsort(hits, count, sizeof(*hits), compare_hits);
+    size_t i = 0;
+    int stop = 0;
+    while (i < count && !stop)
+    {
+        size_t last = i;
+        int deleted = 0;
+        while (last < count && hits[last].record.id == hits[i].record.id)
+        {
+            if (hits[last].type == SEGMENT_TOMBSTONE) deleted = 1;
+            last++;
+        }
+        if (!deleted) stop = visit(&hits[last - 1].record, ctx) != 0;
+        i = last;
+    }
+
+    free(hits);
+    return 1;
+}
+
+static void segment_recover(const char *mail_dir, const char *user)
+{
+    int lock_fd = segment_lock(mail_dir, user);
+    if (lock_fd < 0) return;
+
+    uint32_t *numbers;
+    int count;
+    if (segment_list(mail_dir, user, &numbers, &count))
+    {
+        for (int i = 0; i < count; i++)
+        {
+            char path[256];
+            segment_path(path, sizeof(path), mail_dir, user, numbers[i]);
+
+            // Abgebrochener Append am Ende: auf den letzten gültigen Eintrag kürzen
+            uint64_t sequence = 0;
+            off_t valid = segment_read_entries(path, numbers[i], 0, NULL, NULL, NULL, &sequence);
+            struct stat st;
+            if (stat(path, &st) == 0 && st.st_size > valid && truncate(path, valid) == 0)
+            {
+                log_warn("Segment %s auf %lld Bytes gekürzt", path, (long long)valid);
+            }
+        }
+        free(numbers);
+    }
+    close(lock_fd);
+}
+
+// -=- Kompaktierung -=-
+
+struct compact_context
+{
+    uint32_t active;            // Segmente < active werden umkopiert
+    struct mail_index_record *live;
+    size_t count;
+    size_t capacity;
+};
+
+static int collect_sealed(const struct mail_index_record *record, uint32_t total, void *ctx)
+{
+    struct compact_context *compact = ctx;
+    (void)total;
+    if (record->segment >= compact->active) return 0;
+
+    if (compact->count == compact->capacity)
+    {
+        compact->capacity = compact->capacity ? compact->capacity * 2 : 256;
+        struct mail_index_record *grown = realloc(compact->live, compact->capacity * sizeof(*grown));
+        if (!grown) return 1;
+        compact->live = grown;
+    }
+    compact->live[compact->count++] = *record;
+    return 0;
+}
+
+static void segment_compact(const char *mail_dir, const char *user)
+{
+    int lock_fd = segment_lock(mail_dir, user);
+    if (lock_fd < 0) return;
+
+    uint32_t *numbers;
+    int segment_count;
+    if (!segment_list(mail_dir, user, &numbers, &segment_count) || segment_count < 2)
+    {
+        free(numbers);
+        close(lock_fd);
+        return;
+    }
+
+    // Nur abgeschlossene Segmente (alle außer dem aktiven) kommen in Frage
+    struct compact_context compact = { numbers[segment_count - 1], NULL, 0, 0 };
+    uint64_t sealed_bytes = 0;
+    int recent = 0;
+    for (int i = 0; i < segment_count - 1; i++)
+    {
+        char path[256];
+        struct stat st;
+        segment_path(path, sizeof(path), mail_dir, user, numbers[i]);
+        if (stat(path, &st) < 0) continue;
+        sealed_bytes += (uint64_t)st.st_size;
+
+        // Gerade erst abgeschlossen: eine Zustellung könnte noch auf ihren Index-Eintrag warten
+        if (st.st_mtime + STORAGE_COMPACT_INTERVAL > time(NULL)) recent = 1;
+    }
+
+    mailbox_index_foreach(mail_dir, user, collect_sealed, &compact);
+    uint64_t live_bytes = 0;
+    for (size_t i = 0; i < compact.count; i++) live_bytes += compact.live[i].size + sizeof(struct segment_entry);
+
+    // Erst ab mehr als 50% Müll lohnt sich das Umkopieren
+    if (!recent && live_bytes * 2 < sealed_bytes)
+    {
+        int ok = 1;
+        for (size_t i = 0; ok && i < compact.count; i++)
+        {
+            struct mail_index_record *record = &compact.live[i];
+            char path[256];
+            segment_path(path, sizeof(path), mail_dir, user, record->segment);
+            int src_fd = open(path, O_RDONLY | O_CLOEXEC);
+            ok = src_fd >= 0 &&
+                 segment_append(mail_dir, user, SEGMENT_MESSAGE, record->id, src_fd, (off_t)record->offset,
+                                record->size, &record->segment, &record->offset);
+            if (src_fd >= 0) close(src_fd);
+        }
+
+        // Index erst umbiegen, wenn alle Kopien geschrieben sind; dann die alten Segmente löschen
+        if (ok && mailbox_index_relocate(mail_dir, user, compact.live, (int)compact.count))
+        {
+            for (int i = 0; i < segment_count - 1; i++)
+            {
+                char path[256];
+                segment_path(path, sizeof(path), mail_dir, user, numbers[i]);
+                unlink(path);
+            }
+            log_info("[Compactor] %s: %d Segmente kompaktiert (%llu -> %llu Bytes)", user, segment_count - 1,
+                     (unsigned long long)sealed_bytes, (unsigned long long)live_bytes);
+        }
+    }
+
+    free(compact.live);
+    free(numbers);
+    close(lock_fd);
+}
+
+static void segment_destroy(const char *mail_dir, const char *user)
+{
+    uint32_t *numbers;
+    int count;
+    if (!segment_list(mail_dir, user, &numbers, &count)) return;
+
+    for (int i = 0; i < count; i++)
+    {
+        char path[256];
+        segment_path(path, sizeof(path), mail_dir, user, numbers[i]);
+        unlink(path);
+    }
+    free(numbers);
+
+    char dir_path[256];
+    segment_dir(dir_path, sizeof(dir_path), mail_dir, user);
+    rmdir(dir_path);
+}
+
+const struct storage_backend segment_storage =
+{
+    .name = "segment",
+    .publish = segment_publish,
+    .import = segment_import,
+    .open_message = segment_open_message,
+    .remove_message = segment_remove_message,
+    .scan = segment_scan,
+    .recover = segment_recover,
+    .compact = segment_compact,
+    .destroy = segment_destroy,
+};
@@ -1,81 +1,41 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
+#include <limits.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <time.h>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <signal.h>
 #include "Headers/common.h" // Gemeine Definitionen
-#define LDAP_DEPRECATED 1
-#include <ldap.h>
-
-#define LDAP_URI     "ldap://ldap.technikum-wien.at:389"
-#define LDAP_BASE_DN "dc=technikum-wien,dc=at"
-
-#define BLACKLIST_FILE "blacklist.txt"
-#define BLACKLIST_DURATION 60
-
-int is_ip_blacklisted(const char *ip) {
-    FILE *f = fopen(BLACKLIST_FILE, "r");
-    if (!f) return 0;
-
-    char file_ip[64];
-    long until = 0;
-    long now = time(NULL);
-
-    while (fscanf(f, "%63s %ld", file_ip, &until) == 2) {
-        if (strcmp(file_ip, ip) == 0) {
-            if (now < until) {
-                fclose(f);
-                return 1;  // IP ist noch gesperrt
-            }
-        }
-    }
-
-    fclose(f);
-    return 0;
-}
-
-void add_ip_to_blacklist(const char *ip) {
-    FILE *f = fopen(BLACKLIST_FILE, "a");
-    if (!f) return;
-
-    long until = time(NULL) + BLACKLIST_DURATION;
-
-    fprintf(f, "%s %ld\n", ip, until);
-    fclose(f);
-
-    printf("[SERVER] Added IP %s to blacklist for %d seconds.\n",
-           ip, BLACKLIST_DURATION);
-}
+#include "Headers/server.h"
+#include "Headers/reactor.h"
+#include "Headers/linereader.h"
+#include "Headers/outbuf.h"
+#include "Headers/mailbox.h"
+#include "Headers/delivery.h"
+#include "Headers/storage.h"
+#include "Headers/auth.h"
+#include "Headers/ldapauth.h"
+#include "Headers/htpasswd.h"
+#include "Headers/blacklist.h"
+#include "Headers/ratelimit.h"
+#include "Headers/prefork.h"
+#include "Headers/log.h"
+#include "Headers/metrics.h"
+#include "Headers/tls.h"
+#include "Headers/compress.h"
 
 // -=- Hilf-Methoden (File IO / String) -=-
 
-int read_complete_line(int sock, char* buffer, int max_size) // Liest eine Zeile und überprüft, dass sie korrekt verarbeitet wird.
-{
-    int bytes_read = 0;
-    char c;
-    
-    while (bytes_read < max_size - 1) 
-    {
-        int n = read(sock, &c, 1);
-        if (n <= 0) 
-        {
-            return -1; // Fehler oder Verbindung geschlossen
-        }
-        if (c == '\n') break; // Zeilenende
-        buffer[bytes_read++] = c;
-    }
-    buffer[bytes_read] = '\0';
-    return bytes_read;
-}
-
 int is_username_valid(const char* username)
 {
     if(!username || strlen(username) > USER_LEN || strlen(username) == 0) return 0;
@@ -103,618 +63,1672 @@ int create_user_folder(const char* username, const char* mail_dir)
     return 1; // Erfolg
 }
 
-int count_user_messages(const char* username, const char* mail_dir) 
-{
-    char folder_path[256];
-    snprintf(folder_path, sizeof(folder_path), "%s/%s", mail_dir, username);
-    
-    DIR* folder = opendir(folder_path);
-    if (!folder) 
-    {
-        return 0; // Keine Nachrichten
-    }
-    
-    int message_count = 0;
-    struct dirent* entry;
-    
-    while ((entry = readdir(folder)) != NULL) 
-    {
-        if (strstr(entry->d_name, ".msg")) 
-        {
-            message_count++;
-        }
-    }
-    
-    closedir(folder);
-    return message_count;
-}
+// -=- Antwort-Ausgabe -=-
 
-int compare_filenames_numerically(const void *a, const void *b)
+// COMPRESS: "OK" ist unkomprimiert draußen, ab jetzt läuft alles durch deflate.
+// Was der Client schon nachgeschickt hat, ist bereits komprimiert: es geht aus
+// dem Line Reader in den Entpacker.
+static int session_start_compress(struct session *s)
 {
-    const char *filename_a = *(const char**)a;
-    const char *filename_b = *(const char**)b;
-
-    return atoi(filename_a) - atoi(filename_b);
+    struct line_reader *reader = s->wire_reader;
+    char *pending = NULL;
+    size_t pending_len = lr_take(reader, lr_pending(reader), &pending);
+
+    s->wire = wire_compress_new(s->sock, reader->read_fn, reader->read_ctx,
+                                s->out.write_fn, s->out.write_ctx, pending, pending_len);
+    if (!s->wire) return 0;
+    lr_set_source(reader, wire_read, s->wire);
+    ob_set_writer(&s->out, wire_write, s->wire);
+    s->wire_reader = NULL;
+    s->state = STATE_COMMAND;
+    log_debug("[Client %d] Verbindung komprimiert (deflate)", s->id);
+    return 1;
 }
 
-char **get_sorted_messages(const char *username, const char* mail_dir, int *out_msg_count)
+int session_flush(struct session *s)
 {
-    *out_msg_count = 0;
-
-    char folder_path[256];
-    snprintf(folder_path, sizeof(folder_path), "%s/%s", mail_dir, username);
-
-    DIR *folder = opendir(folder_path);
-    if(!folder)
+    int rc = 0;
+    if (ob_pending(&s->out) > 0)
     {
-        return NULL;
+        uint64_t start = metrics_now();
+        rc = ob_flush(&s->out);
+        metrics_observe_phase(PHASE_SOCKET_WRITE, start);
     }
 
-    int count = 0;
-    struct dirent *entry;
-    while((entry = readdir(folder)) != NULL)
-    {
-        if(strstr(entry->d_name, ".msg"))
-        {
-            count++;
-        }
-    }
+    if (rc == 0 && s->state == STATE_COMPRESS_START && !session_start_compress(s)) rc = -1;
+    return rc;
+}
 
-    if(count == 0)
-    {
-        closedir(folder);
-        return NULL;
-    }
+void session_write(struct session *s, const char *data, size_t len)
+{
+    ob_append(&s->out, data, len);
 
-    char **filenames = malloc(count *sizeof(char*));
-    if(!filenames)
+    // Große Antworten (READ) im blockierenden Modus nicht komplett puffern
+    if (!s->nonblocking && ob_pending(&s->out) >= OB_FLUSH_THRESHOLD)
     {
-        closedir(folder);
-        return NULL;
+        session_flush(s);
     }
+}
+
+// Übernimmt fd: der Inhalt wird beim Flush per sendfile() gesendet
+static void session_write_file(struct session *s, int fd, off_t offset, size_t len)
+{
+    ob_append_file(&s->out, fd, offset, len);
 
-    rewinddir(folder);
-    int i = 0;
-    while((entry = readdir(folder)) != NULL)
+    if (!s->nonblocking && (ob_pending(&s->out) >= OB_FLUSH_THRESHOLD || ob_open_chunks(&s->out) >= SESSION_MAX_OPEN_CHUNKS))
     {
-        if(strstr(entry->d_name, ".msg"))
-        {
-            filenames[i] = strdup(entry->d_name);
-            if(!filenames[i])
-            {
-                for(int j = 0; j < i; j++) free(filenames[j]);
-                free(filenames);
-                closedir(folder);
-                return NULL;
-            }
-            i++;
-        }
+        session_flush(s);
     }
-    closedir(folder);
+}
 
-    qsort(filenames, count, sizeof(char*), compare_filenames_numerically);
+static void session_reply(struct session *s, const char *response)
+{
+    session_write(s, response, strlen(response));
+    session_write(s, "\n", 1);
+}
 
-    *out_msg_count = count;
-    return filenames;
+static void session_reply_error(struct session *s)
+{
+    s->command_failed = 1;
+    session_reply(s, RESP_ERR);
 }
 
-void free_sorted_messages(char** filenames, int count) 
+// Command ist fertig beantwortet, sobald die State-Machine wieder auf ein Command wartet
+static void session_command_done(struct session *s)
 {
-    if (filenames) 
-    {
-        for (int i = 0; i < count; i++) 
-        {
-            free(filenames[i]); 
-        }
-        free(filenames); 
-    }
+    if (s->metric_command == METRIC_NONE || s->state != STATE_COMMAND) return;
+
+    metrics_observe_command(s->metric_command, s->command_start, s->command_failed);
+    s->metric_command = METRIC_NONE;
 }
 
-// -=- LDAP Authentifizierung -=-
-int ldap_authenticate(const char *username, const char *password)
+// -=- Command Handler -=-
+
+// LOGIN abschließen: Antwort senden, Fehlversuche zählen. 0 = Verbindung schließen
+static int finish_login(struct session *s, int authenticated)
 {
-    printf("=== LDAP AUTH ===\n");
-    printf("Username: '%s'\n", username ? username : "(null)");
-    printf("Password length: %zu\n", password ? strlen(password) : 0);
+    metrics_observe_phase(PHASE_AUTH, s->auth_start);
+    s->auth_start = 0;
 
-    if (!username || !password || strlen(username) == 0 || strlen(password) == 0) {
-        printf("LDAP: empty username or password\n");
-        return 0;
+    if (authenticated)
+    {
+        strcpy(s->session_user, s->login_user);
+        session_reply(s, RESP_OK);
+        s->is_logged_in = 1;
+        s->failed_attempts = 0; // Reset bei Erfolg
+        log_info("[Client %d] User %s logged in.", s->id, s->session_user);
+        return 1;
     }
 
-    LDAP *ld = NULL;
-    int rc = ldap_initialize(&ld, LDAP_URI);
-    printf("LDAP initialize: %s\n", ldap_err2string(rc));
-    if (rc != LDAP_SUCCESS || !ld) {
+    session_reply_error(s);
+    s->failed_attempts++;
+    log_warn("[Client %d] Login failed (%d/%d).", s->id, s->failed_attempts, MAX_LOGIN_ATTEMPTS);
+    if (s->failed_attempts >= MAX_LOGIN_ATTEMPTS)
+    {
+        blacklist_add(s->client_ip);
+        log_warn("[Client %d] BLACKLISTED: %s", s->id, s->client_ip);
         return 0;
     }
+    return 1;
+}
 
-    // LDAP Optionen setzen
-    int version = LDAP_VERSION3;
-    ldap_set_option(ld, LDAP_OPT_PROTOCOL_VERSION, &version);
-    ldap_set_option(ld, LDAP_OPT_REFERRALS, LDAP_OPT_OFF);
-
-    // TLS starten
-    rc = ldap_start_tls_s(ld, NULL, NULL);
-    printf("LDAP start_tls: %s\n", ldap_err2string(rc));
-    if (rc != LDAP_SUCCESS) {
-        ldap_unbind_ext_s(ld, NULL, NULL);
-        return 0;
+int handle_login(struct session *s, const char *password)
+{
+    if(!is_username_valid(s->login_user))
+    {
+        return finish_login(s, 0);
     }
 
-    // DN konstruieren 
-    char user_dn[256];
-    snprintf(user_dn, sizeof(user_dn),
-             "uid=%s,ou=people,dc=technikum-wien,dc=at",
-             username);
-
-    printf("Binding with DN: %s\n", user_dn);
+    // Limit vor dem Anbieter prüfen: Brute Force soll das Directory nicht auslasten.
+    // Zählt nicht als Fehlversuch, der Client wird nur gebremst.
+    if (!ratelimit_allow(RL_LOGIN, s->client_ip, s->login_user, 1))
+    {
+        session_reply_error(s);
+        return 1;
+    }
 
-    // Simple SASL Bind (wie im Unterricht)
-    struct berval cred;
-    cred.bv_val = (char *)password;
-    cred.bv_len = strlen(password);
+    s->auth_start = metrics_now();
 
-    rc = ldap_sasl_bind_s(
-        ld,
-        user_dn,
-        LDAP_SASL_SIMPLE,
-        &cred,
-        NULL,
-        NULL,
-        NULL
-    );
+    // fork-Modus: der Prozess gehört ohnehin nur diesem Client
+    if (!s->nonblocking)
+    {
+        return finish_login(s, auth()->authenticate(s->login_user, password));
+    }
 
-    printf("LDAP bind result: %s\n", ldap_err2string(rc));
+    // epoll-Modus: Bind nur absenden, der Reactor meldet sich über session_poll_login()
+    enum auth_status status = auth()->start(&s->auth, s->login_user, password);
+    if (status == AUTH_PENDING)
+    {
+        s->state = STATE_LOGIN_AUTH;
+        return 1;
+    }
+    return finish_login(s, status == AUTH_OK);
+}
 
-    ldap_unbind_ext_s(ld, NULL, NULL);
+int session_poll_login(struct session *s)
+{
+    enum auth_status status = auth()->poll(&s->auth);
+    if (status == AUTH_PENDING) return 1;
 
-    return (rc == LDAP_SUCCESS);
+    s->state = STATE_COMMAND;
+    int keep_open = finish_login(s, status == AUTH_OK);
+    session_command_done(s);
+    return keep_open;
 }
 
-// -=- Command Handler -=-
+// Zustellungen des aktuellen SEND/MSEND verwerfen (nach dem Veröffentlichen nur aufräumen)
+static void deliveries_release(struct session *s)
+{
+    for (int i = 0; s->deliveries && i < s->receiver_count; i++) delivery_abort(&s->deliveries[i]);
+    if (s->deliveries != &s->delivery) free(s->deliveries);
+    s->deliveries = NULL;
+}
 
-int handle_login(int sock, char *out_username)
+// "anna,ben" → s->receivers ohne Duplikate; 0 = leerer Name, zu lang oder zu viele
+static int parse_receiver_list(struct session *s, const char *line)
 {
-    char ldap_user[LINE_LEN];
-    char ldap_pass[LINE_LEN];
+    int count = 0;
+    const char *p = line;
+    while (1)
+    {
+        const char *end = strchr(p, LIST_SEPARATOR);
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len == 0 || len > USER_LEN || count == MSEND_MAX_RECIPIENTS) return 0;
 
-    if(read_complete_line(sock, ldap_user, sizeof(ldap_user)) <= 0) return 0;
-    if(read_complete_line(sock, ldap_pass, sizeof(ldap_pass)) <= 0) return 0;
+        char name[USER_LEN + 1];
+        memcpy(name, p, len);
+        name[len] = '\0';
 
-    if(!is_username_valid(ldap_user))
-    {
-        write(sock, RESP_ERR, strlen(RESP_ERR));
-        write(sock, "\n", 1);
-        return 0;
-    }
+        int duplicate = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (strcmp(s->receivers[i], name) == 0) duplicate = 1;
+        }
+        if (!duplicate) strcpy(s->receivers[count++], name);
 
-      if (!ldap_authenticate(ldap_user, ldap_pass)) {
-        write(sock, RESP_ERR, strlen(RESP_ERR));
-        write(sock, "\n", 1);
-        return 0;
+        if (!end) return count;
+        p = end + 1;
     }
-
-    strcpy(out_username, ldap_user);
-    write(sock, RESP_OK, strlen(RESP_OK));
-    write(sock, "\n", 1);
-    return 1;
 }
 
-void process_send_command(int client_sock, const char *mail_dir, const char *session_user) 
+void begin_send_command(struct session *s)
 {
-    char receiver[USER_LEN + 2];
-    char subject[SUBJECT_LEN + 2];
-    char line_buffer[LINE_LEN];
+    s->send_valid = 1; // Flag only after connection is established
+    s->deliveries = NULL;
 
-    if(read_complete_line(client_sock, receiver, sizeof(receiver)) <= 0 ||
-       read_complete_line(client_sock, subject, sizeof(subject)) <= 0) return;
+    int receivers_valid = s->receiver_count > 0;
+    for (int i = 0; i < s->receiver_count; i++)
+    {
+        if (!is_username_valid(s->receivers[i])) receivers_valid = 0;
+    }
 
-    FILE* message_file = NULL; 
-    int is_valid = 1; // Flag only after connection is established
+    // Alle Empfänger stehen im Header jeder Kopie
+    char receiver_list[MSEND_MAX_RECIPIENTS * (USER_LEN + 1)] = "";
+    for (int i = 0; i < s->receiver_count; i++)
+    {
+        if (i > 0) strcat(receiver_list, ",");
+        strcat(receiver_list, s->receivers[i]);
+    }
 
     // validation
-    if (!is_username_valid(session_user) || !is_username_valid(receiver)) 
+    if (!s->is_logged_in)
+    {
+        s->send_valid = 0; // Body wird nur gelesen, danach ERR
+    }
+    else if (!is_username_valid(s->session_user) || !receivers_valid) 
     {
-        printf("Ungültiger Benutzername empfangen. Nachricht wird verworfen.\n");
-        is_valid = 0; 
+        log_warn("[Client %d] Ungültiger Benutzername empfangen. Nachricht wird verworfen.", s->id);
+        s->send_valid = 0; 
     } 
     else 
     {
-        printf("Neue Nachricht: %s -> %s [%s]\n", session_user, receiver, subject);
+        log_debug("[Client %d] Neue Nachricht: %s -> %s [%s]", s->id, s->session_user, receiver_list, s->subject);
     }
     
-    if (is_valid) 
+    if (s->send_valid && !ratelimit_allow(RL_SEND, s->client_ip, s->session_user, (uint32_t)s->receiver_count))
     {
-        if (!create_user_folder(receiver, mail_dir)) 
+        s->send_valid = 0; // Vor jedem Plattenzugriff ablehnen
+    }
+
+    if (s->send_valid)
+    {
+        s->deliveries = s->receiver_count == 1 ? &s->delivery : calloc(s->receiver_count, sizeof(*s->deliveries));
+        if (!s->deliveries) s->send_valid = 0;
+    }
+
+    for (int i = 0; s->send_valid && i < s->receiver_count; i++)
+    {
+        struct mail_delivery *d = &s->deliveries[i];
+        if (!create_user_folder(s->receivers[i], s->mail_dir)) 
         {
-            is_valid = 0; 
+            s->send_valid = 0; 
+            break;
         }
-        
-        if (is_valid) 
+
+        // Nachricht entsteht in <receiver>/tmp/ und wird erst nach dem Sync sichtbar.
+        // Weitere Empfänger bekommen einen Hardlink auf die Datei des ersten.
+        uint64_t start = metrics_now();
+        int begun = i == 0 ? delivery_begin(d, s->mail_dir, s->receivers[i])
+                           : delivery_begin_shared(d, s->mail_dir, s->receivers[i], &s->deliveries[0]);
+        metrics_observe_phase(PHASE_FILE_IO, start);
+        if (!begun) 
         {
-            int next_msg_number = count_user_messages(receiver, mail_dir) + 1;
-            char file_path[256];
-            snprintf(file_path, sizeof(file_path), "%s/%s/%d.msg", mail_dir, receiver, next_msg_number);
-            
-            message_file = fopen(file_path, "w");
-            if (!message_file) 
-            {
-                is_valid = 0; 
-            } 
-            else 
-            {
-                fprintf(message_file, "Sender: %s\n", session_user);
-                fprintf(message_file, "Receiver: %s\n", receiver);
-                fprintf(message_file, "Subject: %s\n", subject);
-                fprintf(message_file, "\n");
-                printf("Speichere Nachricht in: %s\n", file_path);
-            }
-        }
-    }
-    
-    while (1) 
-    {
-        if(read_complete_line(client_sock, line_buffer, sizeof(line_buffer)) < 0) return;
-        if(strcmp(line_buffer, ".") == 0) break;
+            s->send_valid = 0; 
+            break;
+        } 
 
-        if (is_valid && message_file) 
+        if (i == 0 && !delivery_write_header(d, s->session_user, receiver_list, s->subject))
         {
-            fprintf(message_file, "%s\n", line_buffer);
+            s->send_valid = 0;
+            break;
         }
+        log_debug("[Client %d] Speichere Nachricht %u für %s (Backend: %s)", s->id, d->record.id, s->receivers[i], storage()->name);
     }
-    
-    if (is_valid && message_file) 
-    {
-        fclose(message_file);
-        write(client_sock, RESP_OK, strlen(RESP_OK));
-        write(client_sock, "\n", 1);
-        printf("Nachricht erfolgreich gespeichert.\n");
-    } 
-    else 
+}
+
+// Eine Zeile des Nachrichtentexts: einmal empfangen, einmal schreiben
+static void send_body_line(struct session *s, const char *line)
+{
+    if (!s->send_valid) return;
+
+    if (!ratelimit_allow_split(RL_BYTES, s->client_ip, s->session_user, strlen(line) + 1))
     {
-        if (message_file) fclose(message_file);
-        write(client_sock, RESP_ERR, strlen(RESP_ERR));
-        write(client_sock, "\n", 1);
-        printf("Nachricht wurde verworfen (Fehler oder ungültiger User).\n");
+        deliveries_release(s); // Rest der Nachricht wird nur noch gelesen
+        s->send_valid = 0;
+        return;
     }
+    fprintf(s->deliveries[0].file, "%s\n", line);
 }
 
-void process_list_command(int client_sock, const char *mail_dir, const char *session_user) 
+// Sucht im Text mit Längenangabe eine Zeile "." (READ würde dort enden), auch über Chunk-Grenzen.
+// body_line_state: 0 = innerhalb einer Zeile, 1 = Zeilenanfang, 2 = Zeilenanfang + '.'
+static int body_has_dot_line(struct session *s, const char *data, size_t len)
 {
-    printf("Nachrichten auflisten für: %s\n", session_user);
-    
-    int message_count = 0;
-    char **sorted_files = get_sorted_messages(session_user, mail_dir, &message_count);
-    
-    // Anzahl an Client senden
-    char count_buffer[32];
-    snprintf(count_buffer, sizeof(count_buffer), "%d\n", message_count);
-    write(client_sock, count_buffer, strlen(count_buffer));
-    
-    printf("Gefunden: %d Nachrichten\n", message_count);
-    
-    if (message_count > 0 && sorted_files) 
+    const char *p = data;
+    const char *end = data + len;
+    while (p < end)
     {
-        char folder_path[256];
-        snprintf(folder_path, sizeof(folder_path), "%s/%s", mail_dir, session_user);
+        if (s->body_line_state == 2)
+        {
+            if (*p == '\n') return 1;
+            s->body_line_state = 0;
+        }
+        else if (s->body_line_state == 1)
+        {
+            s->body_line_state = *p == '.' ? 2 : *p == '\n' ? 1 : 0;
+            p++;
+            continue;
+        }
 
-        for (int i = 0; i < message_count; i++) 
+        // Rest der Zeile überspringen
+        const char *newline = memchr(p, '\n', end - p);
+        if (!newline)
         {
-            char file_path[512];
-            // Den sortierten Dateinamen verwenden
-            snprintf(file_path, sizeof(file_path), "%s/%s", folder_path, sorted_files[i]);
-            
-            FILE* message_file = fopen(file_path, "r");
-            if (message_file) 
-            {
-                char subject_line[SUBJECT_LEN + 50];
-                
-                fgets(subject_line, sizeof(subject_line), message_file); // Sender
-                fgets(subject_line, sizeof(subject_line), message_file); // Receiver
-                if (fgets(subject_line, sizeof(subject_line), message_file)) // Subject
-                { 
-                    if (strncmp(subject_line, "Subject: ", 9) == 0) 
-                    {
-                        char* pure_subject = subject_line + 9;
-                        char* newline_pos = strchr(pure_subject, '\n');
-                        if (newline_pos) *newline_pos = '\0';
-                        
-                        write(client_sock, pure_subject, strlen(pure_subject));
-                        write(client_sock, "\n", 1);
-                    }
-                }
-                fclose(message_file);
-            }
+            s->body_line_state = 0;
+            return 0;
         }
+        p = newline + 1;
+        s->body_line_state = 1;
     }
-    
-    free_sorted_messages(sorted_files, message_count);
+    return 0;
 }
 
-void process_read_command(int client_sock, const char *mail_dir, const char *session_user) 
+// Ein Block Rohdaten von SEND <bytes>: unverändert und ohne Zeilenpuffer in die Datei
+static void send_body_data(struct session *s, const char *data, size_t len)
 {
-    char msg_number_str[32];
-    int msg_number;
-    
-    if(read_complete_line(client_sock, msg_number_str, sizeof(msg_number_str)) <= 0)
+    if (!s->send_valid) return;
+
+    if (body_has_dot_line(s, data, len))
     {
-        write(client_sock, RESP_ERR, strlen(RESP_ERR));
-        write(client_sock, "\n", 1);
+        log_warn("[Client %d] Text enthält eine Zeile \".\", Nachricht wird verworfen.", s->id);
+        deliveries_release(s);
+        s->send_valid = 0;
         return;
     }
-    
-    msg_number = atoi(msg_number_str);
-    printf("Nachricht lesen: User=%s, Nr=%d\n", session_user, msg_number);
-    
-    int message_count = 0;
-    char** sorted_files = get_sorted_messages(session_user, mail_dir, &message_count);
-    
-    if (msg_number < 1 || msg_number > message_count || !sorted_files) 
+    // Blöcke sind bis zu einem Eingabepuffer groß, unabhängig von der Nachricht
+    if (!ratelimit_allow_split(RL_BYTES, s->client_ip, s->session_user, len))
     {
-        write(client_sock, RESP_ERR, strlen(RESP_ERR));
-        write(client_sock, "\n", 1);
-        free_sorted_messages(sorted_files, message_count);
+        deliveries_release(s);
+        s->send_valid = 0;
         return;
     }
-    
-    // Den korrekten Dateinamen aus der sortierten Liste holen
-    const char* filename_to_read = sorted_files[msg_number - 1];
-    
-    char file_path[256];
-    snprintf(file_path, sizeof(file_path), "%s/%s/%s", mail_dir, session_user, filename_to_read);
-    
-    FILE* message_file = fopen(file_path, "r");
-    if (!message_file) 
+    if (fwrite(data, 1, len, s->deliveries[0].file) != len)
     {
-        write(client_sock, RESP_ERR, strlen(RESP_ERR));
-        write(client_sock, "\n", 1);
-        free_sorted_messages(sorted_files, message_count);
-        return;
+        deliveries_release(s);
+        s->send_valid = 0;
     }
-    
-    // OK senden und Nachrichteninhalt übertragen
-    write(client_sock, RESP_OK, strlen(RESP_OK));
-    write(client_sock, "\n", 1);
-    
-    char file_buffer[LINE_LEN];
-    while (fgets(file_buffer, sizeof(file_buffer), message_file)) 
+}
+
+static void send_command_result(struct session *s, int stored)
+{
+    if (stored)
     {
-        write(client_sock, file_buffer, strlen(file_buffer));
+        session_reply(s, RESP_OK);
+        log_info("[Client %d] Nachricht für %s%s gespeichert.", s->id, s->receivers[0], s->receiver_count > 1 ? " u.a." : "");
+    }
+    else
+    {
+        session_reply_error(s);
+        log_warn("[Client %d] Nachricht wurde verworfen (Fehler oder ungültiger User).", s->id);
     }
-    
-    fclose(message_file);
-    write(client_sock, ".\n", 2);
-    printf("Nachricht erfolgreich gelesen\n");
-    
-    free_sorted_messages(sorted_files, message_count);
 }
 
-void process_delete_command(int client_sock, const char *mail_dir, const char *session_user) 
+// Nach dem Sync alle Zustellungen veröffentlichen; 1 = alle Empfänger haben die Nachricht
+static int deliveries_publish(struct session *s, int synced)
 {
-    char msg_number_str[32];
-    int msg_number;
-    
-    if(read_complete_line(client_sock, msg_number_str, sizeof(msg_number_str)) <= 0)
+    int ok = synced;
+    for (int i = 0; i < s->receiver_count; i++)
+    {
+        if (!synced) delivery_abort(&s->deliveries[i]);
+        else if (!delivery_publish(&s->deliveries[i])) ok = 0;
+    }
+    return ok;
+}
+
+void finish_send_command(struct session *s)
+{
+    if (!s->send_valid) 
     {
-        write(client_sock, RESP_ERR, strlen(RESP_ERR));
-        write(client_sock, "\n", 1);
+        deliveries_release(s);
+        send_command_result(s, 0);
         return;
     }
-    
-    msg_number = atoi(msg_number_str);
-    printf("Nachricht löschen: User=%s, Nr=%d\n", session_user, msg_number);
 
-    int message_count = 0;
-    char** sorted_files = get_sorted_messages(session_user, mail_dir, &message_count);
-    
-    if (msg_number < 1 || msg_number > message_count || !sorted_files) 
+    int closed = 1;
+    for (int i = 0; i < s->receiver_count; i++)
     {
-        write(client_sock, RESP_ERR, strlen(RESP_ERR));
-        write(client_sock, "\n", 1);
-        free_sorted_messages(sorted_files, message_count);
+        struct mail_index_record *record = &s->deliveries[i].record;
+        snprintf(record->sender, sizeof(record->sender), "%s", s->session_user);
+        snprintf(record->subject, sizeof(record->subject), "%s", s->subject);
+        if (!delivery_close(&s->deliveries[i])) closed = 0;
+    }
+    if (!closed)
+    {
+        deliveries_release(s);
+        send_command_result(s, 0);
         return;
     }
-    
-    // Den korrekten Dateinamen aus der sortierten Liste holen
-    const char* filename_to_delete = sorted_files[msg_number - 1];
-    
-    char file_path[256];
-    snprintf(file_path, sizeof(file_path), "%s/%s/%s", mail_dir, session_user, filename_to_delete);
-    
-    if (remove(file_path) == 0) 
+
+    // epoll-Modus mit Group Commit: der Reactor schließt alle in dieser
+    // Runde fertigen Zustellungen gemeinsam ab (session_commit_group)
+    if (s->nonblocking && delivery_sync_mode() == SYNC_GROUP)
     {
-        write(client_sock, RESP_OK, strlen(RESP_OK));
-        write(client_sock, "\n", 1);
-        printf("Nachricht erfolgreich gelöscht\n");
-    } 
-    else 
+        s->state = STATE_SEND_COMMIT;
+        return;
+    }
+
+    // Ein Sync für die Inhalte aller Empfänger, einer für die Verzeichniseinträge
+    uint64_t start = metrics_now();
+    int stored = deliveries_publish(s, delivery_barrier(s->mail_dir));
+    if (stored) stored = delivery_barrier(s->mail_dir);
+    metrics_observe_phase(PHASE_FILE_IO, start);
+    deliveries_release(s);
+    send_command_result(s, stored);
+}
+
+// Alle angekündigten Bytes sind da. Wie bei zeilenweisem SEND endet die Datei mit '\n',
+// damit das "." von READ auf einer eigenen Zeile steht.
+static void finish_send_data(struct session *s)
+{
+    s->state = STATE_COMMAND; // finish kann auf STATE_SEND_COMMIT wechseln
+    if (s->send_valid && s->body_line_state == 2)
     {
-        write(client_sock, RESP_ERR, strlen(RESP_ERR));
-        write(client_sock, "\n", 1);
-        printf("Löschen fehlgeschlagen\n");
+        log_warn("[Client %d] Text endet mit einer Zeile \".\", Nachricht wird verworfen.", s->id);
+        deliveries_release(s);
+        s->send_valid = 0;
     }
-    
-    free_sorted_messages(sorted_files, message_count);
+    if (s->send_valid && s->body_line_state == 0) fputc('\n', s->deliveries[0].file);
+    finish_send_command(s);
 }
 
-// -=- Client Handler -=-
-void handle_client(int client_socket, const char *mail_dir)
+void session_commit_group(struct session **sessions, int count)
 {
-    char client_command[32];
-    char session_user[USER_LEN + 1] = "";
-    int is_logged_in = 0;
-    int failed_attempts = 0;   // Zähler pro Verbindung
+    if (count == 0) return;
 
-    //IP-Adresse holen
-    struct sockaddr_in addr;
-    socklen_t len = sizeof(addr);
-    getpeername(client_socket, (struct sockaddr*)&addr, &len);
+    // Ein Sync für alle Inhalte, dann veröffentlichen, dann ein Sync für die Verzeichniseinträge
+    uint64_t start = metrics_now();
+    int synced = delivery_barrier(sessions[0]->mail_dir);
+    int published = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (deliveries_publish(sessions[i], synced)) published++;
+        else sessions[i]->send_valid = 0;
+    }
+    if (published > 0) synced = delivery_barrier(sessions[0]->mail_dir);
+    metrics_observe_phase(PHASE_FILE_IO, start);
 
-    char client_ip[32];
-    strcpy(client_ip, inet_ntoa(addr.sin_addr));
+    for (int i = 0; i < count; i++)
+    {
+        struct session *s = sessions[i];
+        deliveries_release(s);
+        send_command_result(s, synced && s->send_valid);
+        s->state = STATE_COMMAND;
+        session_command_done(s);
+    }
+}
 
-    printf("[Client %d] Connected from IP: %s\n", getpid(), client_ip);
+int session_accepts_input(const struct session *s)
+{
+    // Jede eingereihte Datei hält einen Deskriptor: ohne Grenze könnte ein Client, der
+    // READs schickt und nie liest, alle Deskriptoren des Workers belegen
+    if (ob_open_chunks(&s->out) >= SESSION_MAX_OPEN_CHUNKS) return 0;
+    return s->state != STATE_SEND_COMMIT && s->state != STATE_LOGIN_AUTH && s->state != STATE_COMPRESS_START;
+}
 
-    //BLACKLIST CHECK
-    if (is_ip_blacklisted(client_ip)) {
-        printf("[Client %d] IP %s is BLACKLISTED → terminating connection.\n", getpid(), client_ip);
-        write(client_socket, "ERR\n", 4);
-        close(client_socket);
-        exit(0);
-    }
-    
-    while (1)
-    {
-        if (read_complete_line(client_socket, client_command, sizeof(client_command)) <= 0)
-            break;
+struct list_context
+{
+    struct session *s;
+    int count_sent;
+};
 
-        printf("[Client %d] Command: %s\n", getpid(), client_command);
+static void list_send_count(struct session *s, uint32_t message_count)
+{
+    // Anzahl an Client senden
+    char count_buffer[32];
+    snprintf(count_buffer, sizeof(count_buffer), "%u\n", message_count);
+    session_write(s, count_buffer, strlen(count_buffer));
+    log_debug("[Client %d] Gefunden: %u Nachrichten", s->id, message_count);
+}
 
-        // LOGIN
-        if (strcmp(client_command, CMD_LOGIN) == 0)
-        {
-            // Zu viele Fehlversuche → Verbindung beenden
-            if (failed_attempts >= 3)
-            {
-                 add_ip_to_blacklist(client_ip);
-                write(client_socket, RESP_ERR, strlen(RESP_ERR));
-                write(client_socket, "\n", 1);
-                printf("[Client %d] Too many failed attempts --> BLACKLISTED \n", getpid());
-                break;  
-            }
+static int list_visit_subject(const struct mail_index_record *record, uint32_t total, void *ctx)
+{
+    struct list_context *list = ctx;
 
-            // Login ausführen
-            if (handle_login(client_socket, session_user))
-            {
-                is_logged_in = 1;
-                failed_attempts = 0; // Reset bei Erfolg
-                printf("[Client %d] User %s logged in.\n", getpid(), session_user);
-            }
-            else
-            {
-                failed_attempts++;
-                printf("[Client %d] Login failed (%d/3).\n", getpid(), failed_attempts);
+    // Die Anzahl kommt aus demselben Index-Snapshot wie die Betreffzeilen
+    if (!list->count_sent)
+    {
+        list_send_count(list->s, total);
+        list->count_sent = 1;
+    }
+    session_reply(list->s, record->subject);
+    return 0;
+}
 
-                if (failed_attempts >= 3)
-                {
-                    add_ip_to_blacklist(client_ip);
-                    printf("[Client %d] BLACKLISTED: %s\n", getpid(), client_ip);
-                    break;
-                }
-            }
-        }
+// "key=wert key=wert ..." aus der LIST-Zeile; 0 = unbekannter Parameter oder ungültiger Wert
+static int parse_list_query(const char *argument, struct mailbox_query *query)
+{
+    memset(query, 0, sizeof(*query));
+    query->limit = LIST_MAX_LIMIT;
 
-        // QUIT
-        else if (strcmp(client_command, CMD_QUIT) == 0)
+    const char *p = argument;
+    while (*p != '\0')
+    {
+        if (*p == ' ')
         {
-            break;
+            p++;
+            continue;
         }
 
-        // Alles andere REQUIRES LOGIN
-        else if (!is_logged_in)
-        {
-            write(client_socket, RESP_ERR, strlen(RESP_ERR));
-            write(client_socket, "\n", 1);
-        }
+        const char *equals = strchr(p, '=');
+        if (!equals) return 0;
+        size_t key_len = equals - p;
+        const char *value = equals + 1;
 
-        // SEND
-        else if (strcmp(client_command, CMD_SEND) == 0)
+        // Der Betreff darf Leerzeichen enthalten und nimmt deshalb den Rest der Zeile
+        if (key_len == strlen(LIST_PARAM_SUBJECT) && strncmp(p, LIST_PARAM_SUBJECT, key_len) == 0)
         {
-            process_send_command(client_socket, mail_dir, session_user);
+            if (strlen(value) > SUBJECT_LEN) return 0;
+            strcpy(query->subject, value);
+            return 1;
         }
 
-        // LIST
-        else if (strcmp(client_command, CMD_LIST) == 0)
-        {
-            process_list_command(client_socket, mail_dir, session_user);
-        }
+        const char *end = strchr(value, ' ');
+        size_t value_len = end ? (size_t)(end - value) : strlen(value);
+        char buffer[32];
+        if (value_len == 0 || value_len >= sizeof(buffer)) return 0;
+        memcpy(buffer, value, value_len);
+        buffer[value_len] = '\0';
 
-        // READ
-        else if (strcmp(client_command, CMD_READ) == 0)
+        if (key_len == strlen(LIST_PARAM_FROM) && strncmp(p, LIST_PARAM_FROM, key_len) == 0)
         {
-            process_read_command(client_socket, mail_dir, session_user);
+            if (value_len > USER_LEN) return 0;
+            strcpy(query->sender, buffer);
         }
-
-        // DELETE
-        else if (strcmp(client_command, CMD_DEL) == 0)
+        else if (key_len == strlen(LIST_PARAM_ORDER) && strncmp(p, LIST_PARAM_ORDER, key_len) == 0)
         {
-            process_delete_command(client_socket, mail_dir, session_user);
+            if (strcmp(buffer, LIST_ORDER_DESC) == 0) query->newest_first = 1;
+            else if (strcmp(buffer, LIST_ORDER_ASC) == 0) query->newest_first = 0;
+            else return 0;
         }
-
-        // Unbekannter Command
         else
         {
-            write(client_socket, RESP_ERR, strlen(RESP_ERR));
-            write(client_socket, "\n", 1);
+            char *number_end;
+            errno = 0;
+            unsigned long number = strtoul(buffer, &number_end, 10);
+            if (*number_end != '\0' || buffer[0] == '-' || errno == ERANGE || number > UINT32_MAX) return 0;
+
+            if (key_len == strlen(LIST_PARAM_OFFSET) && strncmp(p, LIST_PARAM_OFFSET, key_len) == 0) query->offset = (uint32_t)number;
+            else if (key_len == strlen(LIST_PARAM_SINCE) && strncmp(p, LIST_PARAM_SINCE, key_len) == 0) query->since_id = (uint32_t)number;
+            else if (key_len == strlen(LIST_PARAM_LIMIT) && strncmp(p, LIST_PARAM_LIMIT, key_len) == 0)
+            {
+                if (number == 0) return 0;
+                query->limit = number < LIST_MAX_LIMIT ? (uint32_t)number : LIST_MAX_LIMIT;
+            }
+            else return 0;
         }
+        p = value + value_len;
     }
-
-    close(client_socket);
-    exit(0);
+    return 1;
 }
 
-int main(int argc, char *argv[]) 
+// LIST mit Parametern: nur der angefragte Ausschnitt wird gelesen und gesendet
+static void process_list_query(struct session *s, const char *argument)
 {
-    
-    // Parameter überprüfen
+    struct mailbox_query query;
+    if (!parse_list_query(argument, &query))
+    {
+        session_reply_error(s);
+        return;
+    }
 
-    if (argc != 3) 
+    struct mail_index_record *records = malloc(query.limit * sizeof(*records));
+    int *numbers = malloc(query.limit * sizeof(*numbers));
+    if (!records || !numbers)
     {
-        printf("Verwendung: %s <Port> <Mail-Verzeichnis>\n", argv[0]);
-        printf("Beispiel: %s 8080 mailspool\n", argv[0]);
-        return 1;
+        session_reply_error(s);
+        free(records);
+        free(numbers);
+        return;
+    }
+
+    uint32_t total = 0;
+    uint64_t start = metrics_now();
+    int found = mailbox_index_query(s->mail_dir, s->session_user, &query, records, numbers, &total);
+    metrics_observe_phase(PHASE_INDEX, start);
+    if (found < 0) found = 0; // Ohne Mailbox wie bei LIST: keine Treffer statt ERR
+
+    char line[64 + USER_LEN + SUBJECT_LEN];
+    snprintf(line, sizeof(line), "%d %u", found, total);
+    session_reply(s, line);
+    for (int i = 0; i < found; i++)
+    {
+        snprintf(line, sizeof(line), "%d %u %s %s", numbers[i], records[i].id, records[i].sender, records[i].subject);
+        session_reply(s, line);
+    }
+    log_debug("[Client %d] Gefunden: %d von %u Nachrichten (%s)", s->id, found, total, argument);
+
+    free(records);
+    free(numbers);
+}
+
+void process_list_command(struct session *s, const char *argument)
+{
+    log_debug("[Client %d] Nachrichten auflisten für: %s", s->id, s->session_user);
+
+    if (argument)
+    {
+        process_list_query(s, argument);
+        return;
+    }
+
+    // Ein sequentieller Durchlauf über den Index statt readdir + fopen je Nachricht
+    struct list_context list = { s, 0 };
+    uint64_t start = metrics_now();
+    mailbox_index_foreach(s->mail_dir, s->session_user, list_visit_subject, &list);
+    metrics_observe_phase(PHASE_INDEX, start);
+    if (!list.count_sent) list_send_count(s, 0);
+}
+
+// -=- Komprimierte Nachrichten (READ) -=-
+
+// Beim Einreihen stehen nur Kopfzeilen und Länge fest. Datei und Entpacker (gut
+// 16 KiB plus zlib) entstehen erst, wenn der Stream-Chunk vorne im Ausgabepuffer steht
+struct deferred_message
+{
+    struct session *session;
+    struct deferred_message *next;          // s->deferred, solange stream == NULL
+    struct mail_index_record record;
+    size_t plain_length;                    // Angekündigt, die Datei muss dazu passen
+    void *stream;                           // inflate_stream, NULL = noch nicht geöffnet
+};
+
+static void deferred_unlink(struct deferred_message *m)
+{
+    struct deferred_message **link = &m->session->deferred;
+    while (*link && *link != m) link = &(*link)->next;
+    if (*link) *link = m->next;
+    m->next = NULL;
+}
+
+// 0 = nicht (mehr) lesbar oder mit anderem Inhalt
+static int deferred_open_record(struct deferred_message *m, const struct mail_index_record *record)
+{
+    struct session *s = m->session;
+    struct message_ref message;
+    if (!storage()->open_message(s->mail_dir, s->session_user, record, &message)) return 0;
+
+    struct compressed_message compressed;
+    if (!compress_open_message(message.fd, message.offset, message.length, &compressed) ||
+        compressed.plain_length != m->plain_length)
+    {
+        message_ref_close(&message);
+        return 0;
+    }
+    m->stream = inflate_stream_open(message.fd, &compressed);
+    return m->stream != NULL;
+}
+
+static int deferred_open(struct deferred_message *m)
+{
+    deferred_unlink(m);
+
+    // Die Segment-Kompaktierung kann den Record inzwischen verschoben haben
+    struct mail_index_record moved;
+    if (deferred_open_record(m, &m->record)) return 1;
+    if (mailbox_index_get_id(m->session->mail_dir, m->session->session_user, m->record.id, &moved) &&
+        deferred_open_record(m, &moved)) return 1;
+
+    log_warn("[Client %d] Nachricht %u beim Senden nicht mehr lesbar.", m->session->id, m->record.id);
+    return 0;
+}
+
+static ssize_t deferred_read(void *ctx, void *buf, size_t len)
+{
+    struct deferred_message *m = ctx;
+    if (!m->stream && !deferred_open(m)) return -1; // OK ist schon raus: Verbindung schließen
+    return inflate_stream_read(m->stream, buf, len);
+}
+
+static void deferred_close(void *ctx)
+{
+    struct deferred_message *m = ctx;
+    if (!m->stream) deferred_unlink(m);
+    inflate_stream_close(m->stream);
+    free(m);
+}
+
+// Vor DEL/MDEL: noch eingereihte READs derselben Verbindung jetzt öffnen,
+// sonst wäre die Nachricht weg, bevor sie gesendet wird
+static void session_open_deferred(struct session *s)
+{
+    while (s->deferred) deferred_open(s->deferred);
+}
+
+// OK, Kopfzeilen, Klartext (entsteht erst beim Flush, blockweise) und "."; 0 = nichts gesendet
+static int session_write_compressed(struct session *s, const struct mail_index_record *record,
+                                    const struct compressed_message *compressed)
+{
+    struct deferred_message *m = malloc(sizeof(*m));
+    if (!m) return 0;
+    m->session = s;
+    m->record = *record;
+    m->plain_length = compressed->plain_length;
+    m->stream = NULL;
+    m->next = s->deferred;
+    s->deferred = m;
+
+    session_reply(s, RESP_OK);
+    session_write(s, compressed->header, compressed->header_len);
+    ob_append_stream(&s->out, deferred_read, deferred_close, m, compressed->plain_length);
+    session_write(s, ".\n", 2);
+
+    if (!s->nonblocking && ob_open_chunks(&s->out) >= SESSION_MAX_OPEN_CHUNKS) session_flush(s);
+    return 1;
+}
+
+// OK + Inhalt + "." einreihen; 0 = Nachricht nicht lesbar, nichts gesendet
+static int send_message(struct session *s, const struct mail_index_record *record)
+{
+    struct message_ref message;
+    uint64_t start = metrics_now();
+    int opened = storage()->open_message(s->mail_dir, s->session_user, record, &message);
+    metrics_observe_phase(PHASE_FILE_IO, start);
+    if (!opened) return 0;
+
+    // Komprimiert gespeichert (oder seit dem Indexlesen umgeschrieben): beim Senden entpacken
+    struct compressed_message compressed;
+    if (((record->flags & MI_FLAG_COMPRESSED) || message.length != record->size) &&
+        compress_open_message(message.fd, message.offset, message.length, &compressed))
+    {
+        // Jetzt nur die Kopfzeilen, zum Senden wird die Datei neu geöffnet
+        message_ref_close(&message);
+        return session_write_compressed(s, record, &compressed);
     }
+
+    // OK senden, der Inhalt geht ohne Umweg über den Userspace hinterher
+    session_reply(s, RESP_OK);
+    session_write_file(s, message.fd, message.offset, message.length);
+    session_write(s, ".\n", 2);
+    return 1;
+}
+
+// Optionale Erweiterungen, die ein Client vor der Nutzung prüfen kann
+void process_capa_command(struct session *s)
+{
+    static const char *capabilities[] = { CMD_MREAD, CMD_MDEL, CMD_MSEND, CAPA_SEND_BYTES, CAPA_COMPRESS_DEFLATE,
+                                          CAPA_LIST_QUERY };
+    int count = (int)(sizeof(capabilities) / sizeof(capabilities[0]));
+
+    char count_line[16];
+    snprintf(count_line, sizeof(count_line), "%d", count);
+    session_reply(s, count_line);
+    for (int i = 0; i < count; i++) session_reply(s, capabilities[i]);
+}
+
+void process_read_command(struct session *s, const char *msg_number_str) 
+{
+    const char *session_user = s->session_user;
+    int msg_number = atoi(msg_number_str);
+    log_debug("[Client %d] Nachricht lesen: User=%s, Nr=%d", s->id, session_user, msg_number);
     
-    int port = atoi(argv[1]);
-    char* mail_directory = argv[2];
-    mkdir(mail_directory, 0700);
+    struct mail_index_record record;
+    uint64_t start = metrics_now();
+    int found = mailbox_index_get(s->mail_dir, session_user, msg_number, &record);
+    metrics_observe_phase(PHASE_INDEX, start);
+    if (!found) 
+    {
+        session_reply_error(s);
+        return;
+    }
     
-    signal(SIGCHLD, SIG_IGN);
+    if (!send_message(s, &record))
+    {
+        session_reply_error(s);
+        return;
+    }
+    log_debug("[Client %d] Nachricht erfolgreich gelesen", s->id);
+}
 
-    // Server-Socket erstellen
+void process_delete_command(struct session *s, const char *msg_number_str) 
+{
+    const char *session_user = s->session_user;
+    int msg_number = atoi(msg_number_str);
+    log_debug("[Client %d] Nachricht löschen: User=%s, Nr=%d", s->id, session_user, msg_number);
+
+    struct mail_index_record record;
+    uint64_t start = metrics_now();
+    int found = mailbox_index_delete(s->mail_dir, session_user, msg_number, &record);
+    metrics_observe_phase(PHASE_INDEX, start);
+    if (!found) 
+    {
+        session_reply_error(s);
+        return;
+    }
+    
+    session_open_deferred(s);
+    start = metrics_now();
+    int removed = storage()->remove_message(s->mail_dir, session_user, &record);
+    metrics_observe_phase(PHASE_FILE_IO, start);
+    if (removed) 
+    {
+        session_reply(s, RESP_OK);
+        log_info("[Client %d] Nachricht %d von %s gelöscht", s->id, msg_number, session_user);
+    } 
+    else 
+    {
+        session_reply_error(s);
+        log_warn("[Client %d] Löschen fehlgeschlagen", s->id);
+    }
+}
+
+// -=- Protokoll-State-Machine -=-
+
+void session_init(struct session *s, int sock, int id, const char *client_ip, const char *mail_dir, int nonblocking)
+{
+    memset(s, 0, sizeof(*s));
+    s->sock = sock;
+    s->id = id;
+    s->mail_dir = mail_dir;
+    s->state = STATE_COMMAND;
+    s->metric_command = METRIC_NONE;
+    s->nonblocking = nonblocking;
+    ob_init(&s->out, sock);
+    snprintf(s->client_ip, sizeof(s->client_ip), "%s", client_ip);
+}
+
+void session_cleanup(struct session *s)
+{
+    deliveries_release(s); // abgebrochenes SEND
+    if (s->state == STATE_LOGIN_AUTH) auth()->cancel(&s->auth);
+    free(s->mread);
+    s->mread = NULL;
+    ob_free(&s->out);
+    if (s->wire)
+    {
+        uint64_t plain, compressed;
+        wire_compress_stats(s->wire, &plain, &compressed);
+        log_debug("[Client %d] Kompression: %llu Bytes Klartext, %llu Bytes übertragen", s->id,
+                  (unsigned long long)plain, (unsigned long long)compressed);
+        wire_compress_free(s->wire); // Vor tls_free(): liegt darüber
+        s->wire = NULL;
+    }
+    tls_free(s->tls);
+    s->tls = NULL;
+}
+
+// Eingaben kommen ab jetzt über TLS. Mit kTLS verschlüsselt der Kernel,
+// der Ausgabepuffer bleibt dann bei writev()/sendfile() (READ ohne Kopie).
+void session_start_tls(struct session *s, struct line_reader *reader, struct ssl_st *tls)
+{
+    s->tls = tls;
+    lr_set_source(reader, tls_read, tls);
+
+    int ktls = tls_ktls_send(tls);
+    if (!ktls) ob_set_writer(&s->out, tls_write, tls);
+    log_debug("[Client %d] %s, Session %s, kTLS %s", s->id, tls_version(tls),
+              tls_session_reused(tls) ? "wiederaufgenommen" : "neu", ktls ? "an" : "aus");
+}
+
+// "1,4,7-12" → Nummern in der Reihenfolge der Anfrage; 0 = ungültig oder mehr als max
+static int parse_message_list(const char *line, int *numbers, int max)
+{
+    int count = 0;
+    const char *p = line;
+    while (1)
+    {
+        char *end;
+        if (!isdigit((unsigned char)*p)) return 0;
+        long from = strtol(p, &end, 10);
+        long to = from;
+        if (*end == RANGE_SEPARATOR)
+        {
+            p = end + 1;
+            if (!isdigit((unsigned char)*p)) return 0;
+            to = strtol(p, &end, 10);
+        }
+        if (from < 1 || to < from || to > INT_MAX || to - from >= max - count) return 0;
+        for (long n = from; n <= to; n++) numbers[count++] = (int)n;
+
+        if (*end == '\0') return count;
+        if (*end != LIST_SEPARATOR) return 0;
+        p = end + 1;
+    }
+}
+
+static int compare_numbers(const void *a, const void *b)
+{
+    int na = *(const int *)a;
+    int nb = *(const int *)b;
+    return (na > nb) - (na < nb);
+}
+
+// MREAD, das an SESSION_MAX_OPEN_CHUNKS angehalten hat
+struct mread_batch
+{
+    struct mail_index_record records[MREAD_MAX_MESSAGES];
+    int found[MREAD_MAX_MESSAGES];
+    int count;
+    int next;
+};
+
+// Nachrichten ab *next einreihen, solange die Dateigrenze es zulässt; 1 = alle eingereiht.
+// Blockierend leert session_write_file() den Puffer an der Grenze selbst.
+static int mread_send(struct session *s, const struct mail_index_record *records, const int *found, int count, int *next)
+{
+    while (*next < count)
+    {
+        if (s->nonblocking && ob_open_chunks(&s->out) >= SESSION_MAX_OPEN_CHUNKS) return 0;
+        int i = (*next)++;
+        if (!found[i] || !send_message(s, &records[i])) session_reply(s, RESP_ERR);
+    }
+    return 1;
+}
+
+void process_mread_command(struct session *s, const char *list)
+{
+    int numbers[MREAD_MAX_MESSAGES];
+    struct mail_index_record records[MREAD_MAX_MESSAGES];
+    int found[MREAD_MAX_MESSAGES];
+
+    int count = parse_message_list(list, numbers, MREAD_MAX_MESSAGES);
+    log_debug("[Client %d] Nachrichten lesen: User=%s, Nr=%s", s->id, s->session_user, list);
+    if (count == 0)
+    {
+        session_reply_error(s);
+        return;
+    }
+
+    // Ein Durchlauf über den Index für alle Nummern
+    uint64_t start = metrics_now();
+    int indexed = mailbox_index_get_many(s->mail_dir, s->session_user, numbers, count, records, found);
+    metrics_observe_phase(PHASE_INDEX, start);
+    if (!indexed)
+    {
+        session_reply_error(s);
+        return;
+    }
+
+    char count_buffer[32];
+    snprintf(count_buffer, sizeof(count_buffer), "%d\n", count);
+    session_write(s, count_buffer, strlen(count_buffer));
+
+    // Einzelne unbekannte Nummern sind kein Fehler des ganzen Commands
+    int next = 0;
+    if (mread_send(s, records, found, count, &next)) return;
+
+    // Grenze erreicht, auch durch vorherige Commands: Rest erst einreihen, wenn
+    // genug gesendet ist (session_feed_input). Der Index-Stand bleibt der von jetzt.
+    s->mread = malloc(sizeof(*s->mread));
+    if (!s->mread)
+    {
+        for (; next < count; next++)
+        {
+            if (!found[next] || !send_message(s, &records[next])) session_reply(s, RESP_ERR);
+        }
+        return;
+    }
+    memcpy(s->mread->records, records, count * sizeof(*records));
+    memcpy(s->mread->found, found, count * sizeof(*found));
+    s->mread->count = count;
+    s->mread->next = next;
+    s->state = STATE_MREAD_SENDING;
+}
+
+void process_mdel_command(struct session *s, const char *list)
+{
+    int *numbers = malloc(MDEL_MAX_MESSAGES * sizeof(*numbers));
+    struct mail_index_record *records = malloc(MDEL_MAX_MESSAGES * sizeof(*records));
+    int count = numbers && records ? parse_message_list(list, numbers, MDEL_MAX_MESSAGES) : 0;
+    log_debug("[Client %d] Nachrichten löschen: User=%s, Nr=%s", s->id, s->session_user, list);
+
+    // Doppelte Nummern nur einmal löschen
+    int unique = 0;
+    if (count > 0) qsort(numbers, count, sizeof(*numbers), compare_numbers);
+    for (int i = 0; i < count; i++)
+    {
+        if (unique == 0 || numbers[unique - 1] != numbers[i]) numbers[unique++] = numbers[i];
+    }
+
+    uint64_t start = metrics_now();
+    int deleted = unique > 0 ? mailbox_index_delete_many(s->mail_dir, s->session_user, numbers, unique, records) : 0;
+    metrics_observe_phase(PHASE_INDEX, start);
+
+    // Nur den Speicher der tatsächlich gelöschten Records entfernen, sonst holt
+    // mailbox_index_verify() sie wieder zurück
+    int removed = deleted > 0;
+    if (deleted > 0)
+    {
+        session_open_deferred(s);
+        start = metrics_now();
+        for (int i = 0; i < deleted; i++)
+        {
+            if (!storage()->remove_message(s->mail_dir, s->session_user, &records[i])) removed = 0;
+        }
+        metrics_observe_phase(PHASE_FILE_IO, start);
+    }
+
+    if (removed && deleted == unique)
+    {
+        session_reply(s, RESP_OK);
+        log_info("[Client %d] %d Nachrichten von %s gelöscht", s->id, unique, s->session_user);
+    }
+    else
+    {
+        session_reply_error(s);
+        if (deleted > 0 && deleted < unique) log_error("[Client %d] MDEL nur teilweise: %d von %d Nachrichten gelöscht", s->id, deleted, unique);
+        else if (deleted > 0) log_warn("[Client %d] Löschen fehlgeschlagen", s->id);
+    }
+    free(numbers);
+    free(records);
+}
+
+// "SEND <bytes>": Text mit Längenangabe; ohne Argument zeilenweise bis "."
+static int parse_body_length(struct session *s, const char *argument)
+{
+    s->body_framed = argument != NULL;
+    s->body_length = s->body_remaining = 0;
+    if (!argument) return 1;
+
+    char *end;
+    if (!isdigit((unsigned char)*argument)) return 0;
+    errno = 0;
+    unsigned long long length = strtoull(argument, &end, 10);
+    if (*end != '\0' || errno == ERANGE || length > SEND_MAX_BODY_LEN) return 0;
+
+    s->body_length = s->body_remaining = length;
+    return 1;
+}
+
+static int session_dispatch_command(struct session *s, const char *client_command, const char *argument)
+{
+    log_debug("[Client %d] Command: %s", s->id, client_command);
+
+    static const char *measured[METRIC_COMMANDS] = { CMD_LOGIN, CMD_SEND, CMD_LIST, CMD_READ, CMD_DEL,
+                                                     CMD_MSEND, CMD_MREAD, CMD_MDEL };
+    s->metric_command = METRIC_NONE;
+    for (int i = 0; i < METRIC_COMMANDS; i++)
+    {
+        if (strcmp(client_command, measured[i]) == 0) s->metric_command = (enum metric_command)i;
+    }
+    s->command_start = metrics_now();
+    s->command_failed = 0;
+
+    // Nur SEND und MSEND (Länge des Texts) sowie LIST (Ausschnitt und Filter) haben ein Argument
+    if (argument && strcmp(client_command, CMD_SEND) != 0 && strcmp(client_command, CMD_MSEND) != 0 &&
+        strcmp(client_command, CMD_LIST) != 0)
+    {
+        session_reply_error(s);
+        return 1;
+    }
+
+    // LOGIN
+    if (strcmp(client_command, CMD_LOGIN) == 0)
+    {
+        // Zu viele Fehlversuche → Verbindung beenden
+        if (s->failed_attempts >= MAX_LOGIN_ATTEMPTS)
+        {
+            blacklist_add(s->client_ip);
+            session_reply_error(s);
+            log_warn("[Client %d] Too many failed attempts --> BLACKLISTED", s->id);
+            return 0;
+        }
+        s->state = STATE_LOGIN_USER;
+    }
+
+    // QUIT
+    else if (strcmp(client_command, CMD_QUIT) == 0)
+    {
+        return 0;
+    }
+
+    // SEND, READ, DEL und ihre M-Varianten lesen ihre Zeilen auch ohne Login und antworten erst
+    // danach mit ERR: sonst würden bei gepipelinten Commands Empfänger,
+    // Betreff oder Nummer als eigene Commands gelten und Antworten verrutschen
+
+    // SEND
+    else if (strcmp(client_command, CMD_SEND) == 0)
+    {
+        // Ungültige Länge: der Client schickt trotzdem Rohdaten, die nicht als Commands gelten dürfen
+        if (!parse_body_length(s, argument))
+        {
+            session_reply_error(s);
+            return 0;
+        }
+        s->state = STATE_SEND_RECEIVER;
+    }
+
+    // READ
+    else if (strcmp(client_command, CMD_READ) == 0)
+    {
+        s->state = STATE_READ_NUMBER;
+    }
+
+    // DELETE
+    else if (strcmp(client_command, CMD_DEL) == 0)
+    {
+        s->state = STATE_DEL_NUMBER;
+    }
+
+    // Mehrere Empfänger bzw. Nachrichten in einem Command (MSEND = SEND mit Liste)
+    else if (strcmp(client_command, CMD_MSEND) == 0)
+    {
+        if (!parse_body_length(s, argument))
+        {
+            session_reply_error(s);
+            return 0;
+        }
+        s->state = STATE_SEND_RECEIVER;
+    }
+    else if (strcmp(client_command, CMD_MREAD) == 0)
+    {
+        s->state = STATE_MREAD_NUMBERS;
+    }
+    else if (strcmp(client_command, CMD_MDEL) == 0)
+    {
+        s->state = STATE_MDEL_NUMBERS;
+    }
+
+    // Erweiterungen und Kompression gehen auch ohne Login
+    else if (strcmp(client_command, CMD_CAPA) == 0)
+    {
+        process_capa_command(s);
+    }
+    else if (strcmp(client_command, CMD_COMPRESS) == 0)
+    {
+        s->state = STATE_COMPRESS_METHOD;
+    }
+
+    // Alles andere REQUIRES LOGIN
+    else if (!s->is_logged_in)
+    {
+        session_reply_error(s);
+    }
+
+    // LIST
+    else if (strcmp(client_command, CMD_LIST) == 0)
+    {
+        process_list_command(s, argument);
+    }
+
+    // Unbekannter Command
+    else
+    {
+        session_reply_error(s);
+    }
+    return 1;
+}
+
+static int session_process_line(struct session *s, char *line)
+{
+    switch (s->state)
+    {
+        case STATE_COMMAND:
+        {
+            if (line[0] == '\0') return 0; // Leere Zeile beendet die Verbindung
+            char *argument = strchr(line, ' ');
+            if (argument) *argument++ = '\0';
+            return session_dispatch_command(s, line, argument);
+        }
+
+        case STATE_LOGIN_USER:
+            // Zu lange Namen landen leer im Puffer und scheitern an der Validierung
+            if (strlen(line) > USER_LEN) s->login_user[0] = '\0';
+            else strcpy(s->login_user, line);
+            s->state = STATE_LOGIN_PASS;
+            return 1;
+
+        case STATE_LOGIN_PASS:
+            s->state = STATE_COMMAND;
+            // Login ausführen (epoll: wechselt evtl. auf STATE_LOGIN_AUTH)
+            return handle_login(s, line);
+
+        case STATE_SEND_RECEIVER:
+            // Ein Empfänger oder eine Liste; ungültig: Betreff und Text werden trotzdem gelesen, dann ERR
+            s->receiver_count = parse_receiver_list(s, line);
+            s->state = STATE_SEND_SUBJECT;
+            return 1;
+
+        case STATE_SEND_SUBJECT:
+            snprintf(s->subject, sizeof(s->subject), "%s", line);
+            begin_send_command(s);
+            s->state = STATE_SEND_BODY;
+            if (s->body_framed)
+            {
+                s->state = STATE_SEND_DATA;
+                s->body_line_state = 1;
+                if (s->body_remaining == 0) finish_send_data(s);
+            }
+            return 1;
+
+        case STATE_SEND_BODY:
+            if (strcmp(line, ".") == 0)
+            {
+                s->state = STATE_COMMAND; // finish kann auf STATE_SEND_COMMIT wechseln
+                finish_send_command(s);
+            }
+            else
+            {
+                send_body_line(s, line);
+            }
+            return 1;
+
+        case STATE_READ_NUMBER:
+            s->state = STATE_COMMAND;
+            if (s->is_logged_in) process_read_command(s, line);
+            else session_reply_error(s);
+            return 1;
+
+        case STATE_DEL_NUMBER:
+            s->state = STATE_COMMAND;
+            if (s->is_logged_in) process_delete_command(s, line);
+            else session_reply_error(s);
+            return 1;
+
+        case STATE_MREAD_NUMBERS:
+            s->state = STATE_COMMAND;
+            if (s->is_logged_in) process_mread_command(s, line);
+            else session_reply_error(s);
+            return 1;
+
+        case STATE_MDEL_NUMBERS:
+            s->state = STATE_COMMAND;
+            if (s->is_logged_in) process_mdel_command(s, line);
+            else session_reply_error(s);
+            return 1;
+
+        case STATE_COMPRESS_METHOD:
+            s->state = STATE_COMMAND;
+            if (strcmp(line, COMPRESS_DEFLATE) == 0 && !s->wire)
+            {
+                session_reply(s, RESP_OK);
+                s->state = STATE_COMPRESS_START;
+            }
+            else
+            {
+                session_reply_error(s); // Unbekanntes Verfahren oder schon komprimiert
+            }
+            return 1;
+
+        case STATE_SEND_DATA:           // Kommt über session_feed_input() als Rohdaten
+        case STATE_MREAD_SENDING:
+        case STATE_SEND_COMMIT:
+        case STATE_LOGIN_AUTH:
+        case STATE_COMPRESS_START:
+            return 1; // Reactor liefert keine Zeilen solange ein Commit, Login bzw. Umschalten aussteht
+    }
+    return 0;
+}
+
+int session_feed_line(struct session *s, char *line)
+{
+    int keep_open = session_process_line(s, line);
+    session_command_done(s);
+    return keep_open;
+}
+
+int session_feed_input(struct session *s, struct line_reader *reader)
+{
+    if (s->state == STATE_SEND_DATA)
+    {
+        // Text mit Längenangabe: direkt aus dem Lesepuffer, so groß wie gerade vorhanden
+        char *data;
+        size_t len = lr_take(reader, (size_t)s->body_remaining, &data);
+        if (len == 0) return 0;
+
+        send_body_data(s, data, len);
+        s->body_remaining -= len;
+        if (s->body_remaining == 0)
+        {
+            finish_send_data(s);
+            session_command_done(s);
+        }
+        return 1;
+    }
+
+    // Laufendes MREAD fortsetzen, bevor der nächste Command gelesen wird
+    if (s->state == STATE_MREAD_SENDING)
+    {
+        if (mread_send(s, s->mread->records, s->mread->found, s->mread->count, &s->mread->next))
+        {
+            free(s->mread);
+            s->mread = NULL;
+            s->state = STATE_COMMAND;
+            session_command_done(s);
+        }
+        return 1;
+    }
+
+    // Nach COMPRESS erst weiterlesen, wenn das OK draußen ist (session_flush schaltet um)
+    if (s->state == STATE_COMPRESS_START) return 0;
 
+    char *line;
+    size_t line_len;
+    if (!lr_next_line(reader, &line, &line_len)) return 0;
+    int keep_open = session_feed_line(s, line);
+    if (s->state == STATE_COMPRESS_START) s->wire_reader = reader;
+    return keep_open ? 1 : -1;
+}
+
+// -=- Client Handler (fork-Modus) -=-
+void handle_client(int client_socket, const char *mail_dir)
+{
+    struct line_reader reader;
+
+    //IP-Adresse holen
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    getpeername(client_socket, (struct sockaddr*)&addr, &len);
+
+    char client_ip[32];
+    strcpy(client_ip, inet_ntoa(addr.sin_addr));
+
+    log_info("[Client %d] Connected from IP: %s", getpid(), client_ip);
+
+    //BLACKLIST CHECK
+    if (blacklist_contains(client_ip)) {
+        metrics_count_connection(0);
+        log_warn("[Client %d] IP %s is BLACKLISTED → terminating connection.", getpid(), client_ip);
+        write(client_socket, "ERR\n", 4);
+        close(client_socket);
+        exit(0);
+    }
+
+    metrics_count_connection(1);
+    int nodelay = 1;
+    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    struct session s;
+    session_init(&s, client_socket, getpid(), client_ip, mail_dir, 0);
+    
+    lr_init(&reader, client_socket, LINE_LEN);
+    if (tls_server_enabled())
+    {
+        // Blockierender Socket: der Handshake ist fertig oder gescheitert
+        struct ssl_st *tls = tls_server_new(client_socket);
+        if (!tls || tls_handshake(tls) != 1)
+        {
+            log_warn("[Client %d] TLS: %s", s.id, tls_last_error());
+            tls_free(tls);
+            session_cleanup(&s);
+            close(client_socket);
+            exit(0);
+        }
+        session_start_tls(&s, &reader, tls);
+    }
+    while (1)
+    {
+        int rc = session_feed_input(&s, &reader);
+        if (rc < 0) break;
+        if (rc == 0)
+        {
+            // Keine vollständige Zeile mehr gepuffert: gesammelte Antworten
+            // in einem writev() senden, dann erst wieder blockierend lesen
+            if (session_flush(&s) < 0) break;
+            if (lr_fill(&reader) <= 0) break;
+        }
+    }
+    session_flush(&s);
+
+    lr_free(&reader);
+    session_cleanup(&s);
+    close(client_socket);
+    log_info("[Client %d] Verbindung geschlossen", s.id);
+    exit(0); // atexit: Log-Ring leeren
+}
+
+int server_socket_create(int port, int reuseport)
+{
     int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_socket < 0)
+    {
+        log_error("Socket failed: %s", strerror(errno));
+        return -1;
+    }
+
     struct sockaddr_in server_address;
+    memset(&server_address, 0, sizeof(server_address));
     server_address.sin_family = AF_INET;
     server_address.sin_port = htons(port);
     server_address.sin_addr.s_addr = INADDR_ANY;
 
     int opt = 1;
     setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reuseport && setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    {
+        log_error("SO_REUSEPORT failed: %s", strerror(errno));
+        close(server_socket);
+        return -1;
+    }
+
+    if (bind(server_socket, (struct sockaddr*)&server_address, sizeof(server_address)) < 0)
+    {
+        log_error("Bind failed: %s", strerror(errno));
+        close(server_socket);
+        return -1;
+    }
+    listen(server_socket, SOMAXCONN);
+    return server_socket;
+}
+
+static int parse_count(const char *text, int *value)
+{
+    char *end;
+    long parsed = strtol(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || parsed < 0 || parsed > 1000000) return 0;
+    *value = (int)parsed;
+    return 1;
+}
+
+static void print_usage(const char *program)
+{
+    printf("Verwendung: %s [-m fork|epoll|prefork] [-w worker] [-c verbindungen] [-P]\n"
+           "          [-d none|fsync|group] [-b file|segment] [-z none|gzip[:stufe]]\n"
+           "          [-a ldap|htpasswd] [-H datei] [-L ldap-uri] [-U dn-vorlage] [-T] [-C sekunden] [-A sekunden]\n"
+           "          [-R art=rate[/burst]]... [-l level] [-J] [-M [ip:]port] [-S zertifikat.pem [-K schlüssel.pem]]\n"
+           "          <Port> <Mail-Verzeichnis>\n", program);
+    printf("Beispiel: %s -m epoll -d group -b segment 8080 mailspool\n", program);
+    printf("  -m  Server-Modus: fork (ein Prozess pro Client, Standard), epoll (ein Event-Loop)\n"
+           "      oder prefork (feste Anzahl epoll-Worker auf einem SO_REUSEPORT Port)\n");
+    printf("  -w  Anzahl Worker im prefork-Modus (Standard: Anzahl CPUs, max. %d)\n", PREFORK_MAX_WORKERS);
+    printf("  -c  Maximale Verbindungen pro Worker bzw. epoll-Prozess (Standard: 0 = unbegrenzt)\n");
+    printf("  -P  Worker im prefork-Modus an je eine CPU binden\n");
+    printf("  -d  Dauerhaftigkeit von SEND: none, fsync (pro Nachricht, Standard) oder group (Group Commit)\n");
+    printf("  -b  Speicher-Backend: file (eine Datei pro Nachricht, Standard) oder segment (append-only Log)\n");
+    printf("  -z  Nachrichtentexte komprimiert speichern: none (Standard) oder gzip[:1-9] (Standard-Stufe %d)\n", COMPRESS_DEFAULT_LEVEL);
+    printf("  -a  Anmeldung: ldap (Standard) oder htpasswd (lokale Benutzerdatei, SIGHUP lädt neu)\n");
+    printf("  -H  Benutzerdatei für -a htpasswd, Zeilen user:bcrypt-hash (Standard: %s)\n", HTPASSWD_DEFAULT_FILE);
+    printf("  -L  LDAP URI (Standard: %s)\n", LDAP_DEFAULT_URI);
+    printf("  -U  DN-Vorlage, %%s = Username (Standard: %s)\n", LDAP_DEFAULT_DN_TEMPLATE);
+    printf("  -T  Kein StartTLS zum LDAP Server (nur für lokale Tests)\n");
+    printf("  -C  Erfolgreiche Logins so viele Sekunden cachen (Standard: 0 = aus)\n");
+    printf("  -A  Timeout für einen LDAP Login in Sekunden (Standard: %d)\n", LDAP_AUTH_TIMEOUT);
+    printf("  -R  Token-Bucket Limit pro IP und User, art = connect|login|send|bytes (mehrfach möglich)\n");
+    printf("      z.B. -R login=1/5 (1 pro Sekunde, bis zu 5 am Stück)\n");
+    printf("  -l  Log-Level: debug, info (Standard), warn oder error\n");
+    printf("  -J  Log-Einträge als JSON-Zeilen ausgeben\n");
+    printf("  -M  Admin-Port für Metriken im Prometheus Format (GET /metrics), z.B. -M 127.0.0.1:9464\n");
+    printf("  -S  TLS mit diesem Zertifikat (PEM, inkl. Kette); ohne -S unverschlüsselt\n");
+    printf("  -K  Privater Schlüssel zu -S (Standard: in der Zertifikatsdatei)\n");
+}
+
+int main(int argc, char *argv[]) 
+{
     
-    if(bind(server_socket, (struct sockaddr*)&server_address, sizeof(server_address)) < 0)
+    // Parameter überprüfen
+
+    const char *mode = MODE_FORK;
+    const char *tls_cert = NULL;
+    const char *tls_key = NULL;
+    struct prefork_config workers = { 0, 0, 0 };
+    int opt_char;
+    while ((opt_char = getopt(argc, argv, "m:w:c:Pd:b:z:a:H:L:U:TC:A:R:l:JM:S:K:")) != -1)
     {
-        perror("Bind failed.");
+        switch (opt_char)
+        {
+            case 'm':
+                mode = optarg;
+                break;
+            case 'w':
+                if (!parse_count(optarg, &workers.workers) || workers.workers < 1 || workers.workers > PREFORK_MAX_WORKERS)
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'c':
+                if (!parse_count(optarg, &workers.max_connections))
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'P':
+                workers.pin_cpus = 1;
+                break;
+            case 'l':
+                if (!log_set_level(optarg))
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'J':
+                log_set_json(1);
+                break;
+            case 'S':
+                tls_cert = optarg;
+                break;
+            case 'K':
+                tls_key = optarg;
+                break;
+            case 'M':
+                if (!metrics_configure(optarg))
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'd':
+                if (!delivery_set_sync_mode(optarg))
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'b':
+                if (!storage_select(optarg))
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'z':
+                if (!compress_configure(optarg))
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'a':
+                if (!auth_select(optarg))
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'H':
+                htpasswd_set_file(optarg);
+                break;
+            case 'L':
+                ldap_auth_set_uri(optarg);
+                break;
+            case 'U':
+                if (!ldap_auth_set_dn_template(optarg))
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'T':
+                ldap_auth_set_starttls(0);
+                break;
+            case 'A':
+                if (!ldap_auth_set_timeout(optarg))
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'R':
+                if (!ratelimit_configure(optarg))
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'C':
+                if (!ldap_auth_set_cache_ttl(optarg))
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind != 2 || (strcmp(mode, MODE_FORK) != 0 && strcmp(mode, MODE_EPOLL) != 0 &&
+                               strcmp(mode, MODE_PREFORK) != 0))
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (tls_key && !tls_cert)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (workers.workers == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers.workers = cpus < 1 ? 1 : cpus > PREFORK_MAX_WORKERS ? PREFORK_MAX_WORKERS : (int)cpus;
+    }
+    
+    int port = atoi(argv[optind]);
+    char* mail_directory = argv[optind + 1];
+    mkdir(mail_directory, 0700);
+
+    // Reste abgebrochener Zustellungen entfernen, Indizes abgleichen
+    delivery_recover(mail_directory);
+    
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    storage_start_compactor(mail_directory);
+
+    // TLS-Kontext (Ticket-Schlüssel), Login-Cache, Blacklist, Rate-Limits und Metriken müssen vor dem
+    // ersten fork() existieren, damit alle Kinder sie teilen
+    if (tls_cert && !tls_server_init(tls_cert, tls_key))
+    {
+        log_error("TLS konnte nicht initialisiert werden: %s", tls_last_error());
+        return 1;
+    }
+    if (tls_cert) log_info("TLS aktiv, Zertifikat: %s", tls_cert);
+    if (!auth()->init())
+    {
+        log_error("Anmeldung (%s) konnte nicht initialisiert werden.", auth()->name);
+        return 1;
+    }
+    auth_watch_reload();
+    if (!blacklist_init() || !ratelimit_init() || !metrics_init())
+    {
+        log_error("Shared memory setup failed: %s", strerror(errno));
         return 1;
     }
-    listen(server_socket, 5);
+    blacklist_start_reaper();
+    metrics_start_server();
+
+    if (strcmp(mode, MODE_PREFORK) == 0)
+    {
+        // Jeder Worker bindet seinen eigenen Socket, der Master nimmt keine Verbindungen an
+        log_info("TW-Mailer Pro Server gestartet auf Port %d (Modus: %s, %d Worker, Backend: %s)",
+                 port, mode, workers.workers, storage()->name);
+        log_info("Mail-Verzeichnis: %s", mail_directory);
+        return prefork_run(port, mail_directory, &workers) ? 0 : 1;
+    }
+
+    // Server-Socket erstellen
+
+    int server_socket = server_socket_create(port, 0);
+    if (server_socket < 0) return 1;
     
-    printf("TW-Mailer Pro Server gestartet auf Port %d\n", port);
-    printf("Mail-Verzeichnis: %s\n", mail_directory);
-    printf("Warte auf Client-Verbindungen...\n");
+    log_info("TW-Mailer Pro Server gestartet auf Port %d (Modus: %s, Backend: %s)", port, mode, storage()->name);
+    log_info("Mail-Verzeichnis: %s", mail_directory);
+    log_info("Warte auf Client-Verbindungen...");
+
+    if (strcmp(mode, MODE_EPOLL) == 0)
+    {
+        if (auth()->warm) auth()->warm(); // Ein Prozess für alle Logins: Verbindungen gleich aufbauen
+        int rc = reactor_run(server_socket, mail_directory, workers.max_connections);
+        close(server_socket);
+        return rc;
+    }
     
     // Hauptschleife für Client-Verbindungen
     while (1) 
     {
+        // SIGHUP: neue Kinder bekommen die neu geladenen Benutzer, laufende behalten ihre
+        if (auth_reload_requested() && auth()->reload) auth()->reload();
+
         struct sockaddr_in client_addr;
         socklen_t client_len = sizeof(client_addr);
         int client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_len);
         if(client_socket < 0) continue;
 
+        // Verbindungslimit schon im Elternprozess prüfen: kein fork() für abgewiesene Clients
+        char client_ip[INET6_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
+        if (!ratelimit_allow(RL_CONNECT, client_ip, NULL, 1))
+        {
+            metrics_count_connection(0);
+            write(client_socket, "ERR\n", 4);
+            close(client_socket);
+            continue;
+        }
+
         pid_t pid = fork();
 
         if(pid < 0)
         {
-            perror("Fork failed.");
+            log_error("Fork failed: %s", strerror(errno));
             close(client_socket);
         }
         else if(pid == 0) // Child
         {
-            printf("\n--- Neue Client-Verbindung ---\n");
+            signal(SIGHUP, SIG_IGN); // Nur der Elternprozess lädt neu, laufende Logins nicht unterbrechen
             close(server_socket);
             handle_client(client_socket, mail_directory);
-            printf("--- Client-Verbindung geschlossen ---\n");
         }
         else // Parent
         {
@@ -724,4 +1738,4 @@ int main(int argc, char *argv[])
     
     close(server_socket);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,264 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include "Headers/common.h"
+#include "Headers/mailbox.h"
+#include "Headers/storage.h"
+#include "Headers/log.h"
+#include "Headers/compress.h"
+
+static const struct storage_backend *active_storage = &file_storage;
+
+const struct storage_backend *storage_find(const char *name)
+{
+    if (strcmp(name, file_storage.name) == 0) return &file_storage;
+    if (strcmp(name, segment_storage.name) == 0) return &segment_storage;
+    return NULL;
+}
+
+int storage_select(const char *name)
+{
+    const struct storage_backend *backend = storage_find(name);
+    if (!backend) return 0;
+    active_storage = backend;
+    return 1;
+}
+
+const struct storage_backend *storage(void)
+{
+    return active_storage;
+}
+
+void message_ref_close(struct message_ref *ref)
+{
+    if (ref->fd >= 0) close(ref->fd);
+    ref->fd = -1;
+}
+
+void parse_message_header(const char *data, size_t len, struct mail_index_record *record)
+{
+    const char *end = data + len;
+    const char *line = data;
+
+    // Kopfzeilen bis zur Leerzeile; danach beginnt der (evtl. komprimierte) Text
+    while (line < end)
+    {
+        const char *newline = memchr(line, '\n', end - line);
+        int line_len = (int)((newline ? newline : end) - line);
+        if (line_len == 0) break;
+
+        if (line_len >= 8 && strncmp(line, "Sender: ", 8) == 0)
+        {
+            snprintf(record->sender, sizeof(record->sender), "%.*s", line_len - 8, line + 8);
+        }
+        else if (line_len >= 9 && strncmp(line, "Subject: ", 9) == 0)
+        {
+            snprintf(record->subject, sizeof(record->subject), "%.*s", line_len - 9, line + 9);
+        }
+        else if (line_len == (int)sizeof(COMPRESS_ENCODING_LINE) - 1 && strncmp(line, COMPRESS_ENCODING_LINE, line_len) == 0)
+        {
+            record->flags |= MI_FLAG_COMPRESSED;
+        }
+        if (!newline) break;
+        line = newline + 1;
+    }
+}
+
+// -=- Backend: eine Datei pro Nachricht -=-
+
+static void file_message_path(char *path, size_t size, const char *mail_dir, const char *user, uint32_t id)
+{
+    snprintf(path, size, "%s/%s/%u.msg", mail_dir, user, id);
+}
+
+static int file_publish(struct mail_delivery *d)
+{
+    // link() statt rename(): schlägt fehl statt eine vorhandene Nachricht zu ersetzen
+    if (link(d->tmp_path, d->final_path) < 0) return 0;
+    unlink(d->tmp_path);
+    d->tmp_path[0] = '\0';
+    d->record.offset = 0;
+
+    if (delivery_sync_mode() == SYNC_FSYNC)
+    {
+        char folder_path[256];
+        snprintf(folder_path, sizeof(folder_path), "%s/%s", d->mail_dir, d->user);
+        int fd = open(folder_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            fsync(fd);
+            close(fd);
+        }
+    }
+    return 1;
+}
+
+static int file_import(const char *mail_dir, const char *user, struct mail_index_record *record, int src_fd, off_t src_offset)
+{
+    char file_path[256];
+    file_message_path(file_path, sizeof(file_path), mail_dir, user, record->id);
+
+    int fd = open(file_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) return 0;
+
+    loff_t in_offset = src_offset;
+    size_t remaining = record->size;
+    while (remaining > 0)
+    {
+        ssize_t n = copy_file_range(src_fd, &in_offset, fd, NULL, remaining, 0);
+        if (n <= 0) break;
+        remaining -= n;
+    }
+
+    int ok = remaining == 0 && fsync(fd) == 0;
+    close(fd);
+    if (!ok) unlink(file_path);
+    record->offset = 0;
+    return ok;
+}
+
+static int file_open_message(const char *mail_dir, const char *user, const struct mail_index_record *record, struct message_ref *out)
+{
+    char file_path[256];
+    file_message_path(file_path, sizeof(file_path), mail_dir, user, record->id);
+
+    out->fd = open(file_path, O_RDONLY | O_CLOEXEC);
+    if (out->fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(out->fd, &st) < 0)
+    {
+        message_ref_close(out);
+        return 0;
+    }
+    out->offset = 0;
+    out->length = (size_t)st.st_size;
+    return 1;
+}
+
+static int file_remove_message(const char *mail_dir, const char *user, const struct mail_index_record *record)
+{
+    char file_path[256];
+    file_message_path(file_path, sizeof(file_path), mail_dir, user, record->id);
+    return remove(file_path) == 0;
+}
+
+static int file_scan(const char *mail_dir, const char *user, int with_headers, storage_scan_fn visit, void *ctx)
+{
+    char folder_path[256];
+    snprintf(folder_path, sizeof(folder_path), "%s/%s", mail_dir, user);
+
+    DIR *folder = opendir(folder_path);
+    if (!folder) return 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(folder)) != NULL)
+    {
+        if (!strstr(entry->d_name, ".msg")) continue;
+
+        struct mail_index_record record;
+        memset(&record, 0, sizeof(record));
+        record.id = (uint32_t)strtoul(entry->d_name, NULL, 10);
+
+        if (with_headers)
+        {
+            char file_path[512];
+            snprintf(file_path, sizeof(file_path), "%s/%s", folder_path, entry->d_name);
+            int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+            if (fd >= 0)
+            {
+                char peek[MESSAGE_HEADER_MAX];
+                struct stat st;
+                if (fstat(fd, &st) == 0) record.size = (uint64_t)st.st_size;
+                ssize_t n = pread(fd, peek, sizeof(peek), 0);
+                if (n > 0) parse_message_header(peek, (size_t)n, &record);
+                close(fd);
+            }
+        }
+
+        if (visit(&record, ctx) != 0) break;
+    }
+    closedir(folder);
+    return 1;
+}
+
+static void file_recover(const char *mail_dir, const char *user)
+{
+    (void)mail_dir;
+    (void)user; // Halbe Zustellungen liegen nur in tmp/, das räumt delivery_recover() auf
+}
+
+static void file_destroy(const char *mail_dir, const char *user)
+{
+    char folder_path[256];
+    snprintf(folder_path, sizeof(folder_path), "%s/%s", mail_dir, user);
+
+    DIR *folder = opendir(folder_path);
+    if (!folder) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(folder)) != NULL)
+    {
+        if (!strstr(entry->d_name, ".msg")) continue;
+        char file_path[512];
+        snprintf(file_path, sizeof(file_path), "%s/%s", folder_path, entry->d_name);
+        unlink(file_path);
+    }
+    closedir(folder);
+}
+
+const struct storage_backend file_storage =
+{
+    .name = "file",
+    .publish = file_publish,
+    .import = file_import,
+    .open_message = file_open_message,
+    .remove_message = file_remove_message,
+    .scan = file_scan,
+    .recover = file_recover,
+    .compact = NULL,
+    .destroy = file_destroy,
+};
+
+// -=- Hintergrund-Kompaktierung -=-
+
+void storage_start_compactor(const char *mail_dir)
+{
+    if (!active_storage->compact) return;
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        log_error("Compactor fork failed: %s", strerror(errno));
+        return;
+    }
+    if (pid > 0) return;
+
+    // Kindprozess: läuft neben den Client-Verbindungen, stirbt mit dem Server
+    signal(SIGCHLD, SIG_DFL);
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    while (1)
+    {
+        sleep(STORAGE_COMPACT_INTERVAL);
+
+        DIR *spool = opendir(mail_dir);
+        if (!spool) continue;
+
+        struct dirent *entry;
+        while ((entry = readdir(spool)) != NULL)
+        {
+            if (entry->d_name[0] == '.') continue;
+            active_storage->compact(mail_dir, entry->d_name);
+        }
+        closedir(spool);
+    }
+}
@@ -0,0 +1,287 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include "Headers/tls.h"
+
+#define TLS_SESSION_ID_CONTEXT "twmailer"
+
+static SSL_CTX *server_ctx = NULL;
+static SSL_CTX *client_ctx = NULL;
+static const char *session_path = NULL;
+static char error_text[256];
+
+static void remember_error(const char *what)
+{
+    unsigned long code = ERR_peek_last_error();
+    if (code) snprintf(error_text, sizeof(error_text), "%s: %s", what, ERR_reason_error_string(code));
+    else snprintf(error_text, sizeof(error_text), "%s: %s", what, errno ? strerror(errno) : "Verbindung beendet");
+    ERR_clear_error();
+}
+
+const char *tls_last_error(void)
+{
+    return error_text[0] ? error_text : "unbekannter Fehler";
+}
+
+// Gemeinsame Einstellungen: mindestens TLS 1.2, kTLS wenn der Kernel es kann,
+// SSL_write() verhält sich wie write() (Teilschreiben, Puffer darf wandern)
+static SSL_CTX *context_new(const SSL_METHOD *method)
+{
+    SSL_CTX *ctx = SSL_CTX_new(method);
+    if (!ctx) return NULL;
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_IGNORE_UNEXPECTED_EOF);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    return ctx;
+}
+
+// -=- Server -=-
+
+int tls_server_init(const char *cert_file, const char *key_file)
+{
+    error_text[0] = '\0';
+    server_ctx = context_new(TLS_server_method());
+    if (!server_ctx)
+    {
+        remember_error("SSL_CTX_new");
+        return 0;
+    }
+    if (SSL_CTX_use_certificate_chain_file(server_ctx, cert_file) != 1)
+    {
+        remember_error(cert_file);
+        goto fail;
+    }
+    if (SSL_CTX_use_PrivateKey_file(server_ctx, key_file ? key_file : cert_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(server_ctx) != 1)
+    {
+        remember_error(key_file ? key_file : cert_file);
+        goto fail;
+    }
+
+    // Wiederaufnahme nur über Tickets: die Schlüssel liegen im Kontext und
+    // werden beim fork() vererbt, ein Session-Cache wäre pro Prozess
+    SSL_CTX_set_session_cache_mode(server_ctx, SSL_SESS_CACHE_OFF);
+    SSL_CTX_set_session_id_context(server_ctx, (const unsigned char *)TLS_SESSION_ID_CONTEXT,
+                                   sizeof(TLS_SESSION_ID_CONTEXT) - 1);
+    SSL_CTX_set_num_tickets(server_ctx, 1);
+    return 1;
+
+fail:
+    SSL_CTX_free(server_ctx);
+    server_ctx = NULL;
+    return 0;
+}
+
+int tls_server_enabled(void)
+{
+    return server_ctx != NULL;
+}
+
+struct ssl_st *tls_server_new(int fd)
+{
+    SSL *ssl = SSL_new(server_ctx);
+    if (!ssl || SSL_set_fd(ssl, fd) != 1)
+    {
+        remember_error("SSL_new");
+        SSL_free(ssl);
+        return NULL;
+    }
+    SSL_set_accept_state(ssl);
+    return ssl;
+}
+
+// -=- Client -=-
+
+// Neues Ticket vom Server: für den nächsten Start speichern (erst temporär, dann rename)
+static int save_session(SSL *ssl, SSL_SESSION *session)
+{
+    (void)ssl;
+    char tmp_path[4096];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", session_path) >= (int)sizeof(tmp_path)) return 0;
+
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) return 0;
+    int ok = PEM_write_SSL_SESSION(f, session) == 1;
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp_path, session_path) != 0) unlink(tmp_path);
+    return 0; // Keine Referenz behalten
+}
+
+static SSL_SESSION *load_session(void)
+{
+    FILE *f = fopen(session_path, "r");
+    if (!f) return NULL;
+    SSL_SESSION *session = PEM_read_SSL_SESSION(f, NULL, NULL, NULL);
+    fclose(f);
+    ERR_clear_error();
+    return session;
+}
+
+int tls_client_init(const char *ca_file, const char *session_file)
+{
+    error_text[0] = '\0';
+    client_ctx = context_new(TLS_client_method());
+    if (!client_ctx)
+    {
+        remember_error("SSL_CTX_new");
+        return 0;
+    }
+
+    SSL_CTX_set_verify(client_ctx, SSL_VERIFY_PEER, NULL);
+    int loaded = ca_file ? SSL_CTX_load_verify_locations(client_ctx, ca_file, NULL)
+                         : SSL_CTX_set_default_verify_paths(client_ctx);
+    if (loaded != 1)
+    {
+        remember_error(ca_file ? ca_file : "CA-Verzeichnis");
+        SSL_CTX_free(client_ctx);
+        client_ctx = NULL;
+        return 0;
+    }
+
+    if (session_file)
+    {
+        session_path = session_file;
+        SSL_CTX_set_session_cache_mode(client_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(client_ctx, save_session);
+    }
+    return 1;
+}
+
+struct ssl_st *tls_client_connect(int fd, const char *host)
+{
+    SSL *ssl = SSL_new(client_ctx);
+    if (!ssl || SSL_set_fd(ssl, fd) != 1)
+    {
+        remember_error("SSL_new");
+        SSL_free(ssl);
+        return NULL;
+    }
+
+    SSL_set_connect_state(ssl);
+
+    // IP-Adressen gegen subjectAltName IP prüfen, Namen zusätzlich per SNI schicken
+    unsigned char addr[sizeof(struct in6_addr)];
+    int is_ip = inet_pton(AF_INET, host, addr) == 1 || inet_pton(AF_INET6, host, addr) == 1;
+    int ok = is_ip ? X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host)
+                   : SSL_set_tlsext_host_name(ssl, host) && SSL_set1_host(ssl, host);
+    if (!ok)
+    {
+        remember_error(host);
+        SSL_free(ssl);
+        return NULL;
+    }
+
+    if (session_path)
+    {
+        SSL_SESSION *session = load_session();
+        if (session)
+        {
+            SSL_set_session(ssl, session); // Abgelaufene Tickets lehnt der Server ab: voller Handshake
+            SSL_SESSION_free(session);
+        }
+    }
+
+    if (tls_handshake(ssl) != 1)
+    {
+        long verify = SSL_get_verify_result(ssl);
+        if (verify != X509_V_OK)
+        {
+            snprintf(error_text, sizeof(error_text), "Zertifikat: %s", X509_verify_cert_error_string(verify));
+        }
+        SSL_free(ssl);
+        return NULL;
+    }
+    return ssl;
+}
+
+// -=- Beide -=-
+
+int tls_handshake(struct ssl_st *ssl)
+{
+    ERR_clear_error();
+    int rc = SSL_do_handshake(ssl);
+    if (rc == 1) return 1;
+
+    int err = SSL_get_error(ssl, rc);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+    {
+        errno = EAGAIN;
+        return 0;
+    }
+    remember_error("Handshake");
+    return -1;
+}
+
+// SSL_get_error() auf errno abbilden, damit Aufrufer wie bei read()/write() reagieren
+static ssize_t io_result(SSL *ssl, int rc, const char *what)
+{
+    switch (SSL_get_error(ssl, rc))
+    {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0; // close_notify bzw. TCP EOF
+        case SSL_ERROR_SYSCALL:
+            if (errno == 0) errno = EPIPE;
+            ERR_clear_error();
+            return -1;
+        default:
+            remember_error(what);
+            errno = EPROTO;
+            return -1;
+    }
+}
+
+ssize_t tls_read(void *ssl, void *buf, size_t len)
+{
+    size_t n;
+    ERR_clear_error();
+    errno = 0;
+    int rc = SSL_read_ex(ssl, buf, len, &n);
+    if (rc == 1) return (ssize_t)n;
+    return io_result(ssl, rc, "SSL_read");
+}
+
+ssize_t tls_write(void *ssl, const void *buf, size_t len)
+{
+    size_t n;
+    ERR_clear_error();
+    errno = 0;
+    int rc = SSL_write_ex(ssl, buf, len, &n);
+    if (rc == 1) return (ssize_t)n;
+    return io_result(ssl, rc, "SSL_write");
+}
+
+int tls_ktls_send(struct ssl_st *ssl)
+{
+    return BIO_get_ktls_send(SSL_get_wbio(ssl)) ? 1 : 0;
+}
+
+int tls_session_reused(struct ssl_st *ssl)
+{
+    return SSL_session_reused(ssl);
+}
+
+const char *tls_version(struct ssl_st *ssl)
+{
+    return SSL_get_version(ssl);
+}
+
+void tls_free(struct ssl_st *ssl)
+{
+    if (!ssl) return;
+    ERR_clear_error();
+    if (SSL_is_init_finished(ssl)) SSL_shutdown(ssl);
+    ERR_clear_error();
+    SSL_free(ssl);
+}